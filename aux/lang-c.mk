@@ -0,0 +1,2 @@
+
+bin/scrotty: aux/scrotty.o aux/kern-linux.o aux/info.o aux/pattern.o aux/png.o aux/pixel.o aux/chunk.o aux/strips.o aux/delta.o aux/apng.o aux/raw.o aux/reduce.o aux/ring.o aux/stats.o aux/jobs.o aux/consumer.o aux/scale.o aux/sink.o aux/fastdeflate.o aux/qoi.o
@@ -0,0 +1,269 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "png.h"
+#include "chunk.h"
+#include "strips.h"
+#include "delta.h"
+#include "apng.h"
+
+
+/*
+ * Rationale:
+ * 
+ *   libpng does not support animated PNG files, unless it
+ *   has been patched, so the chunks are written directly.
+ *   The first frame is the default image and is stored in
+ *   full. Every other frame only covers the bounding box
+ *   of what has changed since the frame before it; it
+ *   replaces the pixels under it (blend operation SOURCE)
+ *   and is left on the canvas (dispose operation NONE), so
+ *   the unchanged parts of the screen are not stored or
+ *   compressed again. If nothing has changed, the frame
+ *   is a single unchanged pixel, because frames cannot
+ *   be empty.
+ */
+
+
+
+/**
+ * The frame shall be left as it is on the canvas
+ * when the next frame is rendered.
+ */
+#define DISPOSE_OP_NONE  0
+
+/**
+ * The frame shall replace the pixels under it.
+ */
+#define BLEND_OP_SOURCE  0
+
+
+
+/**
+ * Start writing an animated PNG file.
+ * 
+ * @param   apng    The animated PNG file, shall be zero-initialised.
+ * @param   imgfd   The file descriptor connected to conversion process's stdin.
+ * @param   width   The width of the animation.
+ * @param   height  The height of the animation.
+ * @param   frames  The number of frames.
+ * @return          Zero on success, -1 on error.
+ */
+int
+begin_apng (struct apng *restrict apng, int imgfd, long width, long height, long frames)
+{
+  size_t size = (size_t)width * 3 * (size_t)height * sizeof (png_byte);
+  unsigned char actl[8];
+  
+  apng->delta.image = malloc (size);
+  if (apng->delta.image == NULL)
+    return -1;
+  apng->delta.previous = malloc (size);
+  if (apng->delta.previous == NULL)
+    return -1;
+  apng->delta.width = width;
+  apng->delta.height = height;
+  
+  apng->file = fdopen_image (imgfd);
+  if (apng->file == NULL)
+    return -1;
+  if (write_png_head (apng->file, width, height, 8, PNG_COLOR_TYPE_RGB) < 0)
+    return -1;
+  
+  /* The number of frames, and the number of times to play them (0 for forever). */
+  PUT_UINT32 (actl + 0, (uint32_t)frames);
+  PUT_UINT32 (actl + 4, (uint32_t)0);
+  return write_png_chunk (apng->file, "acTL", actl, sizeof (actl));
+}
+
+
+/**
+ * Take a screenshot of a framebuffer into `apng->delta.image`,
+ * cropping or padding it to the size of the animation, should
+ * the resolution of the framebuffer have changed.
+ * 
+ * @param   apng    The animated PNG file.
+ * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   width   The width of the framebuffer.
+ * @param   height  The height of the framebuffer.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @return          Zero on success, -1 on error.
+ */
+static int
+snapshot_frame (struct apng *restrict apng, int fbfd, long width, long height, void *restrict data)
+{
+  struct delta *restrict delta = &(apng->delta);
+  size_t w3 = (size_t)(delta->width) * 3, n;
+  png_byte *image;
+  long y;
+  
+  if ((width == delta->width) && (height == delta->height))
+    return snapshot_fb (fbfd, delta->image, width, data);
+  
+  image = reserve_buffer (&(delta->stack), (size_t)width * 3 * (size_t)height * sizeof (png_byte));
+  if (image == NULL)
+    return -1;
+  if (snapshot_fb (fbfd, image, width, data) < 0)
+    return -1;
+  
+  n = width < delta->width ? (size_t)width * 3 : w3;
+  memset (delta->image, 0, w3 * (size_t)(delta->height));
+  for (y = 0; (y < height) && (y < delta->height); y++)
+    memcpy (delta->image + (size_t)y * w3, image + (size_t)y * (size_t)width * 3, n);
+  return 0;
+}
+
+
+/**
+ * Add a screenshot of a framebuffer to an animated PNG file.
+ * Only the part of the screenshot that has changed since
+ * the previous frame is stored.
+ * 
+ * @param   apng     The animated PNG file.
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the framebuffer.
+ * @param   height   The height of the framebuffer.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   delay    The number of milliseconds to show the frame.
+ * @param   threads  The number of threads to compress with.
+ * @return           Zero on success, -1 on error.
+ */
+int
+save_apng_frame (struct apng *restrict apng, int fbfd, long width, long height,
+		 void *restrict data, long delay, long threads)
+{
+  struct delta *restrict delta = &(apng->delta);
+  size_t w3 = (size_t)(delta->width) * 3;
+  unsigned char fctl[26], sequence[4];
+  long x = 0, y = 0, w = 1, h = 1, end;
+  unsigned long delay_den = 1000;
+  int first = (apng->sequence == 0);
+  png_byte *swap;
+  size_t i;
+  
+  if (snapshot_frame (apng, fbfd, width, height, data) < 0)
+    return -1;
+  
+  /* Get the bounding box of what has changed. */
+  if (first)
+    {
+      w = delta->width;
+      h = delta->height;
+    }
+  else if (find_tiles (delta) < 0)
+    return -1;
+  else if (delta->ntiles)
+    {
+      x = delta->tiles[0].x;
+      end = x + delta->tiles[0].width;
+      for (i = 1; i < delta->ntiles; i++)
+	{
+	  x = x < delta->tiles[i].x ? x : delta->tiles[i].x;
+	  end = end > delta->tiles[i].x + delta->tiles[i].width ? end : delta->tiles[i].x + delta->tiles[i].width;
+	}
+      w = end - x;
+      y = delta->tiles[0].y;
+      h = delta->tiles[delta->ntiles - 1].y + delta->tiles[delta->ntiles - 1].height - y;
+    }
+  
+  /* The delay is stored as a 16-bit fraction. */
+  for (; delay > 0xFFFFL && delay_den > 1; delay /= 10, delay_den /= 10);
+  if (delay > 0xFFFFL)
+    delay = 0xFFFFL;
+  
+  /* Write the frame control chunk. */
+  PUT_UINT32 (fctl + 0, apng->sequence);
+  PUT_UINT32 (fctl + 4, (uint32_t)w);
+  PUT_UINT32 (fctl + 8, (uint32_t)h);
+  PUT_UINT32 (fctl + 12, (uint32_t)x);
+  PUT_UINT32 (fctl + 16, (uint32_t)y);
+  fctl[20] = (unsigned char)(delay >> 8), fctl[21] = (unsigned char)delay;
+  fctl[22] = (unsigned char)(delay_den >> 8), fctl[23] = (unsigned char)delay_den;
+  fctl[24] = DISPOSE_OP_NONE;
+  fctl[25] = BLEND_OP_SOURCE;
+  apng->sequence++;
+  if (write_png_chunk (apng->file, "fcTL", fctl, sizeof (fctl)) < 0)
+    return -1;
+  
+  /* Write the frame, the first frame is the default image. */
+  if (first)
+    {
+      if (write_png_image_chunk (apng->file, "IDAT", NULL, 0, delta->image,
+				 (size_t)w * 3, h, w3, 3, threads) < 0)
+	return -1;
+    }
+  else
+    {
+      PUT_UINT32 (sequence, apng->sequence);
+      apng->sequence++;
+      if (write_png_image_chunk (apng->file, "fdAT", sequence, sizeof (sequence),
+				 delta->image + (size_t)y * w3 + (size_t)x * 3,
+				 (size_t)w * 3, h, w3, 3, threads) < 0)
+	return -1;
+    }
+  
+  /* The current frame is the previous one for the next frame. */
+  swap = delta->image;
+  delta->image = delta->previous;
+  delta->previous = swap;
+  return 0;
+}
+
+
+/**
+ * Finish writing an animated PNG file, and close it.
+ * 
+ * @param   apng  The animated PNG file.
+ * @return        Zero on success, -1 on error.
+ */
+int
+end_apng (struct apng *restrict apng)
+{
+  FILE *file = apng->file;
+  int saved_errno;
+  
+  apng->file = NULL;
+  if (write_png_chunk (file, "IEND", NULL, 0) < 0)
+    goto fail;
+  if (fflush (file))
+    goto fail;
+  return fclose (file) ? -1 : 0;
+ fail:
+  saved_errno = errno;
+  fclose (file);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Release the resources of a `struct apng`,
+ * without finishing the file.
+ * 
+ * @param  apng  The animated PNG file.
+ */
+void
+destroy_apng (struct apng *restrict apng)
+{
+  if (apng->file != NULL)
+    fclose (apng->file);
+  apng->file = NULL;
+  destroy_delta (&(apng->delta));
+}
+
@@ -0,0 +1,86 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * An animated PNG file that is being written.
+ */
+struct apng
+{
+  /**
+   * The output image file.
+   */
+  FILE *file;
+  
+  /**
+   * The current and previous frame, and what has changed.
+   */
+  struct delta delta;
+  
+  /**
+   * The sequence number of the next fcTL or fdAT chunk.
+   */
+  uint32_t sequence;
+};
+
+
+
+/**
+ * Start writing an animated PNG file.
+ * 
+ * @param   apng    The animated PNG file, shall be zero-initialised.
+ * @param   imgfd   The file descriptor connected to conversion process's stdin.
+ * @param   width   The width of the animation.
+ * @param   height  The height of the animation.
+ * @param   frames  The number of frames.
+ * @return          Zero on success, -1 on error.
+ */
+int begin_apng (struct apng *restrict apng, int imgfd, long width, long height, long frames);
+
+/**
+ * Add a screenshot of a framebuffer to an animated PNG file.
+ * Only the part of the screenshot that has changed since
+ * the previous frame is stored.
+ * 
+ * @param   apng     The animated PNG file.
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the framebuffer.
+ * @param   height   The height of the framebuffer.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   delay    The number of milliseconds to show the frame.
+ * @param   threads  The number of threads to compress with.
+ * @return           Zero on success, -1 on error.
+ */
+int save_apng_frame (struct apng *restrict apng, int fbfd, long width, long height,
+		     void *restrict data, long delay, long threads);
+
+/**
+ * Finish writing an animated PNG file, and close it.
+ * 
+ * @param   apng  The animated PNG file.
+ * @return        Zero on success, -1 on error.
+ */
+int end_apng (struct apng *restrict apng);
+
+/**
+ * Release the resources of a `struct apng`,
+ * without finishing the file.
+ * 
+ * @param  apng  The animated PNG file.
+ */
+void destroy_apng (struct apng *restrict apng);
+
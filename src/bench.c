@@ -0,0 +1,711 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "kern.h"
+#include "png.h"
+#include "strips.h"
+#include "pattern.h"
+#include "raw.h"
+#include "scale.h"
+#include "qoi.h"
+
+
+
+/*
+ * This program measures how fast screenshots are taken, without
+ * a real console. Synthetic framebuffers are written to temporary
+ * files as raw framebuffer dumps, which are opened as if they were
+ * framebuffers, just like with --convert. Each stage is run
+ * repeatedly for at least `MIN_DURATION` nanoseconds.
+ * 
+ * Run it with `make bench`.
+ */
+
+
+
+/**
+ * The minimum number of nanoseconds each stage is measured for.
+ */
+#define MIN_DURATION  250000000L
+
+/**
+ * The width of a character cell in the text fixtures.
+ */
+#define CELL_WIDTH  8
+
+/**
+ * The height of a character cell in the text fixtures.
+ */
+#define CELL_HEIGHT  16
+
+
+
+/**
+ * `argv[0]` from `main`.
+ */
+const char *execname;
+
+/**
+ * If a function fails when it tries to
+ * open a file, it will set this variable
+ * point to the pathname of that file.
+ */
+const char *failure_file = NULL;
+
+/**
+ * If a function fails for a reason that
+ * `errno` cannot describe, it will set this
+ * variable to a description of the reason.
+ */
+const char *failure_reason = NULL;
+
+
+
+/**
+ * What a synthetic framebuffer shows.
+ */
+enum content
+{
+  /**
+   * A console with lines of text of different
+   * lengths and colours, on a black background.
+   */
+  TEXT,
+  
+  /**
+   * Smooth gradients, with many colours.
+   */
+  GRADIENT,
+  
+  /**
+   * Random pixels, which cannot be compressed.
+   */
+  NOISE
+};
+
+/**
+ * A synthetic framebuffer.
+ */
+struct fixture
+{
+  /**
+   * The name of the content.
+   */
+  const char *name;
+  
+  /**
+   * What the framebuffer shows.
+   */
+  enum content content;
+  
+  /**
+   * The width of the image.
+   */
+  long width;
+  
+  /**
+   * The height of the image.
+   */
+  long height;
+  
+  /**
+   * The number of bits per pixel, 8 means
+   * that the pixels are indices into a
+   * colour map.
+   */
+  int bits_per_pixel;
+  
+  /**
+   * The number of dead pixels at the
+   * end of each line.
+   */
+  long hblank;
+  
+  /**
+   * The number of dead pixels at the beginning
+   * of each line, as if the framebuffer was panned.
+   */
+  long xoffset;
+};
+
+/**
+ * A synthetic framebuffer that is being measured.
+ */
+struct bench
+{
+  /**
+   * File descriptor for the framebuffer.
+   */
+  int fbfd;
+  
+  /**
+   * File descriptor for /dev/null.
+   */
+  int nullfd;
+  
+  /**
+   * The width of the image.
+   */
+  long width;
+  
+  /**
+   * The height of the image.
+   */
+  long height;
+  
+  /**
+   * Data from `measure`.
+   */
+  void *data;
+  
+  /**
+   * Buffer for the image.
+   */
+  struct buffer buffer;
+  
+  /**
+   * Buffer for the scaled down image.
+   */
+  struct buffer reduced;
+};
+
+
+
+/**
+ * The synthetic framebuffers.
+ */
+static const struct fixture fixtures[] =
+  {
+    {"text",     TEXT,      640,  480, 32,  0,  0},
+    {"text",     TEXT,     1024,  768, 32,  0,  0},
+    {"text",     TEXT,     1920, 1080, 32,  0,  0},
+    {"gradient", GRADIENT, 1024,  768, 32,  0,  0},
+    {"noise",    NOISE,    1024,  768, 32,  0,  0},
+    {"text",     TEXT,     1024,  768, 24,  0,  0},
+    {"text",     TEXT,     1024,  768, 16,  0,  0},
+    {"gradient", GRADIENT, 1024,  768, 16,  0,  0},
+    {"text",     TEXT,     1024,  768,  8,  0,  0},
+    {"text",     TEXT,     1024,  768, 32, 64,  0},
+    {"text",     TEXT,     1024,  768, 32, 32, 32},
+  };
+
+/**
+ * The 16 colours of the console, the colour
+ * map also starts with these colours.
+ */
+static const unsigned char console_colours[16][3] =
+  {
+    {  0,   0,   0}, {170,   0,   0}, {  0, 170,   0}, {170,  85,   0},
+    {  0,   0, 170}, {170,   0, 170}, {  0, 170, 170}, {170, 170, 170},
+    { 85,  85,  85}, {255,  85,  85}, { 85, 255,  85}, {255, 255,  85},
+    { 85,  85, 255}, {255,  85, 255}, { 85, 255, 255}, {255, 255, 255}
+  };
+
+
+
+/**
+ * Scramble an integer, to get
+ * reproducible pseudorandom values.
+ * 
+ * @param   x  The integer.
+ * @return     The scrambled integer.
+ */
+static uint32_t
+mix (uint32_t x)
+{
+  x ^= x >> 16;
+  x *= UINT32_C(0x7feb352d);
+  x ^= x >> 15;
+  x *= UINT32_C(0x846ca68b);
+  x ^= x >> 16;
+  return x;
+}
+
+
+/**
+ * Get the colour of a pixel in a synthetic framebuffer.
+ * 
+ * @param   f    The fixture.
+ * @param   x    The column of the pixel.
+ * @param   y    The row of the pixel.
+ * @param   rgb  Output parameter for the red, green, and blue values.
+ * @return       The index of the colour in the colour map if it is
+ *               one of the first 16 colours, otherwise -1 and the
+ *               colour is stored in `rgb`.
+ */
+static int
+get_colour (const struct fixture *restrict f, long x, long y, unsigned char rgb[3])
+{
+  uint32_t line = (uint32_t)(y / CELL_HEIGHT), column = (uint32_t)(x / CELL_WIDTH);
+  uint32_t columns = (uint32_t)(f->width / CELL_WIDTH), cell = line * columns + column;
+  uint32_t cx = (uint32_t)(x % CELL_WIDTH), cy = (uint32_t)(y % CELL_HEIGHT), h;
+  int i;
+  
+  switch (f->content)
+    {
+    case TEXT:
+      /* Lines of different lengths, with some blank characters, and
+         glyphs that do not fill their cells, in one colour per line. */
+      if ((column >= mix (line) % columns) || (mix (cell) % 6 == 0))
+	return 0;
+      if ((cx < 1) || (cx > 6) || (cy < 3) || (cy > 13))
+	return 0;
+      if (mix (cell * 128 + cy * 8 + cx) % 3)
+	return 0;
+      return 7 + (int)(mix (line) % 9);
+      
+    case GRADIENT:
+      rgb[0] = (unsigned char)(x * 255 / f->width);
+      rgb[1] = (unsigned char)(y * 255 / f->height);
+      rgb[2] = (unsigned char)((x + y) * 255 / (f->width + f->height));
+      return -1;
+      
+    case NOISE:
+    default:
+      h = mix ((uint32_t)(y * f->width + x));
+      for (i = 0; i < 3; i++)
+	rgb[i] = (unsigned char)(h >> (8 * i));
+      return -1;
+    }
+}
+
+
+/**
+ * Create a synthetic framebuffer, as a raw framebuffer
+ * dump in a temporary file, and measure it.
+ * 
+ * @param   f  The fixture.
+ * @param   b  Output parameter for the framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+create_fixture (const struct fixture *restrict f, struct bench *restrict b)
+{
+  struct raw_header header;
+  const char *tmpdir = getenv ("TMPDIR");
+  char *path = NULL;
+  unsigned char *line = NULL, rgb[3], *p;
+  size_t bytespp = (size_t)(f->bits_per_pixel / 8), linesize, off;
+  long x, y;
+  ssize_t r;
+  uint32_t v;
+  uint16_t v16;
+  int i, index, saved_errno;
+  
+  memset (b, 0, sizeof (*b));
+  b->fbfd = -1;
+  
+  /* Open a temporary file, that is deleted when it is closed. */
+  if ((tmpdir == NULL) || !*tmpdir)
+    tmpdir = "/tmp";
+  path = malloc (strlen (tmpdir) + sizeof ("/scrotty-bench-XXXXXX"));
+  if (path == NULL)
+    goto fail;
+  sprintf (path, "%s/scrotty-bench-XXXXXX", tmpdir);
+  b->fbfd = mkstemp (path);
+  if (b->fbfd < 0)
+    goto fail;
+  unlink (path);
+  
+  /* Describe the framebuffer. */
+  memset (&header, 0, sizeof (header));
+  header.width = (unsigned long)(f->width);
+  header.height = (unsigned long)(f->height);
+  header.xoffset = (unsigned long)(f->xoffset);
+  header.line_length = (unsigned long)(f->xoffset + f->width + f->hblank) * bytespp;
+  header.bits_per_pixel = (unsigned long)(f->bits_per_pixel);
+  if (f->bits_per_pixel == 16)
+    {
+      header.red.offset = 11, header.red.length = 5;
+      header.green.offset = 5, header.green.length = 6;
+      header.blue.offset = 0, header.blue.length = 5;
+    }
+  else if (f->bits_per_pixel == 8)
+    {
+      header.red.length = header.green.length = header.blue.length = 8;
+      header.colours = 256;
+      /* The console colours, followed by a 6-by-6-by-6 colour cube. */
+      for (i = 0; i < 256; i++)
+	{
+	  if (i < 16)
+	    memcpy (header.palette + 3 * i, console_colours[i], 3);
+	  else if (i < 16 + 216)
+	    {
+	      header.palette[3 * i + 0] = (unsigned char)((i - 16) / 36 * 51);
+	      header.palette[3 * i + 1] = (unsigned char)((i - 16) / 6 % 6 * 51);
+	      header.palette[3 * i + 2] = (unsigned char)((i - 16) % 6 * 51);
+	    }
+	}
+    }
+  else
+    {
+      header.red.offset = 16, header.red.length = 8;
+      header.green.offset = 8, header.green.length = 8;
+      header.blue.offset = 0, header.blue.length = 8;
+    }
+  if (write_raw_header (b->fbfd, &header) < 0)
+    goto fail;
+  
+  /* Draw the framebuffer, the pixels are stored in the CPU's byte order. */
+  linesize = (size_t)(header.line_length);
+  line = calloc (linesize, 1);
+  if (line == NULL)
+    goto fail;
+  for (y = 0; y < f->height; y++)
+    {
+      for (x = 0; x < f->width; x++)
+	{
+	  index = get_colour (f, x, y, rgb);
+	  if (index >= 0)
+	    memcpy (rgb, console_colours[index], 3);
+	  p = line + (size_t)(f->xoffset + x) * bytespp;
+	  if (f->bits_per_pixel == 8)
+	    *p = (unsigned char)(index >= 0 ? index : 16 + rgb[0] / 43 * 36 + rgb[1] / 43 * 6 + rgb[2] / 43);
+	  else if (f->bits_per_pixel == 16)
+	    {
+	      v16 = (uint16_t)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+	      memcpy (p, &v16, 2);
+	    }
+	  else
+	    {
+	      v = ((uint32_t)(rgb[0]) << 16) | ((uint32_t)(rgb[1]) << 8) | (uint32_t)(rgb[2]);
+	      memcpy (p, &v, bytespp);
+	    }
+	}
+      for (off = 0; off < linesize; off += (size_t)r)
+	{
+	  r = write (b->fbfd, line + off, linesize - off);
+	  if (r < 0)
+	    goto fail;
+	}
+    }
+  
+  /* Measure it, as if it was a framebuffer. */
+  if (measure (0, b->fbfd, &(b->width), &(b->height), &(b->data)) < 0)
+    goto fail;
+  b->nullfd = open ("/dev/null", O_WRONLY);
+  if (b->nullfd < 0)
+    goto fail;
+  
+  free (path);
+  free (line);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (b->fbfd >= 0)
+    close (b->fbfd);
+  free (path);
+  free (line);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Release a synthetic framebuffer created with `create_fixture`.
+ * 
+ * @param  b  The framebuffer.
+ */
+static void
+destroy_fixture (struct bench *restrict b)
+{
+  close (b->fbfd);
+  close (b->nullfd);
+  release_fb (b->data);
+  free (b->buffer.buf);
+  free (b->reduced.buf);
+}
+
+
+/**
+ * Copy the framebuffer into memory, as
+ * is done before anything else.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_copy (struct bench *restrict b)
+{
+  size_t n;
+  if (rewind_fb (b->fbfd, b->data) < 0)
+    return -1;
+  return copy_fb (b->fbfd, &n, b->data) ? 0 : -1;
+}
+
+
+/**
+ * Convert the copy of the framebuffer to PNG pixel data,
+ * with `convert_fb_to_png`. The copy is only made once.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_convert (struct bench *restrict b)
+{
+  if (reserve_buffer (&(b->buffer), (size_t)(b->width) * 3 * (size_t)(b->height)) == NULL)
+    return -1;
+  return snapshot_fb (b->fbfd, b->buffer.buf, b->width, b->data);
+}
+
+
+/**
+ * Scale down the PNG pixel data, from the convert
+ * stage, to a thumbnail that fits in 256 by 256 pixels.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_thumbnail (struct bench *restrict b)
+{
+  long width, height;
+  thumbnail_size (b->width, b->height, 256, &width, &height);
+  if (reserve_buffer (&(b->reduced), (size_t)width * 3 * (size_t)height) == NULL)
+    return -1;
+  return downscale (b->buffer.buf, b->width, b->height, b->reduced.buf, width, height);
+}
+
+
+/**
+ * Take a screenshot with `save_png`, and write it to /dev/null.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_save_png (struct bench *restrict b)
+{
+  if (rewind_fb (b->fbfd, b->data) < 0)
+    return -1;
+  return save_png (b->fbfd, b->width, b->height, b->nullfd, b->data, &(b->buffer));
+}
+
+
+/**
+ * Take a screenshot with `save_png_strips` and the built-in
+ * encoder, in one thread, and write it to /dev/null.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_save_fast (struct bench *restrict b)
+{
+  int r;
+  if (rewind_fb (b->fbfd, b->data) < 0)
+    return -1;
+  use_fast_encoder (1);
+  r = save_png_strips (b->fbfd, b->width, b->height, b->nullfd, b->data, 1, &(b->buffer));
+  use_fast_encoder (0);
+  return r;
+}
+
+
+/**
+ * Take a screenshot with `save_qoi`, and write it to /dev/null.
+ * 
+ * @param   b  The framebuffer.
+ * @return     Zero on success, -1 on error.
+ */
+static int
+stage_save_qoi (struct bench *restrict b)
+{
+  if (rewind_fb (b->fbfd, b->data) < 0)
+    return -1;
+  return save_qoi (b->fbfd, b->width, b->height, b->nullfd, b->data, &(b->buffer));
+}
+
+
+/**
+ * Get the number of nanoseconds since an earlier point in time.
+ * 
+ * @param   start  The earlier point in time.
+ * @return         The number of nanoseconds since `start`, -1 on error.
+ */
+static double
+nanoseconds_since (const struct timespec *restrict start)
+{
+  struct timespec now;
+  if (clock_gettime (CLOCK_MONOTONIC, &now))
+    return -1;
+  return (double)(now.tv_sec - start->tv_sec) * 1000000000.0 + (double)(now.tv_nsec - start->tv_nsec);
+}
+
+
+/**
+ * Measure how long a stage takes.
+ * 
+ * @param   stage  The stage.
+ * @param   b      The framebuffer.
+ * @return         The average number of nanoseconds
+ *                 the stage takes, -1 on error.
+ */
+static double
+measure_stage (int (*stage) (struct bench *restrict), struct bench *restrict b)
+{
+  struct timespec start;
+  double elapsed;
+  long n;
+  
+  /* Warm up, so that buffers are allocated and the file is cached. */
+  if (stage (b) < 0)
+    return -1;
+  
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    return -1;
+  for (n = 1;; n++)
+    {
+      if (stage (b) < 0)
+	return -1;
+      elapsed = nanoseconds_since (&start);
+      if (elapsed < 0)
+	return -1;
+      if (elapsed >= MIN_DURATION)
+	return elapsed / (double)n;
+    }
+}
+
+
+/**
+ * Measure how long it takes to evaluate a pattern,
+ * the pattern is compiled once, before the timing.
+ * 
+ * @param   pattern  The pattern.
+ * @param   path     The filename of the image, `NULL`
+ *                   if `pattern` is a filename pattern.
+ * @return           The average number of nanoseconds
+ *                   it takes to evaluate the pattern,
+ *                   -1 on error.
+ */
+static double
+measure_evaluate (const char *restrict pattern, const char *restrict path)
+{
+  struct pattern compiled;
+  struct timespec start;
+  double elapsed = -1;
+  char *result;
+  long n;
+  
+  if (compile_pattern (&compiled, pattern, path != NULL) < 0)
+    return -1;
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    goto done;
+  for (n = 1;; n++)
+    {
+      result = evaluate (&compiled, 0, n, 1024, 768, path);
+      if (result == NULL)
+	{
+	  elapsed = -1;
+	  break;
+	}
+      free (result);
+      elapsed = nanoseconds_since (&start);
+      if (elapsed < 0)
+	break;
+      if (elapsed >= MIN_DURATION)
+	{
+	  elapsed /= (double)n;
+	  break;
+	}
+    }
+ done:
+  free_pattern (&compiled);
+  return elapsed;
+}
+
+
+/**
+ * Measure how fast screenshots are taken
+ * of synthetic framebuffers, and print
+ * the results.
+ * 
+ * @param   argc  The number of elements in `argv`.
+ * @param   argv  Command line arguments, none are recognised.
+ * @return        Zero on and only on success.
+ */
+int
+main (int argc, char *argv[])
+{
+  static const struct
+  {
+    const char *name;
+    int (*function) (struct bench *restrict);
+  } stages[] =
+    {
+      {"copy",      stage_copy},
+      {"convert",   stage_convert},
+      {"thumbnail", stage_thumbnail},
+      {"save_png",  stage_save_png},
+      {"save_fast", stage_save_fast},
+      {"save_qoi",  stage_save_qoi},
+    };
+  
+  const struct fixture *f;
+  struct bench b;
+  char name[64];
+  double ns, pixels, bytes;
+  size_t i, j;
+  
+  execname = argc ? *argv : "bench";
+  
+  printf ("%-42s %-10s %12s %12s\n", "FRAMEBUFFER", "STAGE", "MB/s", "ns/pixel");
+  for (i = 0; i < sizeof (fixtures) / sizeof (*fixtures); i++)
+    {
+      f = fixtures + i;
+      snprintf (name, sizeof (name), "%s %lix%li %ibpp", f->name, f->width, f->height, f->bits_per_pixel);
+      if (f->hblank)
+	snprintf (name + strlen (name), sizeof (name) - strlen (name), " hblank=%li", f->hblank);
+      if (f->xoffset)
+	snprintf (name + strlen (name), sizeof (name) - strlen (name), " xoffset=%li", f->xoffset);
+      
+      if (create_fixture (f, &b) < 0)
+	goto fail;
+      pixels = (double)(f->width) * (double)(f->height);
+      bytes = pixels * (double)(f->bits_per_pixel / 8);
+      for (j = 0; j < sizeof (stages) / sizeof (*stages); j++)
+	{
+	  ns = measure_stage (stages[j].function, &b);
+	  if (ns < 0)
+	    {
+	      destroy_fixture (&b);
+	      goto fail;
+	    }
+	  printf ("%-42s %-10s %12.1f %12.3f\n", name, stages[j].name, bytes / ns * 1000.0, ns / pixels);
+	  fflush (stdout);
+	}
+      destroy_fixture (&b);
+    }
+  
+  printf ("\n%-42s %-10s %12s\n", "PATTERN", "STAGE", "ns/call");
+#define X(PATTERN, PATH)									\
+  if ((ns = measure_evaluate (PATTERN, PATH)) < 0)						\
+    goto fail;											\
+  printf ("%-42s %-10s %12.1f\n", PATTERN, "evaluate", ns)
+  X ("%Y-%m-%d_%H:%M:%S_$wx$h.$i.png", NULL);
+  X ("%Y-%m-%d_%H:%M:%S_$wx$h.$i.$c.png", NULL);
+  X ("optipng -- $f", "/tmp/screenshot.png");
+#undef X
+  
+  return 0;
+ fail:
+  perror (execname);
+  return 1;
+}
@@ -0,0 +1,117 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "chunk.h"
+
+#include <zlib.h>
+
+
+
+/**
+ * Write the PNG file signature and the IHDR chunk.
+ * 
+ * @param   file    The output image file.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   depth   The bit depth.
+ * @param   colour  The colour type, for example `PNG_COLOR_TYPE_RGB`.
+ * @return          Zero on success, -1 on error.
+ */
+int
+write_png_head (FILE *file, long width, long height, int depth, int colour)
+{
+  static const unsigned char signature[] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  unsigned char ihdr[13];
+  
+  PUT_UINT32 (ihdr + 0, (uint32_t)width);
+  PUT_UINT32 (ihdr + 4, (uint32_t)height);
+  ihdr[8] = (unsigned char)depth;
+  ihdr[9] = (unsigned char)colour;
+  ihdr[10] = 0; /* Compression method: deflate. */
+  ihdr[11] = 0; /* Filter method: adaptive. */
+  ihdr[12] = 0; /* Interlace method: none. */
+  
+  if (fwrite (signature, sizeof (signature), 1, file) != 1)
+    return -1;
+  return write_png_chunk (file, "IHDR", ihdr, sizeof (ihdr));
+}
+
+
+/**
+ * Write a chunk to a PNG file.
+ * 
+ * @param   file  The output image file.
+ * @param   type  The chunk type, four characters.
+ * @param   data  The chunk data.
+ * @param   n     The size of the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int
+write_png_chunk (FILE *file, const char *type, const void *data, size_t n)
+{
+  uLong crc = crc32 (0, (const Bytef *)type, 4);
+  if (n)
+    crc = crc32 (crc, data, (uInt)n);
+  
+  if (write_png_chunk_head (file, type, n) < 0)
+    return -1;
+  if (n && (fwrite (data, n, 1, file) != 1))
+    return -1;
+  return write_png_crc (file, (uint32_t)crc);
+}
+
+
+/**
+ * Write the beginning of a chunk to a PNG file,
+ * the caller shall write the chunk data and then
+ * the CRC with `write_png_crc`.
+ * 
+ * @param   file  The output image file.
+ * @param   type  The chunk type, four characters.
+ * @param   n     The size of the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int
+write_png_chunk_head (FILE *file, const char *type, size_t n)
+{
+  unsigned char head[8];
+  
+  if (n > 0x7FFFFFFFUL)
+    return errno = EFBIG, -1;
+  
+  PUT_UINT32 (head, (uint32_t)n);
+  memcpy (head + 4, type, 4);
+  return fwrite (head, sizeof (head), 1, file) == 1 ? 0 : -1;
+}
+
+
+/**
+ * Write the CRC of a chunk to a PNG file.
+ * 
+ * @param   file  The output image file.
+ * @param   crc   The CRC-32 of the chunk type and the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int
+write_png_crc (FILE *file, uint32_t crc)
+{
+  unsigned char buf[4];
+  PUT_UINT32 (buf, crc);
+  return fwrite (buf, sizeof (buf), 1, file) == 1 ? 0 : -1;
+}
@@ -0,0 +1,80 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+/**
+ * Store a 32-bit unsigned integer, in network byte order
+ * (big endian,) as all integers in PNG files are stored.
+ * 
+ * @param  BUF:unsigned char *  The buffer to store the integer in.
+ * @param  VALUE:uint32_t       The value to store.
+ */
+#define PUT_UINT32(BUF, VALUE)				\
+  ((BUF)[0] = (unsigned char)((VALUE) >> 24),		\
+   (BUF)[1] = (unsigned char)((VALUE) >> 16),		\
+   (BUF)[2] = (unsigned char)((VALUE) >> 8),		\
+   (BUF)[3] = (unsigned char)((VALUE) >> 0))
+
+
+/**
+ * Write the PNG file signature and the IHDR chunk.
+ * 
+ * @param   file    The output image file.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   depth   The bit depth.
+ * @param   colour  The colour type, for example `PNG_COLOR_TYPE_RGB`.
+ * @return          Zero on success, -1 on error.
+ */
+int write_png_head (FILE *file, long width, long height, int depth, int colour);
+
+/**
+ * Write a chunk to a PNG file.
+ * 
+ * @param   file  The output image file.
+ * @param   type  The chunk type, four characters.
+ * @param   data  The chunk data.
+ * @param   n     The size of the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int write_png_chunk (FILE *file, const char *type, const void *data, size_t n);
+
+/**
+ * Write the beginning of a chunk to a PNG file,
+ * the caller shall write the chunk data and then
+ * the CRC with `write_png_crc`.
+ * 
+ * @param   file  The output image file.
+ * @param   type  The chunk type, four characters.
+ * @param   n     The size of the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int write_png_chunk_head (FILE *file, const char *type, size_t n);
+
+/**
+ * Write the CRC of a chunk to a PNG file.
+ * 
+ * @param   file  The output image file.
+ * @param   crc   The CRC-32 of the chunk type and the chunk data.
+ * @return        Zero on success, -1 on error.
+ */
+int write_png_crc (FILE *file, uint32_t crc);
@@ -76,3 +76,10 @@ extern const char *execname;
  */
 extern const char *failure_file;
 
+/**
+ * If a function fails for a reason that
+ * `errno` cannot describe, it will set this
+ * variable to a description of the reason.
+ */
+extern const char *failure_reason;
+
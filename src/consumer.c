@@ -0,0 +1,228 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE /* For memfd_create. */
+#include "common.h"
+#include "consumer.h"
+#include "chunk.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * The write end of the consumer's stdin, -1 if not started.
+ */
+static int consumer_fd = -1;
+
+/**
+ * The consumer's process ID.
+ */
+static pid_t consumer_pid;
+
+/**
+ * Keeps images sent by different threads from being mixed.
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * Start the program that all images are sent to.
+ * 
+ * @param   args  The command and its arguments, `NULL`-terminated.
+ * @return        Zero on success, -1 on error.
+ */
+int
+start_consumer (char *const *args)
+{
+  posix_spawn_file_actions_t actions;
+  int fds[2], r, saved_errno;
+  
+  /* The write end is not inherited, so that the
+     consumer sees the end of its input. */
+  if (pipe2 (fds, O_CLOEXEC))
+    return -1;
+  if ((r = posix_spawn_file_actions_init (&actions)))
+    goto fail;
+  r = posix_spawn_file_actions_adddup2 (&actions, fds[0], STDIN_FILENO);
+  if (r == 0)
+    r = posix_spawnp (&consumer_pid, *args, &actions, NULL, args, environ);
+  posix_spawn_file_actions_destroy (&actions);
+  if (r)
+    {
+      failure_file = *args;
+      goto fail;
+    }
+  
+  close (fds[0]);
+  consumer_fd = fds[1];
+  return 0;
+ fail:
+  saved_errno = r;
+  close (fds[0]);
+  close (fds[1]);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Close the consumer's stdin, and wait for it to exit.
+ * 
+ * @return  Zero on success, -1 on error,
+ *          1 if the consumer failed.
+ */
+int
+stop_consumer (void)
+{
+  int status;
+  
+  if (consumer_fd < 0)
+    return 0;
+  close (consumer_fd);
+  consumer_fd = -1;
+  while (waitpid (consumer_pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return -1;
+  return status ? 1 : 0;
+}
+
+
+/**
+ * Create a file, in memory, to save an image in,
+ * before it is sent to the consumer with `send_image`.
+ * 
+ * @return  The file descriptor of the file, -1 on error.
+ */
+int
+open_consumer_image (void)
+{
+  return memfd_create ("scrotty", MFD_CLOEXEC);
+}
+
+
+/**
+ * Write a buffer to the consumer.
+ * 
+ * @param   buf  The buffer.
+ * @param   n    The size of the buffer.
+ * @return       Zero on success, -1 on error.
+ */
+static int
+write_consumer (const unsigned char *restrict buf, size_t n)
+{
+  ssize_t r;
+  size_t i;
+  
+  for (i = 0; i < n; i += (size_t)r)
+    {
+      r = write (consumer_fd, buf + i, n - i);
+      if (r < 0)
+	{
+	  if (errno != EINTR)
+	    return -1;
+	  r = 0;
+	}
+    }
+  return 0;
+}
+
+
+/**
+ * Send an image to the consumer, after its header.
+ * Images sent by different threads are not mixed.
+ * 
+ * @param   imgfd   The file descriptor returned by `open_consumer_image`,
+ *                  it is not closed.
+ * @param   fbno    The number of the framebuffer.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   taken   When the screenshot was taken.
+ * @param   format  The format of the image, 4 characters.
+ * @return          Zero on success, -1 on error.
+ */
+int
+send_image (int imgfd, int fbno, long width, long height,
+	    const struct timespec *restrict taken, const char *restrict format)
+{
+  unsigned char header[CONSUMER_HEADER_SIZE];
+  uint64_t seconds = (uint64_t)(taken->tv_sec);
+  uint64_t size;
+  struct stat attr;
+  enum stage stage;
+  off_t off = 0;
+  ssize_t r;
+  int saved_errno;
+  
+  if (fstat (imgfd, &attr))
+    return -1;
+  size = (uint64_t)(attr.st_size);
+  
+  PUT_UINT32 (header + 0, (uint32_t)CONSUMER_HEADER_SIZE);
+  PUT_UINT32 (header + 4, (uint32_t)fbno);
+  PUT_UINT32 (header + 8, (uint32_t)width);
+  PUT_UINT32 (header + 12, (uint32_t)height);
+  PUT_UINT32 (header + 16, (uint32_t)(seconds >> 32));
+  PUT_UINT32 (header + 20, (uint32_t)seconds);
+  PUT_UINT32 (header + 24, (uint32_t)(taken->tv_nsec));
+  memcpy (header + 28, format, 4);
+  PUT_UINT32 (header + 32, (uint32_t)(size >> 32));
+  PUT_UINT32 (header + 36, (uint32_t)size);
+  
+  /* The image is copied from the file in the kernel, without
+     being read into this process. The time it takes is counted
+     as writing, but not the bytes, since they were counted
+     when the image was written to the file. */
+  stage = enter_stage (STAGE_WRITE);
+  pthread_mutex_lock (&mutex);
+  if (write_consumer (header, sizeof (header)) < 0)
+    goto fail;
+  while ((uint64_t)off < size)
+    {
+      r = sendfile (consumer_fd, imgfd, &off, (size_t)(size - (uint64_t)off));
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  goto fail;
+	}
+      if (r == 0)
+	{
+	  errno = EIO;
+	  goto fail;
+	}
+    }
+  pthread_mutex_unlock (&mutex);
+  enter_stage (stage);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  pthread_mutex_unlock (&mutex);
+  enter_stage (stage);
+  errno = saved_errno;
+  return -1;
+}
@@ -0,0 +1,89 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+
+/**
+ * The size of the header, in bytes, that precedes
+ * each image sent to the consumer with `send_image`.
+ * 
+ * The header is, with all integers unsigned and
+ * in network byte order (big endian):
+ * 
+ *   Offset  Size  Field
+ *        0     4  The size of the header, 40. Fields
+ *                 may be added, after the image size,
+ *                 in a later version, so the consumer
+ *                 should skip the rest of the header.
+ *        4     4  The number of the framebuffer.
+ *        8     4  The width of the image.
+ *       12     4  The height of the image.
+ *       16     8  When the screenshot was taken, the
+ *                 number of seconds since the Epoch.
+ *       24     4  The nanoseconds of that time.
+ *       28     4  The format of the image, 4 ASCII
+ *                 characters: "png ", "qoi " or "raw ".
+ *       32     8  The size of the image, in bytes,
+ *                 which follows the header.
+ */
+#define CONSUMER_HEADER_SIZE  40
+
+
+
+/**
+ * Start the program that all images are sent to.
+ * 
+ * @param   args  The command and its arguments, `NULL`-terminated.
+ * @return        Zero on success, -1 on error.
+ */
+int start_consumer (char *const *args);
+
+/**
+ * Close the consumer's stdin, and wait for it to exit.
+ * 
+ * @return  Zero on success, -1 on error,
+ *          1 if the consumer failed.
+ */
+int stop_consumer (void);
+
+/**
+ * Create a file, in memory, to save an image in,
+ * before it is sent to the consumer with `send_image`.
+ * 
+ * @return  The file descriptor of the file, -1 on error.
+ */
+int open_consumer_image (void);
+
+/**
+ * Send an image to the consumer, after its header.
+ * Images sent by different threads are not mixed.
+ * 
+ * @param   imgfd   The file descriptor returned by `open_consumer_image`,
+ *                  it is not closed.
+ * @param   fbno    The number of the framebuffer.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   taken   When the screenshot was taken.
+ * @param   format  The format of the image, 4 characters.
+ * @return          Zero on success, -1 on error.
+ */
+int send_image (int imgfd, int fbno, long width, long height,
+		const struct timespec *restrict taken, const char *restrict format);
+
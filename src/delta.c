@@ -0,0 +1,295 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "png.h"
+#include "strips.h"
+#include "delta.h"
+
+
+/*
+ * Rationale:
+ * 
+ *   When the same framebuffer is screenshot over and
+ *   over again, most of it is usually unchanged. Rather
+ *   than compressing the whole image every time, only
+ *   the rows that have changed, and only the columns in
+ *   them that have changed, are stored. Changed rows
+ *   that are close to each other are merged into the
+ *   same tile, so that a blinking cursor or a line of
+ *   text does not become a pile of tiny tiles. The tiles
+ *   are stacked on top of each other into a small PNG
+ *   image, and a tEXt chunk with the keyword
+ *   "scrotty-delta" tells where they belong:
+ * 
+ *     keyframe K       index of the last full screenshot
+ *     base B           index of the screenshot this one
+ *                      is relative to (the previous one)
+ *     size W H         size of the full screenshot
+ *     tile X Y W H     one line per tile, in the order
+ *                      they are stacked, narrower tiles
+ *                      are padded on the right
+ * 
+ *   To rebuild a screenshot, start with the keyframe and
+ *   paste the tiles of each following screenshot onto it,
+ *   in order. If there are no changes, the image is a
+ *   single black pixel and there are no tiles.
+ */
+
+
+
+/**
+ * The number of unchanged rows between two changed
+ * rows, at which they are put in different tiles.
+ */
+#define MERGE_GAP  8
+
+/**
+ * If more than 1 of `KEYFRAME_SHARE` pixels
+ * have changed, a keyframe is written instead.
+ */
+#define KEYFRAME_SHARE  2
+
+
+
+/**
+ * Get the columns that have changed in a row.
+ * 
+ * @param  cur     The row in the current frame.
+ * @param  prev    The row in the previous frame, must differ from `cur`.
+ * @param  width3  The width of the image multiplied by 3.
+ * @param  left    Output parameter for the left-most changed column.
+ * @param  right   Output parameter for the column after the right-most changed column.
+ */
+static void
+changed_columns (const png_byte *restrict cur, const png_byte *restrict prev,
+		 long width3, long *restrict left, long *restrict right)
+{
+  long l = 0, r = width3;
+  while (cur[l] == prev[l])
+    l++;
+  while (cur[r - 1] == prev[r - 1])
+    r--;
+  *left = l / 3;
+  *right = (r + 2) / 3;
+}
+
+
+/**
+ * Find the tiles that have changed since the previous frame,
+ * and store them in `delta->tiles`.
+ * 
+ * @param   delta  The state of the framebuffer.
+ * @return         The number of changed pixels, -1 on error.
+ */
+long
+find_tiles (struct delta *restrict delta)
+{
+  long y, left, right, end, width3 = delta->width * 3, area = 0;
+  const png_byte *cur = delta->image;
+  const png_byte *prev = delta->previous;
+  struct tile *tile = NULL;
+  void *new;
+  size_t i;
+  
+  delta->ntiles = 0;
+  for (y = 0; y < delta->height; y++, cur += width3, prev += width3)
+    {
+      if (!memcmp (cur, prev, (size_t)width3))
+	continue;
+      changed_columns (cur, prev, width3, &left, &right);
+      
+      /* Close to the last tile? Grow it. */
+      if ((tile != NULL) && (y - (tile->y + tile->height) < MERGE_GAP))
+	{
+	  end = tile->x + tile->width;
+	  tile->x = tile->x < left ? tile->x : left;
+	  tile->width = (end > right ? end : right) - tile->x;
+	  tile->height = y - tile->y + 1;
+	  continue;
+	}
+      
+      /* Otherwise, start a new tile. */
+      if (delta->ntiles == delta->tiles_size)
+	{
+	  delta->tiles_size = delta->tiles_size ? (delta->tiles_size << 1) : 8;
+	  new = realloc (delta->tiles, delta->tiles_size * sizeof (*(delta->tiles)));
+	  if (new == NULL)
+	    return -1;
+	  delta->tiles = new;
+	}
+      tile = delta->tiles + delta->ntiles++;
+      tile->x = left;
+      tile->y = y;
+      tile->width = right - left;
+      tile->height = 1;
+    }
+  
+  for (i = 0; i < delta->ntiles; i++)
+    area += delta->tiles[i].width * delta->tiles[i].height;
+  return area;
+}
+
+
+/**
+ * Create an PNG file with the changed tiles
+ * stacked on top of each other.
+ * 
+ * @param   delta    The state of the framebuffer.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   frame    The index of the screenshot.
+ * @param   threads  The number of threads to compress with.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+save_tiles (struct delta *restrict delta, int imgfd, long frame, long threads)
+{
+  long width = 1, height = 0, y, width3 = delta->width * 3;
+  png_byte *stack, *row;
+  const struct tile *tile;
+  char *text = NULL;
+  size_t i, n, size;
+  int rc = -1, saved_errno;
+  
+  /* Get the size of the stack. */
+  for (i = 0; i < delta->ntiles; i++)
+    {
+      width = width > delta->tiles[i].width ? width : delta->tiles[i].width;
+      height += delta->tiles[i].height;
+    }
+  
+  /* Stack the tiles. */
+  stack = reserve_buffer (&(delta->stack), (size_t)width * 3 * (size_t)(height ? height : 1));
+  if (stack == NULL)
+    return -1;
+  memset (stack, 0, (size_t)width * 3 * (size_t)(height ? height : 1));
+  for (row = stack, i = 0; i < delta->ntiles; i++)
+    for (tile = delta->tiles + i, y = tile->y; y < tile->y + tile->height; y++, row += width * 3)
+      memcpy (row, delta->image + y * width3 + tile->x * 3, (size_t)(tile->width) * 3);
+  
+  /* Write the manifest. */
+  size = 3 * 24 + 4 * 24 + delta->ntiles * (5 + 4 * 21) + sizeof ("scrotty-delta");
+  text = malloc (size);
+  if (text == NULL)
+    return -1;
+  n = sizeof ("scrotty-delta");
+  memcpy (text, "scrotty-delta", n);
+  n += (size_t)sprintf (text + n, "keyframe %li\nbase %li\nsize %li %li\n",
+			delta->keyframe, frame - 1, delta->width, delta->height);
+  for (i = 0; i < delta->ntiles; i++)
+    n += (size_t)sprintf (text + n, "tile %li %li %li %li\n",
+			  delta->tiles[i].x, delta->tiles[i].y,
+			  delta->tiles[i].width, delta->tiles[i].height);
+  
+  rc = encode_png_strips (stack, width, height ? height : 1, imgfd, threads, text, n);
+  
+  saved_errno = errno;
+  free (text);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Create an PNG file, with only the part of the
+ * framebuffer that has changed since the previous
+ * time, or the entire framebuffer if it is time
+ * for a keyframe.
+ * 
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   frame    The index of the screenshot.
+ * @param   threads  The number of threads to compress with.
+ * @param   delta    The state of the framebuffer, shall be zero-initialised
+ *                   with `keyframe` set to -1 before the first screenshot.
+ * @return           Zero on success, -1 on error.
+ */
+int
+save_png_delta (int fbfd, long width, long height, int imgfd, void *restrict data,
+		long frame, long threads, struct delta *restrict delta)
+{
+  size_t size = (size_t)width * 3 * (size_t)height * sizeof (png_byte);
+  int keyframe = 0;
+  png_byte *swap;
+  void *new;
+  long area;
+  
+  /* The first screenshot, or a screenshot after the resolution has
+     changed, cannot be relative to the previous screenshot. */
+  if ((delta->keyframe < 0) || (width != delta->width) || (height != delta->height))
+    {
+      delta->keyframe = -1;
+      new = realloc (delta->image, size);
+      if (new == NULL)
+	return -1;
+      delta->image = new;
+      new = realloc (delta->previous, size);
+      if (new == NULL)
+	return -1;
+      delta->previous = new;
+      delta->width = width;
+      delta->height = height;
+      keyframe = 1;
+    }
+  
+  /* Read the entire framebuffer, and compare it to the previous one. */
+  if (snapshot_fb (fbfd, delta->image, width, data) < 0)
+    return -1;
+  if (!keyframe)
+    {
+      area = find_tiles (delta);
+      if (area < 0)
+	return -1;
+      keyframe = area > width * height / KEYFRAME_SHARE;
+    }
+  
+  /* Write the whole image, or just the changes. */
+  if (keyframe)
+    {
+      if (encode_png_strips (delta->image, width, height, imgfd, threads, NULL, 0) < 0)
+	return -1;
+      delta->keyframe = frame;
+    }
+  else if (save_tiles (delta, imgfd, frame, threads) < 0)
+    return -1;
+  
+  /* The current screenshot is the previous one for the next screenshot. */
+  swap = delta->image;
+  delta->image = delta->previous;
+  delta->previous = swap;
+  return 0;
+}
+
+
+/**
+ * Release the resources of a `struct delta`.
+ * 
+ * @param  delta  The state of the framebuffer.
+ */
+void
+destroy_delta (struct delta *restrict delta)
+{
+  free (delta->image);
+  free (delta->previous);
+  free (delta->stack.buf);
+  free (delta->tiles);
+}
+
@@ -0,0 +1,134 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * A changed rectangle of the image.
+ */
+struct tile
+{
+  /**
+   * The left-most column.
+   */
+  long x;
+  
+  /**
+   * The top-most row.
+   */
+  long y;
+  
+  /**
+   * The number of columns.
+   */
+  long width;
+  
+  /**
+   * The number of rows.
+   */
+  long height;
+};
+
+/**
+ * The state of a framebuffer that is screenshot
+ * repeatedly with delta frames.
+ */
+struct delta
+{
+  /**
+   * The current frame.
+   */
+  png_byte *image;
+  
+  /**
+   * The previous frame.
+   */
+  png_byte *previous;
+  
+  /**
+   * The changed tiles, stacked on top of each other.
+   */
+  struct buffer stack;
+  
+  /**
+   * The changed tiles.
+   */
+  struct tile *tiles;
+  
+  /**
+   * The number of elements in `tiles`.
+   */
+  size_t ntiles;
+  
+  /**
+   * The allocation size of `tiles`.
+   */
+  size_t tiles_size;
+  
+  /**
+   * The width of the frames.
+   */
+  long width;
+  
+  /**
+   * The height of the frames.
+   */
+  long height;
+  
+  /**
+   * The index of the last keyframe, -1 if none.
+   */
+  long keyframe;
+};
+
+
+
+/**
+ * Find the tiles that have changed since the previous frame,
+ * and store them in `delta->tiles`.
+ * 
+ * @param   delta  The state of the framebuffer.
+ * @return         The number of changed pixels, -1 on error.
+ */
+long find_tiles (struct delta *restrict delta);
+
+/**
+ * Create an PNG file, with only the part of the
+ * framebuffer that has changed since the previous
+ * time, or the entire framebuffer if it is time
+ * for a keyframe.
+ * 
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   frame    The index of the screenshot.
+ * @param   threads  The number of threads to compress with.
+ * @param   delta    The state of the framebuffer, shall be zero-initialised
+ *                   with `keyframe` set to -1 before the first screenshot.
+ * @return           Zero on success, -1 on error.
+ */
+int save_png_delta (int fbfd, long width, long height, int imgfd, void *restrict data,
+		    long frame, long threads, struct delta *restrict delta);
+
+/**
+ * Release the resources of a `struct delta`.
+ * 
+ * @param  delta  The state of the framebuffer.
+ */
+void destroy_delta (struct delta *restrict delta);
+
@@ -0,0 +1,443 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "fastdeflate.h"
+
+#include <pthread.h>
+
+
+/*
+ * Rationale:
+ * 
+ *   zlib looks hard for the best matches, and builds Huffman
+ *   codes fitted to the data, which pays off for photos. A
+ *   console is flat colours and the same glyphs over and over,
+ *   which, once filtered, is mostly long runs of zeroes and
+ *   matches that are found at the first attempt. Looking once,
+ *   and using the fixed Huffman codes, the image is compressed
+ *   several times faster, and is only a little larger.
+ */
+
+
+
+/**
+ * The size of the deflate window.
+ */
+#define WINDOW_SIZE  32768
+
+/**
+ * The shortest match that is used.
+ */
+#define MIN_MATCH  4
+
+/**
+ * The longest match deflate can express.
+ */
+#define MAX_MATCH  258
+
+/**
+ * The number of bits in the hash of 4 bytes.
+ */
+#define HASH_BITS  15
+
+/**
+ * Matches shorter than this have all their
+ * positions added to the hash table.
+ */
+#define MAX_INSERT  32
+
+
+
+/**
+ * A code, and its length in bits,
+ * ready to be put in the bit stream.
+ */
+struct code
+{
+  /**
+   * The bits, in the order they are put
+   * in the stream, least significant first.
+   */
+  uint32_t bits;
+  
+  /**
+   * The number of bits.
+   */
+  uint32_t count;
+};
+
+/**
+ * Output bit stream.
+ */
+struct stream
+{
+  /**
+   * Where the next byte is written.
+   */
+  unsigned char *out;
+  
+  /**
+   * Bits that have not been written.
+   */
+  uint64_t bits;
+  
+  /**
+   * The number of bits in `bits`.
+   */
+  unsigned count;
+};
+
+
+
+/**
+ * The fixed codes for each literal, and for the end of block.
+ */
+static struct code literal_codes[257];
+
+/**
+ * The fixed codes for each match length, including the extra bits.
+ */
+static struct code length_codes[MAX_MATCH + 1];
+
+/**
+ * The fixed codes for each distance, including the
+ * extra bits, indexed by `distance_index`.
+ */
+static struct code distance_codes[512];
+
+/**
+ * The first distance of each distance code, indexed by `distance_index`.
+ */
+static unsigned short distance_base[512];
+
+/**
+ * Makes sure the tables are only built once.
+ */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+
+
+/**
+ * Get the index in the distance tables for a distance;
+ * the same as in zlib, so that it only takes 512 entries.
+ * 
+ * @param   D:size_t  The distance.
+ * @return            The index.
+ */
+#define distance_index(D)  \
+  (((D) <= 256) ? (D) - 1 : 256 + (((D) - 1) >> 7))
+
+
+/**
+ * Reverse the order of the bits in a Huffman code; they
+ * are defined most significant bit first, but the stream
+ * is written least significant bit first.
+ * 
+ * @param   code   The code.
+ * @param   count  The number of bits in the code.
+ * @return         The reversed code.
+ */
+static uint32_t
+reverse_bits (uint32_t code, uint32_t count)
+{
+  uint32_t reversed = 0;
+  while (count--)
+    reversed = (reversed << 1) | (code & 1), code >>= 1;
+  return reversed;
+}
+
+
+/**
+ * Get the fixed Huffman code of a literal/length symbol.
+ * 
+ * @param   symbol  The symbol.
+ * @return          The code.
+ */
+static struct code
+fixed_code (uint32_t symbol)
+{
+  struct code code;
+  if (symbol < 144)
+    code.bits = 0x30 + symbol, code.count = 8;
+  else if (symbol < 256)
+    code.bits = 0x190 + (symbol - 144), code.count = 9;
+  else if (symbol < 280)
+    code.bits = symbol - 256, code.count = 7;
+  else
+    code.bits = 0xC0 + (symbol - 280), code.count = 8;
+  code.bits = reverse_bits (code.bits, code.count);
+  return code;
+}
+
+
+/**
+ * Build the tables of codes.
+ */
+static void
+build_tables (void)
+{
+  static const unsigned short length_base[29] =
+    {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+  static const unsigned short dist_base[30] =
+    {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+      513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+  
+  struct code code;
+  uint32_t symbol, extra, length, distance, i, end;
+  
+  for (symbol = 0; symbol < 257; symbol++)
+    literal_codes[symbol] = fixed_code (symbol);
+  
+  /* Length 258 also fits in the range of symbol 284, but has a
+     symbol of its own, which is why the last symbol comes last. */
+  for (symbol = 0; symbol < 29; symbol++)
+    {
+      code = fixed_code (257 + symbol);
+      extra = ((symbol < 8) || (symbol == 28)) ? 0 : (symbol - 4) / 4;
+      end = length_base[symbol] + (1U << extra);
+      for (length = length_base[symbol]; (length < end) && (length <= MAX_MATCH); length++)
+	{
+	  length_codes[length].bits = code.bits | ((length - length_base[symbol]) << code.count);
+	  length_codes[length].count = code.count + extra;
+	}
+    }
+  
+  for (symbol = 0; symbol < 30; symbol++)
+    {
+      extra = (symbol < 4) ? 0 : (symbol - 2) / 2;
+      end = dist_base[symbol] + (1U << extra);
+      for (distance = dist_base[symbol]; distance < end; distance++)
+	{
+	  i = distance_index (distance);
+	  distance_codes[i].bits = reverse_bits (symbol, 5);
+	  distance_codes[i].count = 5 + extra;
+	  distance_base[i] = dist_base[symbol];
+	}
+    }
+}
+
+
+/**
+ * Put bits in the output stream.
+ * 
+ * @param  stream  The output stream.
+ * @param  bits    The bits, least significant first.
+ * @param  count   The number of bits, at most 32.
+ */
+static inline void
+put_bits (struct stream *restrict stream, uint32_t bits, unsigned count)
+{
+  stream->bits |= (uint64_t)bits << stream->count;
+  stream->count += count;
+  if (stream->count >= 32)
+    {
+      stream->out[0] = (unsigned char)(stream->bits >> 0);
+      stream->out[1] = (unsigned char)(stream->bits >> 8);
+      stream->out[2] = (unsigned char)(stream->bits >> 16);
+      stream->out[3] = (unsigned char)(stream->bits >> 24);
+      stream->out += 4;
+      stream->bits >>= 32;
+      stream->count -= 32;
+    }
+}
+
+
+/**
+ * Write the bits that are left in the output
+ * stream, padded to a byte boundary.
+ * 
+ * @param  stream  The output stream.
+ */
+static void
+flush_bits (struct stream *restrict stream)
+{
+  for (; stream->count > 0; stream->count -= stream->count < 8 ? stream->count : 8)
+    *stream->out++ = (unsigned char)stream->bits, stream->bits >>= 8;
+}
+
+
+/**
+ * Hash the 4 bytes at a position.
+ * 
+ * @param   p  The position.
+ * @return     The hash.
+ */
+static inline uint32_t
+hash (const unsigned char *restrict p)
+{
+  uint32_t v;
+  memcpy (&v, p, 4);
+  return (v * UINT32_C (2654435761)) >> (32 - HASH_BITS);
+}
+
+
+/**
+ * Get the number of equal bytes at two positions.
+ * 
+ * @param   a    The first position.
+ * @param   b    The second position, before `a`; they may overlap.
+ * @param   max  The number of bytes to compare at most.
+ * @return       The number of equal bytes.
+ */
+static inline size_t
+match_length (const unsigned char *a, const unsigned char *b, size_t max)
+{
+  uint64_t x, y;
+  size_t n = 0;
+  for (; n + 8 <= max; n += 8)
+    {
+      memcpy (&x, a + n, 8);
+      memcpy (&y, b + n, 8);
+      if (x != y)
+	break;
+    }
+  while ((n < max) && (a[n] == b[n]))
+    n++;
+  return n;
+}
+
+
+/**
+ * Get the largest number of bytes `fast_deflate`
+ * can output for a block.
+ * 
+ * @param   n  The number of bytes in the block.
+ * @return     The largest possible size of the compressed block.
+ */
+size_t
+fast_deflate_bound (size_t n)
+{
+  /* A literal is at most 9 bits, and a match is never longer
+     than the literals it replaces. Then the block header, the
+     end of the block and the sync flush, and 4 bytes of slack. */
+  return n + n / 8 + 16;
+}
+
+
+/**
+ * Compress a block of data as a deflate block with the fixed
+ * Huffman codes, which takes no time to set up, with greedy
+ * matching, which finds the long runs of equal bytes and
+ * repeated glyphs that screens are made of at little cost.
+ * 
+ * The block may refer to data before it, which is the
+ * end of the previous block. The block ends on a byte
+ * boundary, so that blocks can be concatenated.
+ * 
+ * @param   out      Output buffer, `fast_deflate_bound (n)` bytes.
+ * @param   in       The data before the block, followed by the block.
+ * @param   dictlen  The number of bytes before the block in `in`.
+ * @param   n        The number of bytes in the block.
+ * @param   last     Whether this is the last block of the stream.
+ * @return           The number of bytes written to `out`, 0 on error.
+ */
+size_t
+fast_deflate (unsigned char *restrict out, const unsigned char *restrict in,
+	      size_t dictlen, size_t n, int last)
+{
+#define INSERT(POS)							\
+  (h = hash (in + (POS)) << 1,						\
+   table[h + 1] = table[h],						\
+   table[h] = (uint32_t)((POS) + 1))
+  
+  struct stream stream = {out, 0, 0};
+  uint32_t *restrict table;
+  size_t i, j, end = dictlen + n, max, len, best, dist = 0, cand, d;
+  uint32_t h, k;
+  
+  pthread_once (&tables_once, build_tables);
+  
+  /* Two positions for each hash, stored plus one, so that zero means none. */
+  table = calloc ((size_t)2 << HASH_BITS, sizeof (*table));
+  if (table == NULL)
+    return 0;
+  
+  /* The end of the previous block is within reach. */
+  for (i = dictlen > WINDOW_SIZE ? dictlen - WINDOW_SIZE : 0; (i < dictlen) && (i + 4 <= end); i++)
+    INSERT (i);
+  
+  /* A single block, with BTYPE 01 for the fixed codes. */
+  put_bits (&stream, last ? 3 : 2, 3);
+  
+  for (i = dictlen; i + MIN_MATCH <= end;)
+    {
+      max = end - i < MAX_MATCH ? end - i : MAX_MATCH;
+      best = 0;
+      
+      /* Runs are most common, and need no lookup. */
+      if (i && (in[i - 1] == in[i]))
+	best = match_length (in + i, in + i - 1, max), dist = 1;
+      
+      /* The two most recent positions with the same hash. */
+      h = hash (in + i) << 1;
+      for (k = 0; k < 2; k++)
+	{
+	  cand = table[h + k];
+	  if (cand-- && (best < max) && (i - cand <= WINDOW_SIZE))
+	    {
+	      len = match_length (in + i, in + cand, max);
+	      if (len > best)
+		best = len, dist = i - cand;
+	    }
+	}
+      INSERT (i);
+      
+      if (best < MIN_MATCH)
+	{
+	  put_bits (&stream, literal_codes[in[i]].bits, literal_codes[in[i]].count);
+	  i++;
+	  continue;
+	}
+      
+      d = distance_index (dist);
+      put_bits (&stream, length_codes[best].bits, length_codes[best].count);
+      put_bits (&stream, distance_codes[d].bits | (uint32_t)((dist - distance_base[d]) << 5),
+		distance_codes[d].count);
+      
+      if (best < MAX_INSERT)
+	for (j = i + 1; (j < i + best) && (j + 4 <= end); j++)
+	  INSERT (j);
+      i += best;
+    }
+  for (; i < end; i++)
+    put_bits (&stream, literal_codes[in[i]].bits, literal_codes[in[i]].count);
+  
+  /* End of block. */
+  put_bits (&stream, literal_codes[256].bits, literal_codes[256].count);
+  if (!last)
+    {
+      /* Sync flush: an empty stored block, which is byte aligned. */
+      put_bits (&stream, 0, 3);
+      flush_bits (&stream);
+      *stream.out++ = 0x00, *stream.out++ = 0x00;
+      *stream.out++ = 0xFF, *stream.out++ = 0xFF;
+    }
+  else
+    flush_bits (&stream);
+  
+  free (table);
+  return (size_t)(stream.out - out);
+  
+#undef INSERT
+}
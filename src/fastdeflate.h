@@ -0,0 +1,50 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+
+
+
+/**
+ * Get the largest number of bytes `fast_deflate`
+ * can output for a block.
+ * 
+ * @param   n  The number of bytes in the block.
+ * @return     The largest possible size of the compressed block.
+ */
+size_t fast_deflate_bound (size_t n);
+
+/**
+ * Compress a block of data as a deflate block with the fixed
+ * Huffman codes, which takes no time to set up, with greedy
+ * matching, which finds the long runs of equal bytes and
+ * repeated glyphs that screens are made of at little cost.
+ * 
+ * The block may refer to data before it, which is the
+ * end of the previous block. The block ends on a byte
+ * boundary, so that blocks can be concatenated.
+ * 
+ * @param   out      Output buffer, `fast_deflate_bound (n)` bytes.
+ * @param   in       The data before the block, followed by the block.
+ * @param   dictlen  The number of bytes before the block in `in`.
+ * @param   n        The number of bytes in the block.
+ * @param   last     Whether this is the last block of the stream.
+ * @return           The number of bytes written to `out`, 0 on error.
+ */
+size_t fast_deflate (unsigned char *restrict out, const unsigned char *restrict in,
+		     size_t dictlen, size_t n, int last);
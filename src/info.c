@@ -38,6 +38,25 @@ print_help (void)
 		   "\t-c, --copyright    Print copyright information.\n"
 		   "\t-d, --device NO    Select framebuffer device.\n"
 		   "\t-e, --exec CMD     Command to run for each saved image.\n"
+		   "\t-s, --simultaneous Screenshot all framebuffers at the same time.\n"
+		   "\t-t, --threads N    Compress each image with N threads (0 for all CPUs).\n"
+		   "\t    --interval MS  Take a screenshot every MS milliseconds.\n"
+		   "\t    --count N      Take N screenshots of each framebuffer (0 for no limit).\n"
+		   "\t    --delta        Only store what changed since the previous screenshot.\n"
+		   "\t    --apng         Store all screenshots of a framebuffer in one animated PNG.\n"
+		   "\t    --raw          Dump the framebuffers without converting them.\n"
+		   "\t    --convert FILE Convert a dump, or a directory of dumps, to an image.\n"
+		   "\t    --timing       Report how long reading and encoding took.\n"
+		   "\t    --snapshot     Copy each framebuffer into memory before converting it.\n"
+		   "\t    --stats[=FILE] Print statistics for each framebuffer as JSON.\n"
+		   "\t    --jobs N       Run at most N --exec commands at once (0 for all CPUs).\n"
+		   "\t    --pipe-to CMD  Send all images to one command's stdin, each with a header.\n"
+		   "\t    --daemon PATH  Take screenshots on request over the Unix socket PATH.\n"
+		   "\t    --crop X,Y,W,H Only capture the W by H pixels at column X and line Y.\n"
+		   "\t    --scale PCT    Save the images scaled down to PCT percent of the size.\n"
+		   "\t    --thumbnail N  Also save thumbnails that fit in N by N pixels.\n"
+		   "\t    --encoder ENC  Compress with 'zlib' (default), or the faster 'fast'.\n"
+		   "\t    --format FMT   Save as 'png' (default), or as the faster 'qoi'.\n"
 		   "\n"
 		   "\tEach option can only be used once."
 		   "\n"
@@ -50,6 +69,7 @@ print_help (void)
 		   "\tby '$' or '\\'. The following specifiers are recognised:\n"
 		   "\n"
 		   "\t$i  framebuffer index\n"
+		   "\t$c  screenshot index, when taking multiple screenshots\n"
 		   "\t$f  image filename/pathname (ignored when used in filename-pattern)\n"
 		   "\t$n  image filename          (ignored when used in filename-pattern)\n"
 		   "\t$p  image width multiplied by image height\n"
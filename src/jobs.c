@@ -0,0 +1,275 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE /* For wait4. */
+#include "common.h"
+#include "stats.h"
+#include "jobs.h"
+
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * A command that is running.
+ */
+struct job
+{
+  /**
+   * The command's process ID.
+   */
+  pid_t pid;
+  
+  /**
+   * The statistics to count the command's CPU time in.
+   */
+  struct stats *stats;
+};
+
+
+
+/**
+ * The commands that are running.
+ */
+static struct job *jobs = NULL;
+
+/**
+ * The number of commands that are running.
+ */
+static size_t running = 0;
+
+/**
+ * The number of commands that may run at the same time.
+ */
+static size_t max_running = 0;
+
+/**
+ * Is a thread waiting for a command to exit?
+ */
+static int reaping = 0;
+
+/**
+ * The number of commands that have failed.
+ */
+static unsigned long failed = 0;
+
+/**
+ * Protects the variables above.
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Signalled when a command has exited.
+ */
+static pthread_cond_t exited = PTHREAD_COND_INITIALIZER;
+
+
+
+/**
+ * Select how many commands, for the images,
+ * may run at the same time, and forget all
+ * commands started before.
+ * 
+ * This must not be called while another
+ * thread is using the other functions.
+ * 
+ * @param   limit  The number of commands, at least 1.
+ * @return         Zero on success, -1 on error.
+ */
+int
+init_jobs (size_t limit)
+{
+  struct job *new;
+  
+  new = realloc (jobs, limit * sizeof (*jobs));
+  if (new == NULL)
+    return -1;
+  jobs = new;
+  max_running = limit;
+  running = 0;
+  failed = 0;
+  return 0;
+}
+
+
+/**
+ * Release the resources allocated by `init_jobs`.
+ */
+void
+destroy_jobs (void)
+{
+  free (jobs);
+  jobs = NULL;
+  max_running = 0;
+}
+
+
+/**
+ * Wait until a command has exited. Only one thread
+ * waits for the commands at a time, the other
+ * threads wait for that thread instead.
+ * 
+ * This must be called with `mutex` locked,
+ * and at least one command running.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int
+reap_job (void)
+{
+  struct rusage usage;
+  pid_t pid;
+  size_t i;
+  int status, r, saved_errno;
+  
+  if (reaping)
+    {
+      if ((r = pthread_cond_wait (&exited, &mutex)))
+	return errno = r, -1;
+      return 0;
+    }
+  
+  /* The lock is not held while waiting, so that
+     other threads can start commands meanwhile. */
+  reaping = 1;
+  pthread_mutex_unlock (&mutex);
+  pid = wait4 (-1, &status, 0, &usage);
+  saved_errno = errno;
+  pthread_mutex_lock (&mutex);
+  reaping = 0;
+  pthread_cond_broadcast (&exited);
+  
+  if (pid == -1)
+    return saved_errno == EINTR ? 0 : (errno = saved_errno, -1);
+  for (i = 0; i < running; i++)
+    if (jobs[i].pid == pid)
+      break;
+  if (i == running)
+    return 0; /* Not one of the commands. */
+  
+  count_exec (jobs[i].stats, &usage);
+  if (status)
+    failed++;
+  jobs[i] = jobs[--running];
+  return 0;
+}
+
+
+/**
+ * Start a command for an image, without waiting for it
+ * to exit. If the maximum number of commands are already
+ * running, this waits until one of them has exited.
+ * 
+ * If the command cannot be started, this is reported and
+ * counted as a failed command, rather than as an error.
+ * 
+ * @param   args   The command and its arguments, `NULL`-terminated.
+ * @param   stats  The statistics to count the command's CPU time
+ *                 in, `NULL` for none. This must not be used by
+ *                 the caller until `wait_jobs` has returned.
+ * @return         Zero on success, -1 on error.
+ */
+int
+start_job (char *const *args, struct stats *restrict stats)
+{
+  pid_t pid;
+  int r, saved_errno;
+  
+  pthread_mutex_lock (&mutex);
+  while (running == max_running)
+    if (reap_job () < 0)
+      goto fail;
+  
+  /* posix_spawnp does not copy the process, as fork does,
+     so it does not get slower as the images get larger. */
+  r = posix_spawnp (&pid, *args, NULL, NULL, args, environ);
+  if (r)
+    {
+      fprintf (stderr, _("%s: %s: %s\n"), execname, strerror (r), *args);
+      failed++;
+    }
+  else
+    {
+      jobs[running].pid = pid;
+      jobs[running].stats = stats;
+      running++;
+    }
+  
+  pthread_mutex_unlock (&mutex);
+  return 0;
+ fail:
+  saved_errno = errno;
+  pthread_mutex_unlock (&mutex);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Wait until commands have exited.
+ * 
+ * @param   stats  The statistics passed to `start_job` for the
+ *                 commands, `NULL` to wait for all commands.
+ * @return         Zero on success, -1 on error.
+ */
+int
+wait_jobs (struct stats *restrict stats)
+{
+  size_t i;
+  int saved_errno;
+  
+  pthread_mutex_lock (&mutex);
+  for (;;)
+    {
+      for (i = 0; i < running; i++)
+	if ((stats == NULL) || (jobs[i].stats == stats))
+	  break;
+      if (i == running)
+	break;
+      if (reap_job () < 0)
+	goto fail;
+    }
+  pthread_mutex_unlock (&mutex);
+  return 0;
+ fail:
+  saved_errno = errno;
+  pthread_mutex_unlock (&mutex);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the number of commands that have failed.
+ * 
+ * @return  The number of commands that have exited with a
+ *          non-zero status, or by a signal, or could not
+ *          be started.
+ */
+unsigned long
+failed_jobs (void)
+{
+  unsigned long r;
+  pthread_mutex_lock (&mutex);
+  r = failed;
+  pthread_mutex_unlock (&mutex);
+  return r;
+}
@@ -0,0 +1,80 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+
+
+/**
+ * Defined in stats.h.
+ */
+struct stats;
+
+
+
+/**
+ * Select how many commands, for the images,
+ * may run at the same time, and forget all
+ * commands started before.
+ * 
+ * This must not be called while another
+ * thread is using the other functions.
+ * 
+ * @param   limit  The number of commands, at least 1.
+ * @return         Zero on success, -1 on error.
+ */
+int init_jobs (size_t limit);
+
+/**
+ * Release the resources allocated by `init_jobs`.
+ */
+void destroy_jobs (void);
+
+/**
+ * Start a command for an image, without waiting for it
+ * to exit. If the maximum number of commands are already
+ * running, this waits until one of them has exited.
+ * 
+ * If the command cannot be started, this is reported and
+ * counted as a failed command, rather than as an error.
+ * 
+ * @param   args   The command and its arguments, `NULL`-terminated.
+ * @param   stats  The statistics to count the command's CPU time
+ *                 in, `NULL` for none. This must not be used by
+ *                 the caller until `wait_jobs` has returned.
+ * @return         Zero on success, -1 on error.
+ */
+int start_job (char *const *args, struct stats *restrict stats);
+
+/**
+ * Wait until commands have exited.
+ * 
+ * @param   stats  The statistics passed to `start_job` for the
+ *                 commands, `NULL` to wait for all commands.
+ * @return         Zero on success, -1 on error.
+ */
+int wait_jobs (struct stats *restrict stats);
+
+/**
+ * Get the number of commands that have failed.
+ * 
+ * @return  The number of commands that have exited with a
+ *          non-zero status, or by a signal, or could not
+ *          be started.
+ */
+unsigned long failed_jobs (void);
+
@@ -19,8 +19,14 @@
 #include "common.h"
 #include "kern.h"
 #include "png.h"
+#include "pixel.h"
+#include "raw.h"
+#include "stats.h"
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <linux/fb.h>
 
 
@@ -30,6 +36,12 @@
  */
 const int alt_fbpath_limit = 2;
 
+/**
+ * The region of the framebuffers to capture, set
+ * with `set_crop`; everything if `crop_width` is zero.
+ */
+static long crop_x, crop_y, crop_width = 0, crop_height;
+
 /**
  * Addition metadata for the framebuffer.
  */
@@ -41,8 +53,9 @@ struct data
   unsigned long start;
   
   /**
-   * The byte where the frame end. Zero if
-   * there is neither panning or padding.
+   * The pixel where the frame end, that is,
+   * the number of pixels to the pixel after
+   * the last visible pixel's line.
    */
   unsigned long end;
   
@@ -51,11 +64,104 @@ struct data
    */
   long hblank;
   
+  /**
+   * The number of pixels, on each line, before
+   * the first visible pixel.
+   */
+  unsigned long left;
+  
+  /**
+   * The width of the image.
+   */
+  long width;
+  
+  /**
+   * The height of the image.
+   */
+  long height;
+  
+  /**
+   * Whether `copy_fb` copies only the visible pixels,
+   * because most of each line is not visible.
+   */
+  int compact;
+  
   /**
    * This variable is used to keep track of
    * how many pixels have been read.
    */
   unsigned long position;
+  
+  /**
+   * The number of bytes, from the beginning
+   * of the framebuffer, that are required to
+   * get all visible pixels.
+   */
+  size_t size;
+  
+  /**
+   * The number of bytes before the framebuffer's
+   * memory in the file, this is only non-zero
+   * for raw framebuffer dumps with a header.
+   */
+  size_t offset;
+  
+  /**
+   * Whether the framebuffer is a raw
+   * framebuffer dump, rather than a device.
+   */
+  int dump;
+  
+  /**
+   * The framebuffer mapped into memory,
+   * `NULL` if it has not been mapped.
+   */
+  const char *mem;
+  
+  /**
+   * The variable screen information the
+   * framebuffer was measured with.
+   */
+  struct fb_var_screeninfo varinfo;
+  
+  /**
+   * The number of colours in the colour map, zero
+   * if the pixels are not indices into a colour map.
+   */
+  unsigned long colours;
+  
+  /**
+   * The colour map, as red, green, blue triplets.
+   */
+  png_byte palette[3 * 256];
+  
+  /**
+   * How the pixels are stored.
+   */
+  struct pixel_format format;
+  
+  /**
+   * The lines of the framebuffer that contain
+   * the image, copied by `copy_fb`.
+   */
+  char *copy;
+  
+  /**
+   * The allocation size of `copy`.
+   */
+  size_t copy_size;
+  
+  /**
+   * Whether `copy` holds the current screenshot.
+   */
+  int copied;
+  
+  /**
+   * Whether the pixels passed to `convert_fb_to_png`
+   * are only the visible pixels, copied by `copy_fb`,
+   * rather than whole lines of the framebuffer.
+   */
+  int packed;
 };
 
 
@@ -95,28 +201,210 @@ get_fbpath (int altpath, int fbno)
 
 
 /**
- * Get the dimensions of a framebuffer.
+ * Only capture a region of the framebuffers, this
+ * applies to framebuffers measured after the call.
+ * The region is clipped to each framebuffer.
+ * 
+ * @param  x       The left-most column of the region.
+ * @param  y       The top-most line of the region.
+ * @param  width   The width of the region, positive.
+ * @param  height  The height of the region, positive.
+ */
+void
+set_crop (long x, long y, long width, long height)
+{
+  crop_x = x;
+  crop_y = y;
+  crop_width = width;
+  crop_height = height;
+}
+
+
+/**
+ * Calculate `a + b * c`, unless it overflows.
+ * 
+ * @param   a  The addend.
+ * @param   b  The multiplicand.
+ * @param   c  The multiplier.
+ * @param   r  Output parameter for the result.
+ * @return     Zero on success, -1 if the result does not fit in a `size_t`.
+ */
+static int
+add_mul_size (size_t a, size_t b, size_t c, size_t *restrict r)
+{
+  if (c && (b > (SIZE_MAX - a) / c))
+    return -1;
+  *r = a + b * c;
+  return 0;
+}
+
+
+/**
+ * Get the configurations of a raw framebuffer dump,
+ * made with `save_raw`, or of a dump without a header
+ * that is described by a sidecar, as if it was a framebuffer.
+ * 
+ * @param   fbfd     File descriptor for the dump.
+ * @param   geomfd   File descriptor for the sidecar, `fbfd` if the dump has a header.
+ * @param   fixinfo  Output parameter for the fixed screen information.
+ * @param   varinfo  Output parameter for the variable screen information.
+ * @param   d        Output parameter for the colour map, and
+ *                   the offset of the first pixel in the dump.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+measure_raw (int fbfd, int geomfd, struct fb_fix_screeninfo *restrict fixinfo,
+	     struct fb_var_screeninfo *restrict varinfo, struct data *restrict d)
+{
+  struct raw_header header;
+  struct stat attr;
+  off_t offset = 0;
+  size_t row, need;
+  
+  if (geomfd == fbfd)
+    {
+      if (read_raw_header (fbfd, &header) < 0)
+	return -1;
+      offset = (off_t)RAW_DATA_OFFSET (&header);
+    }
+  else if (read_raw_sidecar (geomfd, &header) < 0)
+    return -1;
+  if (fstat (fbfd, &attr))
+    return -1;
+  
+  /* Is the dump truncated? The fields fit in 32 bits,
+     but the size of the pixels may still overflow. */
+  if (!header.height ||
+      add_mul_size (header.width, header.xoffset, 1, &row) ||
+      add_mul_size (0, row, header.bits_per_pixel / 8, &row) ||
+      add_mul_size (row, header.line_length, header.height - 1, &need) ||
+      (attr.st_size < offset) || ((uintmax_t)(attr.st_size - offset) < (uintmax_t)need))
+    return errno = EINVAL, -1;
+  
+  memset (fixinfo, 0, sizeof (*fixinfo));
+  memset (varinfo, 0, sizeof (*varinfo));
+  fixinfo->line_length = (__u32)(header.line_length);
+  fixinfo->smem_len = (__u32)(attr.st_size - offset);
+  fixinfo->visual = header.colours ? FB_VISUAL_PSEUDOCOLOR : FB_VISUAL_TRUECOLOR;
+  varinfo->xres = (__u32)(header.width);
+  varinfo->yres = (__u32)(header.height);
+  varinfo->xoffset = (__u32)(header.xoffset);
+  varinfo->bits_per_pixel = (__u32)(header.bits_per_pixel);
+#define X(CHANNEL)							\
+  varinfo->CHANNEL.offset = (__u32)(header.CHANNEL.offset),		\
+  varinfo->CHANNEL.length = (__u32)(header.CHANNEL.length)
+  X (red);
+  X (green);
+  X (blue);
+  X (transp);
+#undef X
+  d->offset = (size_t)offset;
+  d->dump = 1;
+  d->colours = header.colours;
+  memcpy (d->palette, header.palette, sizeof (d->palette));
+  return 0;
+}
+
+
+/**
+ * Call `ioctl` on a framebuffer, and count the call.
+ * 
+ * @param   fbfd     File descriptor for framebuffer device.
+ * @param   request  The request.
+ * @param   arg      The argument for the request.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+fb_ioctl (int fbfd, unsigned long request, void *arg)
+{
+  count_ioctl ();
+  return ioctl (fbfd, request, arg);
+}
+
+
+/**
+ * Get the colour map of a framebuffer.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   d     Output parameter for the colour map.
+ * @return        Zero on success, -1 on error.
+ */
+static int
+get_colour_map (int fbfd, struct data *restrict d)
+{
+  __u16 red[256], green[256], blue[256];
+  struct fb_cmap cmap;
+  unsigned long i;
+  
+  memset (red, 0, sizeof (red));
+  memset (green, 0, sizeof (green));
+  memset (blue, 0, sizeof (blue));
+  cmap.start = 0;
+  cmap.len = 256;
+  cmap.red = red;
+  cmap.green = green;
+  cmap.blue = blue;
+  cmap.transp = NULL;
+  if (fb_ioctl (fbfd, FBIOGETCMAP, &cmap))
+    return -1;
+  
+  /* The colour map is 16 bits per channel. */
+  d->colours = 256;
+  for (i = 0; i < 256; i++)
+    {
+      d->palette[3 * i + 0] = (png_byte)(red[i] >> 8);
+      d->palette[3 * i + 1] = (png_byte)(green[i] >> 8);
+      d->palette[3 * i + 2] = (png_byte)(blue[i] >> 8);
+    }
+  return 0;
+}
+
+
+/**
+ * Get the dimensions of a framebuffer, or of a dump.
  * 
  * @param   fbno    The number of the framebuffer.
- * @param   fbfd    File descriptor for framebuffer device.
+ * @param   fbfd    File descriptor for framebuffer device, or dump.
+ * @param   geomfd  File descriptor for the dump's sidecar, -1 if none.
  * @param   width   Output parameter for the width of the image.
  * @param   height  Output parameter for the height of the image.
- * @parma   data    Additional data to pass to `convert_fb_to_png`.
- * @return          Zero on success, -1 on error.
+ * @parma   data    Additional data to pass to `convert_fb_to_png`,
+ *                  it shall be released with `release_fb`.
+ * @return          Zero on success, -1 on error. If the configurations
+ *                  are not supported, `failure_reason` is set.
  */
-int
-measure (int fbno, int fbfd, long *restrict width, long *restrict height, void **restrict data)
+static int
+measure_any (int fbno, int fbfd, int geomfd, long *restrict width, long *restrict height, void **restrict data)
 {
-  static struct data d;
+  struct data d;
   struct fb_fix_screeninfo fixinfo;
   struct fb_var_screeninfo varinfo;
-  unsigned long int linelength;
+  unsigned long int linelength, top, left;
+  unsigned offset[3], length[3];
   
-  /* Get configurations. */
-  if (ioctl (fbfd, FBIOGET_FSCREENINFO, &fixinfo))
-    goto fail;
-  if (ioctl (fbfd, FBIOGET_VSCREENINFO, &varinfo))
+  (void) fbno;
+  
+  /* Get configurations. If it is not a framebuffer,
+     it may be a dump made with `save_raw`. */
+  d.offset = 0;
+  d.dump = 0;
+  d.colours = 0;
+  if (geomfd >= 0)
+    {
+      if (measure_raw (fbfd, geomfd, &fixinfo, &varinfo, &d) < 0)
+	goto fail;
+    }
+  else if (fb_ioctl (fbfd, FBIOGET_FSCREENINFO, &fixinfo))
+    {
+      if ((errno != ENOTTY) || (measure_raw (fbfd, fbfd, &fixinfo, &varinfo, &d) < 0))
+	goto fail;
+    }
+  else if (fb_ioctl (fbfd, FBIOGET_VSCREENINFO, &varinfo))
     goto fail;
+  else if ((fixinfo.visual == FB_VISUAL_PSEUDOCOLOR) ||
+	   (fixinfo.visual == FB_VISUAL_STATIC_PSEUDOCOLOR))
+    if ((varinfo.bits_per_pixel == 8) && (get_colour_map (fbfd, &d) < 0))
+      goto fail;
   
   /* Get dimension. */
   *width  = varinfo.xres;
@@ -125,41 +413,432 @@ measure (int fbno, int fbfd, long *restrict width, long *restrict height, void *
   /* Are the configurations supported? */
   if (varinfo.bits_per_pixel & 7)
     {
-      fprintf(stderr, _("%s: Unsupported framebuffer configurations: "
-			"pixels are not encoded in whole bytes.\n"), execname);
-      exit(1);
+      failure_reason = _("Unsupported framebuffer configurations, "
+			 "pixels are not encoded in whole bytes");
+      errno = ENOTSUP;
+      goto fail;
+    }
+  offset[0] = varinfo.red.offset, length[0] = varinfo.red.length;
+  offset[1] = varinfo.green.offset, length[1] = varinfo.green.length;
+  offset[2] = varinfo.blue.offset, length[2] = varinfo.blue.length;
+  if (init_pixel_format (&(d.format), varinfo.bits_per_pixel / 8, offset, length,
+			 d.colours ? d.palette : NULL) < 0)
+    {
+      failure_reason = _("Unsupported framebuffer configurations, "
+			 "the pixel format is not supported");
+      errno = ENOTSUP;
+      goto fail;
     }
   
   /* Get dead area information. */
   linelength = fixinfo.line_length / (varinfo.bits_per_pixel / 8);
-  d.start = varinfo.yoffset * linelength;
-  d.start += varinfo.xoffset;
-  d.end = d.start + linelength * varinfo.yres;
-  if ((d.start == 0) && (linelength == 0))
-    d.end = 0;
-  d.hblank = linelength - *width;
+  if (linelength < (unsigned long)*width)
+    linelength = (unsigned long)*width; /* Line length not reported. */
+  top = varinfo.yoffset;
+  left = varinfo.xoffset;
+  
+  /* Only the cropped region is visible, so
+     nothing outside it will be read. */
+  if (crop_width)
+    {
+      if ((crop_x >= *width) || (crop_y >= *height))
+	{
+	  failure_reason = _("The region to crop is outside the framebuffer");
+	  errno = EINVAL;
+	  goto fail;
+	}
+      top += (unsigned long)crop_y;
+      left += (unsigned long)crop_x;
+      *width = *width - crop_x < crop_width ? *width - crop_x : crop_width;
+      *height = *height - crop_y < crop_height ? *height - crop_y : crop_height;
+    }
+  
+  d.start = top * linelength + left;
+  d.end = d.start + linelength * (unsigned long)*height;
+  d.hblank = (long)linelength - *width;
+  d.left = left;
+  d.width = *width;
+  d.height = *height;
   d.position = 0;
   
-  /* TODO depth support */
+  /* How much do we need to map? */
+  d.size = (size_t)fixinfo.smem_len;
+  if ((size_t)(d.end) * (varinfo.bits_per_pixel / 8) < d.size)
+    d.size = (size_t)(d.end) * (varinfo.bits_per_pixel / 8);
+  d.compact = (d.hblank >= *width) && (d.size == (size_t)(d.end) * (varinfo.bits_per_pixel / 8));
+  d.mem = NULL;
+  d.varinfo = varinfo;
+  d.copy = NULL;
+  d.copy_size = 0;
+  d.copied = 0;
+  d.packed = 0;
   
-  *data = &d;
+  *data = malloc (sizeof (d));
+  if (*data == NULL)
+    goto fail;
+  memcpy (*data, &d, sizeof (d));
   return 0;
  fail:
   return -1;
 }
 
 
+/**
+ * Get the dimensions of a framebuffer.
+ * 
+ * @param   fbno    The number of the framebuffer.
+ * @param   fbfd    File descriptor for framebuffer device.
+ * @param   width   Output parameter for the width of the image.
+ * @param   height  Output parameter for the height of the image.
+ * @parma   data    Additional data to pass to `convert_fb_to_png`,
+ *                  it shall be released with `release_fb`.
+ * @return          Zero on success, -1 on error.
+ */
+int
+measure (int fbno, int fbfd, long *restrict width, long *restrict height, void **restrict data)
+{
+  return measure_any (fbno, fbfd, -1, width, height, data);
+}
+
+
+/**
+ * Get the dimensions of a raw framebuffer dump without
+ * a header, from the sidecar that describes it.
+ * 
+ * @param   fbno    The number of the framebuffer.
+ * @param   fbfd    File descriptor for the dump.
+ * @param   geomfd  File descriptor for the sidecar.
+ * @param   width   Output parameter for the width of the image.
+ * @param   height  Output parameter for the height of the image.
+ * @parma   data    Additional data to pass to `convert_fb_to_png`,
+ *                  it shall be released with `release_fb`.
+ * @return          Zero on success, -1 on error.
+ */
+int
+measure_file (int fbno, int fbfd, int geomfd, long *restrict width, long *restrict height, void **restrict data)
+{
+  return measure_any (fbno, fbfd, geomfd, width, height, data);
+}
+
+
+/**
+ * Prepare a framebuffer, that has already been
+ * measured, for another screenshot.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   data  Data from `measure`.
+ * @return        Zero on success, -1 on error, 1 if the configurations
+ *                have changed and the framebuffer must be measured again.
+ */
+int
+rewind_fb (int fbfd, void *restrict data)
+{
+  struct data *d = data;
+  struct fb_var_screeninfo varinfo;
+  
+  d->position = 0;
+  d->copied = 0;
+  if ((d->mem == NULL) && (lseek (fbfd, (off_t)(d->offset), SEEK_SET) < 0))
+    return -1;
+  
+  /* A dump does not change. */
+  if (d->dump)
+    return 0;
+  
+  if (fb_ioctl (fbfd, FBIOGET_VSCREENINFO, &varinfo))
+    return -1;
+  return memcmp (&varinfo, &(d->varinfo), sizeof (varinfo)) ? 1 : 0;
+}
+
+
+/**
+ * Release data from `measure`.
+ * 
+ * @param  data  Data from `measure`, may be `NULL`.
+ */
+void
+release_fb (void *data)
+{
+  struct data *d = data;
+  if ((d != NULL) && (d->mem != NULL))
+    munmap ((void *)(d->mem), d->offset + d->size);
+  if (d != NULL)
+    free (d->copy);
+  free (d);
+}
+
+
+/**
+ * Get the span of a framebuffer that contains the
+ * image: whole lines, from the first visible line
+ * to the last visible line.
+ * 
+ * @param  d      Data from `measure`.
+ * @param  first  Output parameter for the offset of the span
+ *                from the beginning of the framebuffer's memory.
+ * @param  n      Output parameter for the size of the span.
+ */
+static void
+get_span (const struct data *restrict d, size_t *restrict first, size_t *restrict n)
+{
+  size_t bytespp = d->format.bytes;
+  size_t linelength = (size_t)(d->hblank + d->width);
+  
+  *first = (d->start - d->left) * bytespp;
+  *n = linelength * (size_t)(d->height) * bytespp;
+  if (*first > d->size)
+    *first = d->size;
+  if (*n > d->size - *first)
+    *n = d->size - *first;
+}
+
+
+/**
+ * Map a framebuffer into memory, so that it
+ * can be converted without being copied.
+ * 
+ * The framebuffer is only mapped once, the same
+ * memory is returned for every screenshot until
+ * `data` is released with `release_fb`.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of mapped bytes.
+ * @param   data  Data from `measure`.
+ * @return        The mapped memory, `NULL` on error (the
+ *                framebuffer must be read instead.)
+ */
+const char *
+map_fb (int fbfd, size_t *restrict n, void *restrict data)
+{
+  struct data *d = data;
+  void *mem;
+  
+  if (d->mem != NULL)
+    goto done;
+  if (d->size == 0)
+    return errno = EINVAL, NULL;
+  
+  mem = mmap (NULL, d->offset + d->size, PROT_READ, MAP_SHARED, fbfd, 0);
+  if (mem == MAP_FAILED)
+    return NULL;
+  
+  /* We will read it from the beginning to the end. */
+  posix_madvise (mem, d->offset + d->size, POSIX_MADV_SEQUENTIAL);
+  d->mem = mem;
+  
+ done:
+  *n = d->size;
+  return d->mem + d->offset;
+}
+
+
+/**
+ * Read a part of a framebuffer, with as few reads as possible.
+ * 
+ * @param   fbfd   File descriptor for framebuffer device.
+ * @param   buf    Output buffer for the read data.
+ * @param   n      The number of bytes to read.
+ * @param   off    The offset of the first byte to read.
+ * @param   calls  Incremented by the number of reads.
+ * @return         Zero on success, -1 on error.
+ */
+static int
+read_fb (int fbfd, char *restrict buf, size_t n, off_t off, unsigned long *restrict calls)
+{
+  size_t i;
+  ssize_t r;
+  
+  for (i = 0; i < n; i += (size_t)r, ++*calls)
+    {
+      r = pread (fbfd, buf + i, n - i, off + (off_t)i);
+      if (r < 0)
+	{
+	  if (errno != EINTR)
+	    return -1;
+	  r = 0;
+	}
+      else if (r == 0)
+	return errno = EIO, -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Copy the lines of a framebuffer that contain the image
+ * into memory, in one pass and without converting them,
+ * so that the framebuffer is read as quickly as possible
+ * and changes made while the image is being converted
+ * and compressed cannot tear it. If most of each line
+ * is not visible, for example because the image is
+ * cropped, only the visible pixels are copied.
+ * 
+ * The framebuffer is only copied once per screenshot,
+ * calling this function again returns the same copy
+ * until the framebuffer is rewound with `rewind_fb`.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of copied bytes.
+ * @param   data  Data from `measure`.
+ * @return        The copy, `NULL` on error. It shall be passed,
+ *                whole, to `convert_fb_to_png`.
+ */
+const char *
+copy_fb (int fbfd, size_t *restrict n, void *restrict data)
+{
+  struct data *d = data;
+  const char *mem;
+  size_t first, size, mapped, row, line, y;
+  unsigned long calls = 0;
+  void *new;
+  
+  /* `convert_fb_to_png` starts at the beginning of the copy. */
+  d->packed = d->compact;
+  row = (size_t)(d->width) * d->format.bytes;
+  line = row + (size_t)(d->hblank) * d->format.bytes;
+  if (d->compact)
+    {
+      first = d->start * d->format.bytes;
+      size = row * (size_t)(d->height);
+      d->position = 0;
+    }
+  else
+    {
+      get_span (d, &first, &size);
+      d->position = first / d->format.bytes;
+    }
+  *n = size;
+  if (d->copied)
+    return d->copy;
+  
+  /* The buffer is kept between screenshots. */
+  if (size > d->copy_size)
+    {
+      new = realloc (d->copy, size);
+      if (new == NULL)
+	return NULL;
+      d->copy = new;
+      d->copy_size = size;
+    }
+  
+  /* Copy the pixels with a single memcpy if the framebuffer
+     can be mapped, otherwise read them with as few reads
+     as possible, nothing is converted in between. When
+     only the visible pixels are copied, it is done
+     line by line, the rest of the lines are never read. */
+  mem = map_fb (fbfd, &mapped, data);
+  if (!d->compact && (mem != NULL))
+    memcpy (d->copy, mem + first, size);
+  else if (!d->compact)
+    {
+      if (read_fb (fbfd, d->copy, size, (off_t)(d->offset + first), &calls) < 0)
+	return NULL;
+    }
+  else
+    for (y = 0; y < (size_t)(d->height); y++, first += line)
+      {
+	if (mem != NULL)
+	  memcpy (d->copy + y * row, mem + first, row);
+	else if (read_fb (fbfd, d->copy + y * row, row, (off_t)(d->offset + first), &calls) < 0)
+	  return NULL;
+      }
+  
+  count_read (size, calls);
+  d->copied = 1;
+  return d->copy;
+}
+
+
+/**
+ * Detach the copy made by `copy_fb` from a framebuffer,
+ * so that it can be converted, by another thread, while
+ * the framebuffer is copied again. The copy is returned
+ * with everything needed to convert it, and can be
+ * passed, as data, to `snapshot_fb`, with -1 as the
+ * file descriptor. It shall be released with `release_fb`.
+ * 
+ * @param   data   Data from `measure`, copied with `copy_fb`.
+ * @param   spare  A detached copy that is no longer needed, its
+ *                 buffer is given to `data`, `NULL` if none.
+ * @return         The detached copy, `NULL` on error.
+ */
+void *
+detach_copy (void *restrict data, void *restrict spare)
+{
+  struct data *d = data;
+  struct data *copy = spare;
+  char *buf = NULL;
+  size_t size = 0;
+  
+  if (copy == NULL)
+    {
+      copy = malloc (sizeof (*copy));
+      if (copy == NULL)
+	return NULL;
+    }
+  else
+    buf = copy->copy, size = copy->copy_size;
+  
+  /* The detached copy is never read from the framebuffer again,
+     and must not unmap it, only the copy is handed over. */
+  memcpy (copy, d, sizeof (*d));
+  copy->mem = NULL;
+  d->copy = buf;
+  d->copy_size = size;
+  d->copied = 0;
+  return copy;
+}
+
+
+/**
+ * Get the lines of a framebuffer that contain the image,
+ * directly from the mapped framebuffer, so that they
+ * are converted without being copied first. If the
+ * framebuffer has been copied with `copy_fb` since it
+ * was rewound, or if it cannot be mapped, the copy
+ * is returned instead.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of bytes.
+ * @param   data  Data from `measure`.
+ * @return        The pixels, `NULL` on error. They shall be
+ *                passed, whole, to `convert_fb_to_png`.
+ */
+const char *
+view_fb (int fbfd, size_t *restrict n, void *restrict data)
+{
+  struct data *d = data;
+  const char *mem;
+  size_t first, mapped;
+  
+  if (d->copied)
+    return copy_fb (fbfd, n, data);
+  mem = map_fb (fbfd, &mapped, data);
+  if (mem == NULL)
+    return copy_fb (fbfd, n, data);
+  
+  get_span (d, &first, n);
+  d->position = first / d->format.bytes;
+  d->packed = 0;
+  count_read (*n, 0);
+  return mem + first;
+}
+
+
 /**
  * Convert read data from a framebuffer to PNG pixel data.
  * 
- * @param   file        The output image file.
+ * @param   pngbuf      The PNG image structure, or `NULL` to store
+ *                      the entire image in `pixbuf` instead.
+ * @param   pixbuf      The pixel buffer for the row, or for the
+ *                      entire image if `pngbuf` is `NULL`.
  * @param   buf         Buffer with read data.
  * @param   n           The number of read characters.
  * @param   width3      The width of the image multipled by 3.
  * @param   adjustment  Set to zero if all bytes were converted
  *                      (a whole number of pixels where available,)
- *                      otherwise, set to the number of bytes a
- *                      pixel is encoded.
+ *                      otherwise, set to the number of trailing
+ *                      bytes that were not converted.
  * @param   state       Use this to keep track of where in the you
  *                      stopped. It will be 0 on the first call.
  * @param   data        Data from `measure`.
@@ -169,60 +848,180 @@ int
 convert_fb_to_png (png_struct *pngbuf, png_byte *restrict pixbuf, const char *restrict buf, size_t n,
 		   long width3, size_t *restrict adjustment, long *restrict state, void *restrict data)
 {
-#define STORE(PADDING_AND_PANNING)			\
-  do							\
-    {							\
-      if (PADDING_AND_PANNING)				\
-	if ((pos < d.start) || (pos >= d.end))		\
-	  continue;					\
-							\
-      if (PADDING_AND_PANNING ? (x3 < width3) : 1)	\
-	SAVE_PNG_PIXEL (pixbuf, x3, r, g, b);		\
-      x3 += 3;						\
-      if (x3 == lineend)				\
-	{						\
-	  SAVE_PNG_ROW (pngbuf, pixbuf);		\
-	  x3 = 0;					\
-	}						\
-    }							\
-  while (0)
-  
-  const uint32_t *restrict pixel;
-  int r, g, b;
-  size_t off;
+  size_t off, count;
+  png_byte *restrict row = pixbuf;
   long x3 = *state;
-  struct data d = *(struct data *)data;
-  unsigned long pos = d.position;
-  long lineend = width3 + d.hblank * 3;
+  struct data *restrict d = data;
+  const struct pixel_format *restrict format = &(d->format);
+  size_t bytespp = format->bytes;
+  unsigned long pos = d->position;
+  unsigned long start = d->start, end = d->end;
+  long lineend = width3 + d->hblank * 3;
   
-  if ((d.start == 0) && (d.hblank == 0) && (d.end == 0)) /* Optimised version for customary settings. */
-    for (off = 0; off < n; off += 4)
-      {
-	/* A pixel in the framebuffer is formatted as `%{blue}%{green}%{red}%{x}`
-	   in big-endian binary, or `%{x}%{red}%{green}%{blue}` in little-endian binary. */
-	pixel = (const uint32_t *)(buf + off);
-	r = (*pixel >> 16) & 255;
-	g = (*pixel >> 8) & 255;
-	b = (*pixel >> 0) & 255;
-	
-	STORE(0);
-      }
-  else
-    for (off = 0; off < n; off += 4, pos++)
-      {
-	/* A pixel in the framebuffer is formatted as `%{blue}%{green}%{red}%{x}`
-	   in big-endian binary, or `%{x}%{red}%{green}%{blue}` in little-endian binary. */
-	pixel = (const uint32_t *)(buf + off);
-	r = (*pixel >> 16) & 255;
-	g = (*pixel >> 8) & 255;
-	b = (*pixel >> 0) & 255;
-	
-	STORE(1);
-      }
+  /* `copy_fb` has left out everything that is not visible. */
+  if (d->packed)
+    start = 0, end = (unsigned long)(d->width * d->height), lineend = width3;
   
-  *adjustment = (off != n ? 4 : 0);
+  /* Rather than checking each pixel, we skip or convert as many
+     pixels as possible at once. `x3` is the column, multiplied by 3,
+     within the line, where the padding is at the end of the line. */
+  for (off = 0; off + bytespp <= n; off += count * bytespp, pos += count)
+    {
+      count = (n - off) / bytespp;
+      if (pos < start)
+	{
+	  /* Skip the dead area at the beginning. */
+	  if (count > start - pos)
+	    count = start - pos;
+	}
+      else if (pos >= end)
+	{
+	  /* Ignore everything after the last visible pixel. */
+	  off = n;
+	  break;
+	}
+      else if (x3 < width3)
+	{
+	  /* Convert as much of the row as we have. */
+	  if (count > (size_t)(width3 - x3) / 3)
+	    count = (size_t)(width3 - x3) / 3;
+	  if (pngbuf == NULL)
+	    row = pixbuf + (size_t)((pos - start) / (unsigned long)(lineend / 3)) * (size_t)width3;
+	  format->convert (row + x3, buf + off, count, format);
+	  x3 += (long)count * 3;
+	  if (x3 == width3)
+	    {
+	      if (pngbuf != NULL)
+		SAVE_PNG_ROW (pngbuf, pixbuf);
+	      if (x3 == lineend)
+		x3 = 0;
+	    }
+	}
+      else
+	{
+	  /* Skip the padding at the end of the line. */
+	  if (count > (size_t)(lineend - x3) / 3)
+	    count = (size_t)(lineend - x3) / 3;
+	  x3 += (long)count * 3;
+	  if (x3 == lineend)
+	    x3 = 0;
+	}
+    }
+  
+  *adjustment = n - off;
   *state = x3;
-  ((struct data *)data)->position = pos;
+  d->position = pos;
+  return 0;
+}
+
+/**
+ * Dump the visible part of a framebuffer, without
+ * converting it, preceded by a header that describes
+ * it. The dump can be converted to PNG later by
+ * opening it as if it was a framebuffer.
+ * 
+ * @param   fbno   The number of the framebuffer.
+ * @param   fbfd   File descriptor for framebuffer device.
+ * @param   imgfd  The file descriptor of the output.
+ * @param   data   Data from `measure`.
+ * @return         Zero on success, -1 on error.
+ */
+int
+save_raw (int fbno, int fbfd, int imgfd, void *restrict data)
+{
+  struct data *d = data;
+  struct raw_header header;
+  size_t bytespp = d->format.bytes;
+  size_t linelength = (size_t)(d->hblank + d->width);
+  size_t first, n;
+  const char *mem, *p;
+  char buf[8 << 10];
+  off_t off;
+  ssize_t r;
+  size_t mapped, m, i;
+  
+  /* Describe the framebuffer. */
+  header.fbno = fbno;
+  header.width = (unsigned long)(d->width);
+  header.height = (unsigned long)(d->height);
+  header.xoffset = d->left;
+  header.line_length = linelength * bytespp;
+  header.bits_per_pixel = d->varinfo.bits_per_pixel;
+#define X(CHANNEL)							\
+  header.CHANNEL.offset = d->varinfo.CHANNEL.offset,			\
+  header.CHANNEL.length = d->varinfo.CHANNEL.length
+  X (red);
+  X (green);
+  X (blue);
+  X (transp);
+#undef X
+  header.colours = d->colours;
+  memcpy (header.palette, d->palette, sizeof (header.palette));
+  if (write_raw_header (imgfd, &header) < 0)
+    return -1;
+  
+  /* Dump whole lines, from the first visible line to the last
+     visible line, so that it is a single contiguous span. */
+  get_span (d, &first, &n);
+  off = (off_t)(d->offset + first);
+  
+  /* Let the kernel copy it without it passing through
+     our memory. This does not work for framebuffer devices,
+     since they cannot be spliced, but it does for dumps. */
+  while (n)
+    {
+      r = sendfile (imgfd, fbfd, &off, n);
+      count_read (r > 0 ? (size_t)r : 0, 0);
+      count_write (r > 0 ? (size_t)r : 0, 1);
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (((errno == EINVAL) || (errno == ENOSYS)) && (off == (off_t)(d->offset + first)))
+	    break;
+	  return -1;
+	}
+      if (r == 0)
+	return errno = EIO, -1;
+      n -= (size_t)r;
+    }
+  first = (size_t)off - d->offset;
+  
+  /* Otherwise, write it directly from the mapped framebuffer,
+     or at worst, read it into a buffer and write it. */
+  mem = n ? map_fb (fbfd, &mapped, data) : NULL;
+  while (n)
+    {
+      if (mem != NULL)
+	{
+	  p = mem + first, m = n;
+	  count_read (m, 0);
+	}
+      else
+	{
+	  r = pread (fbfd, buf, n < sizeof (buf) ? n : sizeof (buf), (off_t)(d->offset + first));
+	  count_read (r > 0 ? (size_t)r : 0, 1);
+	  if ((r < 0) && (errno == EINTR))
+	    continue;
+	  if (r <= 0)
+	    return r ? -1 : (errno = EIO, -1);
+	  p = buf, m = (size_t)r;
+	}
+      for (i = 0; i < m; i += (size_t)r)
+	{
+	  r = write (imgfd, p + i, m - i);
+	  count_write (r > 0 ? (size_t)r : 0, 1);
+	  if (r < 0)
+	    {
+	      if (errno != EINTR)
+		return -1;
+	      r = 0;
+	    }
+	}
+      first += m;
+      n -= m;
+    }
+  
   return 0;
 }
 
@@ -16,14 +16,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifdef __GNUC__
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wpadded"
-#endif
-#include <png.h>
-#ifdef __GNUC__
-# pragma GCC diagnostic pop
-#endif
+#include "pngtypes.h"
 
 
 
@@ -51,6 +44,18 @@ void print_not_found_help (void);
  */
 char *get_fbpath (int altpath, int fbno);
 
+/**
+ * Only capture a region of the framebuffers, this
+ * applies to framebuffers measured after the call.
+ * The region is clipped to each framebuffer.
+ * 
+ * @param  x       The left-most column of the region.
+ * @param  y       The top-most line of the region.
+ * @param  width   The width of the region, positive.
+ * @param  height  The height of the region, positive.
+ */
+void set_crop (long x, long y, long width, long height);
+
 /**
  * Get the dimensions of a framebuffer.
  * 
@@ -58,22 +63,126 @@ char *get_fbpath (int altpath, int fbno);
  * @param   fbfd    File descriptor for framebuffer device.
  * @param   width   Output parameter for the width of the image.
  * @param   height  Output parameter for the height of the image.
- * @parma   data    Additional data to pass to `convert_fb_to_png`.
+ * @parma   data    Additional data to pass to `convert_fb_to_png`,
+ *                  it shall be released with `release_fb`.
  * @return          Zero on success, -1 on error.
  */
 int measure (int fbno, int fbfd, long *restrict width, long *restrict height, void **restrict data);
 
+/**
+ * Get the dimensions of a raw framebuffer dump without
+ * a header, from the sidecar that describes it.
+ * 
+ * @param   fbno    The number of the framebuffer.
+ * @param   fbfd    File descriptor for the dump.
+ * @param   geomfd  File descriptor for the sidecar.
+ * @param   width   Output parameter for the width of the image.
+ * @param   height  Output parameter for the height of the image.
+ * @parma   data    Additional data to pass to `convert_fb_to_png`,
+ *                  it shall be released with `release_fb`.
+ * @return          Zero on success, -1 on error.
+ */
+int measure_file (int fbno, int fbfd, int geomfd, long *restrict width,
+		  long *restrict height, void **restrict data);
+
+/**
+ * Prepare a framebuffer, that has already been
+ * measured, for another screenshot.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   data  Data from `measure`.
+ * @return        Zero on success, -1 on error, 1 if the configurations
+ *                have changed and the framebuffer must be measured again.
+ */
+int rewind_fb (int fbfd, void *restrict data);
+
+/**
+ * Release data from `measure`.
+ * 
+ * @param  data  Data from `measure`, may be `NULL`.
+ */
+void release_fb (void *data);
+
+/**
+ * Map a framebuffer into memory, so that it
+ * can be converted without being copied.
+ * 
+ * The framebuffer is only mapped once, the same
+ * memory is returned for every screenshot until
+ * `data` is released with `release_fb`.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of mapped bytes.
+ * @param   data  Data from `measure`.
+ * @return        The mapped memory, `NULL` on error (the
+ *                framebuffer must be read instead.)
+ */
+const char *map_fb (int fbfd, size_t *restrict n, void *restrict data);
+
+/**
+ * Copy the lines of a framebuffer that contain the image
+ * into memory, in one pass and without converting them,
+ * so that the framebuffer is read as quickly as possible
+ * and changes made while the image is being converted
+ * and compressed cannot tear it.
+ * 
+ * The framebuffer is only copied once per screenshot,
+ * calling this function again returns the same copy
+ * until the framebuffer is rewound with `rewind_fb`.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of copied bytes.
+ * @param   data  Data from `measure`.
+ * @return        The copy, `NULL` on error. It shall be passed,
+ *                whole, to `convert_fb_to_png`.
+ */
+const char *copy_fb (int fbfd, size_t *restrict n, void *restrict data);
+
+/**
+ * Get the lines of a framebuffer that contain the image,
+ * directly from the mapped framebuffer, so that they
+ * are converted without being copied first. If the
+ * framebuffer has been copied with `copy_fb` since it
+ * was rewound, or if it cannot be mapped, the copy
+ * is returned instead.
+ * 
+ * @param   fbfd  File descriptor for framebuffer device.
+ * @param   n     Output parameter for the number of bytes.
+ * @param   data  Data from `measure`.
+ * @return        The pixels, `NULL` on error. They shall be
+ *                passed, whole, to `convert_fb_to_png`.
+ */
+const char *view_fb (int fbfd, size_t *restrict n, void *restrict data);
+
+/**
+ * Detach the copy made by `copy_fb` from a framebuffer,
+ * so that it can be converted, by another thread, while
+ * the framebuffer is copied again. The copy is returned
+ * with everything needed to convert it, and can be
+ * passed, as data, to `snapshot_fb`, with -1 as the
+ * file descriptor. It shall be released with `release_fb`.
+ * 
+ * @param   data   Data from `measure`, copied with `copy_fb`.
+ * @param   spare  A detached copy that is no longer needed, its
+ *                 buffer is given to `data`, `NULL` if none.
+ * @return         The detached copy, `NULL` on error.
+ */
+void *detach_copy (void *restrict data, void *restrict spare);
+
 /**
  * Convert read data from a framebuffer to PNG pixel data.
  * 
- * @param   file        The output image file.
+ * @param   pngbuf      The PNG image structure, or `NULL` to store
+ *                      the entire image in `pixbuf` instead.
+ * @param   pixbuf      The pixel buffer for the row, or for the
+ *                      entire image if `pngbuf` is `NULL`.
  * @param   buf         Buffer with read data.
  * @param   n           The number of read characters.
  * @param   width3      The width of the image multipled by 3.
  * @param   adjustment  Set to zero if all bytes were converted
  *                      (a whole number of pixels where available,)
- *                      otherwise, set to the number of bytes a
- *                      pixel is encoded.
+ *                      otherwise, set to the number of trailing
+ *                      bytes that were not converted.
  * @param   state       Use this to keep track of where in the you
  *                      stopped. It will be 0 on the first call.
  * @param   data        Data from `measure`.
@@ -83,3 +192,17 @@ int convert_fb_to_png (png_struct *pngbuf, png_byte *restrict pixbuf, const char
 		       size_t n, long width3, size_t *restrict adjustment, long *restrict state,
 		       void *restrict data);
 
+/**
+ * Dump the visible part of a framebuffer, without
+ * converting it, preceded by a header that describes
+ * it. The dump can be converted to PNG later by
+ * opening it as if it was a framebuffer.
+ * 
+ * @param   fbno   The number of the framebuffer.
+ * @param   fbfd   File descriptor for framebuffer device.
+ * @param   imgfd  The file descriptor of the output.
+ * @param   data   Data from `measure`.
+ * @return         Zero on success, -1 on error.
+ */
+int save_raw (int fbno, int fbfd, int imgfd, void *restrict data);
+
@@ -22,180 +22,267 @@
 
 
 /**
- * Duplicate all '%':s in a buffer until the first occurrence of a zero byte.
+ * Add a part to a pattern that is being compiled.
  * 
- * @param   buf  The buffer.
- * @param   n    The size of the buffer.
- * @return       -1 if the buffer is too small, otherwise.
- *               the new position of the first zero byte.
+ * @param  compiled  The pattern.
+ * @param  op        What the part expands to.
+ * @param  offset    See `struct pattern_part`.
+ * @param  length    See `struct pattern_part`.
  */
-static ssize_t
-duplicate_percents (char *restrict buf, size_t n)
+static void
+add_part (struct pattern *restrict compiled, enum pattern_op op, size_t offset, size_t length)
 {
-  size_t p = 0, pi, pc = 0, i;
-  
-  /* Count number of '%':s. */
-  for (i = 0; buf[i]; i++)
-    if (buf[i] == '%')
-      pc++;
-  
-  /* Check whether the string will overflow. */
-  if (i + pc > n)
-    return -1;
-  
-  /* Duplicate all '%':s. */
-  for (pi = 0; pi < pc; pi++)
-    {
-      p = (size_t)(strchr (buf + p, '%') - buf);
-      memmove (buf + p + 1, buf + p, (i - (p - pi)) * sizeof (char));
-      p += 2;
-    }
-  
-  return (ssize_t)(i + pi);
+  struct pattern_part *part = compiled->parts + compiled->n++;
+  part->op = op;
+  part->offset = offset;
+  part->length = length;
+  compiled->size += length;
 }
 
 
 /**
- * Parse and evaluate a --exec argument or filename pattern.
+ * End the text that is being compiled, and add it
+ * to the pattern, unless it is empty, and start
+ * a new text.
  * 
- * If `path != NULL` than all non-escaped spaces in
- * `pattern` will be stored as 255-bytes in `buf`.
+ * The text starts with a space, so that the
+ * expansion of a `PATTERN_TIME` part is never
+ * empty, `strftime` returns zero on error.
  * 
- * @param   buf      The output buffer.
- * @param   n        The size of `buf`.
- * @param   pattern  The pattern to evaluate.
- * @param   fbno     The index of the framebuffer.
- * @param   width    The width of the image/framebuffer.
- * @param   height   The height of the image/framebuffer.
- * @param   path     The filename of the saved image, `NULL`
- *                   during the evaluation of the filename pattern.
- * @return           Zero on success, -1 on error.
+ * @param  compiled  The pattern.
+ * @param  begin     The offset of the text, in `compiled->text`,
+ *                   updated to the offset of the new text.
+ * @param  end       The offset of the end of the text,
+ *                   updated to the end of the new text.
+ * @param  timed     Whether the text shall be expanded by
+ *                   `strftime`, it is reset.
  */
-static int
-try_evaluate (char *restrict buf, size_t n, const char *restrict pattern,
-	      int fbno, long width, long height, const char *restrict path)
+static void
+end_text (struct pattern *restrict compiled, size_t *restrict begin, size_t *restrict end, int *restrict timed)
 {
-#define P(format, value)  r = snprintf (buf + i, n - i, format "%zn", value, &j)
-  
-  size_t i = 0;
-  ssize_t j = 0;
-  int percent = 0, backslash = 0, dollar = 0, r = 0;
-  char c;
-  char *fmt = NULL;
+  if (*end == *begin + 1)
+    return;
+  compiled->text[(*end)++] = '\0';
+  if (*timed)
+    add_part (compiled, PATTERN_TIME, *begin, 0);
+  else
+    add_part (compiled, PATTERN_TEXT, *begin + 1, *end - *begin - 2);
+  compiled->timed |= *timed;
+  *timed = 0;
+  *begin = *end;
+  compiled->text[(*end)++] = ' ';
+}
+
+
+/**
+ * Parse a --exec argument or filename pattern.
+ * 
+ * If `exec` is set, all non-escaped spaces in
+ * `pattern` will be stored as 255-bytes, and
+ * `$f` and `$n` are expanded, otherwise they
+ * are ignored.
+ * 
+ * @param   compiled  Output parameter for the compiled pattern,
+ *                    it shall be released with `free_pattern`.
+ * @param   pattern   The pattern to compile.
+ * @param   exec      Is the pattern a --exec argument?
+ * @return            Zero on success, -1 on error. `errno` is set
+ *                    to `EINVAL` if the pattern is invalid.
+ */
+int
+compile_pattern (struct pattern *restrict compiled, const char *restrict pattern, int exec)
+{
+  size_t len = strlen (pattern), begin = 0, end = 0, k;
+  struct pattern_part *part;
+  char buf[512];
   time_t t;
-  struct tm *tm;
-  int saved_errno;
+  struct tm tm;
+  int percent = 0, backslash = 0, dollar = 0, timed = 0;
+  char c;
+  
+  /* There is at most one part per character, and one more
+     text, and each text has at most two more bytes than in `pattern`. */
+  memset (compiled, 0, sizeof (*compiled));
+  compiled->size = 1;
+  compiled->parts = malloc ((len + 1) * sizeof (*(compiled->parts)));
+  compiled->text = malloc (2 * len + 3);
+  if ((compiled->parts == NULL) || (compiled->text == NULL))
+    goto fail;
+  compiled->text[end++] = ' ';
   
-  /* Expand '$' and '\'. */
-  while ((i < n) && ((c = *pattern++)))
+  /* Expand '$' and '\'. Anything that is expanded by `strftime`
+     is kept as it is, to be expanded when it is evaluated. */
+  while ((c = *pattern++))
     if (dollar)
       {
 	dollar = 0;
-	if (path == NULL)
-	  if ((c == 'f') || (c == 'n'))
+	if (c == '$')
+	  {
+	    compiled->text[end++] = '$';
 	    continue;
-	if      (c == 'i')  P ("%i", fbno);
-	else if (c == 'f')  P ("%s", path);
-	else if (c == 'n')  P ("%s", strrchr (path, '/') ? (strrchr (path, '/') + 1) : path);
-	else if (c == 'p')  P ("%ju", (uintmax_t)width * (uintmax_t)height);
-	else if (c == 'w')  P ("%li", width);
-	else if (c == 'h')  P ("%li", height);
-	else if (c == '$')  r = 0, j = 1, buf[i] = '$';
-	else if ((r < 0) || (j <= 0))
-	  return -1;
-	else if ((c == 'f') || (c == 'n'))
-	  if (j = duplicate_percents (buf + i, n - i), j < 0)
-	    goto enametoolong;
-	i += (size_t)j;
+	  }
+	if (((c == 'f') || (c == 'n')) && !exec)
+	  continue;
+	end_text (compiled, &begin, &end, &timed);
+#define X(C, OP, TYPE)  else if (c == C)  add_part (compiled, OP, 0, 3 * sizeof (TYPE) + 1)
+	if (0);
+	X ('i', PATTERN_FBNO, int);
+	X ('c', PATTERN_FRAME, long);
+	X ('f', PATTERN_PATH, char);
+	X ('n', PATTERN_NAME, char);
+	X ('p', PATTERN_PIXELS, uintmax_t);
+	X ('w', PATTERN_WIDTH, long);
+	X ('h', PATTERN_HEIGHT, long);
+	else
+	  goto invalid;
+#undef X
       }
-    else if (backslash)  buf[i++] = (c == 'n' ? '\n' : c), backslash = 0;
-    else if (percent)    buf[i++] = c, percent = 0;
-    else if (c == '%')   buf[i++] = c, percent = 1;
+    else if (backslash)  compiled->text[end++] = (c == 'n' ? '\n' : c), backslash = 0;
+    else if (percent)    compiled->text[end++] = c, percent = 0;
+    else if (c == '%')   compiled->text[end++] = c, percent = timed = 1;
     else if (c == '\\')  backslash = 1;
     else if (c == '$')   dollar = 1;
-    else if (c == ' ')   buf[i++] = path == NULL ? ' ' : (char)255; /* 255 is not valid in UTF-8. */
-    else                 buf[i++] = c;
-  if (i >= n)
-    goto enametoolong;
-  buf[i] = '\0';
-  
-  /* Check whether there are any '%' to expand. */
-  if (strchr (buf, '%') == NULL)
-    return 0;
-  
-  /* Copy the buffer so we can reuse the buffer and use its old content for the format. */
-  fmt = strdup (buf);
-  if (fmt == NULL)
-    goto fail;
-  
-  /* Expand '%'. */
-  t = time (NULL);
-  tm = localtime (&t);
-  if (tm == NULL)
-    goto fail;
+    else if (c == ' ')   compiled->text[end++] = exec ? (char)255 : ' '; /* 255 is not valid in UTF-8. */
+    else                 compiled->text[end++] = c;
+  end_text (compiled, &begin, &end, &timed);
   
-#ifdef __GNUC__
-# pragma GCC diagnostic ignored "-Wformat-nonliteral"
-#endif
-  if (strftime (buf, n, fmt, tm) == 0)
-    goto enametoolong; /* No errors are defined for `strftime`. What else can we do? */
+  /* Predict how long the times will be, from how long they are now.
+     This is just a prediction, `evaluate` grows its buffer if needed. */
+  if (compiled->timed)
+    {
+      t = time (NULL);
+      if (localtime_r (&t, &tm) == NULL)
+	goto fail;
+      for (k = 0; k < compiled->n; k++)
+	{
+	  part = compiled->parts + k;
+	  if (part->op != PATTERN_TIME)
+	    continue;
+	  part->length = strftime (buf, sizeof (buf), compiled->text + part->offset, &tm);
+	  part->length = part->length ? (2 * part->length + 16) : sizeof (buf);
+	  compiled->size += part->length;
+	}
+    }
   
-  free (fmt);
   return 0;
   
- enametoolong:
-  errno = ENAMETOOLONG;
+ invalid:
+  errno = EINVAL;
  fail:
-  saved_errno = errno;
-  free (fmt);
-  errno = saved_errno;
+  free_pattern (compiled);
   return -1;
 }
 
 
 /**
- * Parse and evaluate a --exec argument or filename pattern.
+ * Release a pattern compiled with `compile_pattern`.
  * 
- * If `path != NULL` than all non-escaped spaces in
- * `pattern` will be stored as 255-bytes in `buf`.
+ * @param  compiled  The compiled pattern.
+ */
+void
+free_pattern (struct pattern *restrict compiled)
+{
+  free (compiled->parts);
+  free (compiled->text);
+  compiled->parts = NULL;
+  compiled->text = NULL;
+  compiled->n = 0;
+}
+
+
+/**
+ * Evaluate a compiled --exec argument or filename pattern.
  * 
- * @param   pattern  The pattern to evaluate.
- * @param   fbno     The index of the framebuffer.
- * @param   width    The width of the image/framebuffer.
- * @param   height   The height of the image/framebuffer.
- * @param   path     The filename of the saved image, `NULL`
- *                   during the evaluation of the filename pattern.
- * @return           The constructed string, `NULL` on error.
+ * @param   compiled  The compiled pattern.
+ * @param   fbno      The index of the framebuffer.
+ * @param   frame     The index of the screenshot of the framebuffer.
+ * @param   width     The width of the image/framebuffer.
+ * @param   height    The height of the image/framebuffer.
+ * @param   path      The filename of the saved image, `NULL`
+ *                    during the evaluation of the filename pattern.
+ * @return            The constructed string, `NULL` on error.
  */
-char*
-evaluate (const char *restrict pattern, int fbno, long width,
+char *
+evaluate (const struct pattern *restrict compiled, int fbno, long frame, long width,
 	  long height, const char *restrict path)
 {
-  char *buffer = NULL;
-  size_t size = 32;
+#define P(format, value)  r = snprintf (buf + i, size - i, format, value)
+#define S(str, len)       r = (int)(len), ((size_t)r < size - i ? memcpy (buf + i, str, (size_t)r) : NULL)
+  
+  const struct pattern_part *part;
+  const char *name = "";
+  size_t pathlen = 0, namelen = 0, size = compiled->size, i, k;
+  char *buf = NULL;
   void *new;
-  int saved_errno;
+  struct tm tm;
+  time_t t;
+  int r = 0;
   
+  if (compiled->timed)
+    {
+      t = time (NULL);
+      if (localtime_r (&t, &tm) == NULL)
+	return NULL;
+    }
+  
+  if (path != NULL)
+    {
+      name = strrchr (path, '/') ? (strrchr (path, '/') + 1) : path;
+      pathlen = strlen (path);
+      namelen = strlen (name);
+    }
+  else
+    path = "";
+  for (k = 0; k < compiled->n; k++)
+    size += (compiled->parts[k].op == PATTERN_PATH) ? pathlen :
+            (compiled->parts[k].op == PATTERN_NAME) ? namelen : 0;
+  
+  /* The size is predicted, so this is normally only done once. */
  retry:
-  new = realloc (buffer, size * sizeof(char));
+  new = realloc (buf, size);
   if (new == NULL)
-    goto fail;
-  buffer = new;
+    {
+      free (buf);
+      return NULL;
+    }
+  buf = new;
   
-  if (try_evaluate (buffer, size, pattern, fbno, width, height, path) < 0)
+  for (i = k = 0; k < compiled->n; k++, i += (size_t)r)
     {
-      size <<= 1;
-      if (errno == ENAMETOOLONG)
-	goto retry;
-      goto fail;
+      part = compiled->parts + k;
+      switch (part->op)
+	{
+	case PATTERN_TEXT:    S (compiled->text + part->offset, part->length);  break;
+	case PATTERN_FBNO:    P ("%i", fbno);  break;
+	case PATTERN_FRAME:   P ("%li", frame);  break;
+	case PATTERN_PATH:    S (path, pathlen);  break;
+	case PATTERN_NAME:    S (name, namelen);  break;
+	case PATTERN_PIXELS:  P ("%ju", (uintmax_t)width * (uintmax_t)height);  break;
+	case PATTERN_WIDTH:   P ("%li", width);  break;
+	case PATTERN_HEIGHT:  P ("%li", height);  break;
+	case PATTERN_TIME:
+	  /* Skip the leading space. */
+	  r = (int)strftime (buf + i, size - i, compiled->text + part->offset, &tm);
+	  if (r == 0)
+	    goto grow;
+	  memmove (buf + i, buf + i + 1, (size_t)--r);
+	  break;
+	}
+      if ((r < 0) || ((size_t)r >= size - i))
+	goto grow;
     }
+  buf[i] = '\0';
+  return buf;
   
-  return buffer;
+ grow:
+  if (r < 0)
+    {
+      free (buf);
+      return NULL;
+    }
+  size <<= 1;
+  goto retry;
   
- fail:
-  saved_errno = errno;
-  free(buffer);
-  errno = saved_errno;
-  return NULL;
+#undef P
+#undef S
 }
-
@@ -19,20 +19,157 @@
 #include <stddef.h>
 
 
+
+/**
+ * What a part of a compiled pattern expands to.
+ */
+enum pattern_op
+  {
+    /**
+     * The text of the part, as it is.
+     */
+    PATTERN_TEXT,
+    
+    /**
+     * The text of the part, expanded by `strftime`.
+     */
+    PATTERN_TIME,
+    
+    /**
+     * The index of the framebuffer, `$i`.
+     */
+    PATTERN_FBNO,
+    
+    /**
+     * The index of the screenshot, `$c`.
+     */
+    PATTERN_FRAME,
+    
+    /**
+     * The pathname of the image, `$f`.
+     */
+    PATTERN_PATH,
+    
+    /**
+     * The filename of the image, `$n`.
+     */
+    PATTERN_NAME,
+    
+    /**
+     * The number of pixels in the image, `$p`.
+     */
+    PATTERN_PIXELS,
+    
+    /**
+     * The width of the image, `$w`.
+     */
+    PATTERN_WIDTH,
+    
+    /**
+     * The height of the image, `$h`.
+     */
+    PATTERN_HEIGHT
+  };
+
+
+/**
+ * A part of a compiled pattern.
+ */
+struct pattern_part
+{
+  /**
+   * What the part expands to.
+   */
+  enum pattern_op op;
+  
+  /**
+   * For `PATTERN_TEXT` and `PATTERN_TIME`, the offset
+   * of the part's text, in the pattern's `text`.
+   */
+  size_t offset;
+  
+  /**
+   * For `PATTERN_TEXT`, the length of the text. For
+   * `PATTERN_TIME`, the predicted length of its expansion.
+   */
+  size_t length;
+};
+
+
+/**
+ * A --exec argument or filename pattern, parsed
+ * once, so that it can be evaluated in one pass.
+ */
+struct pattern
+{
+  /**
+   * The parts of the pattern, in order.
+   */
+  struct pattern_part *parts;
+  
+  /**
+   * The number of elements in `parts`.
+   */
+  size_t n;
+  
+  /**
+   * The texts of the parts, each terminated by a NUL
+   * byte. The text of a `PATTERN_TIME` part starts
+   * with a space that is not part of the expansion.
+   */
+  char *text;
+  
+  /**
+   * The predicted size of an evaluation of the pattern,
+   * excluding the lengths of the image's pathname and
+   * filename, but including the terminating NUL byte.
+   */
+  size_t size;
+  
+  /**
+   * Does the pattern use the current time?
+   */
+  int timed;
+};
+
+
+
+/**
+ * Parse a --exec argument or filename pattern.
+ * 
+ * If `exec` is set, all non-escaped spaces in
+ * `pattern` will be stored as 255-bytes, and
+ * `$f` and `$n` are expanded, otherwise they
+ * are ignored.
+ * 
+ * @param   compiled  Output parameter for the compiled pattern,
+ *                    it shall be released with `free_pattern`.
+ * @param   pattern   The pattern to compile.
+ * @param   exec      Is the pattern a --exec argument?
+ * @return            Zero on success, -1 on error. `errno` is set
+ *                    to `EINVAL` if the pattern is invalid.
+ */
+int compile_pattern (struct pattern *restrict compiled, const char *restrict pattern, int exec);
+
+/**
+ * Release a pattern compiled with `compile_pattern`.
+ * 
+ * @param  compiled  The compiled pattern.
+ */
+void free_pattern (struct pattern *restrict compiled);
+
 /**
- * Parse and evaluate a --exec argument or filename pattern.
- * 
- * If `path != NULL` than all non-escaped spaces in
- * `pattern` will be stored as 255-bytes in `buf`.
- * 
- * @param   pattern  The pattern to evaluate.
- * @param   fbno     The index of the framebuffer.
- * @param   width    The width of the image/framebuffer.
- * @param   height   The height of the image/framebuffer.
- * @param   path     The filename of the saved image, `NULL`
- *                   during the evaluation of the filename pattern.
- * @return           The constructed string, `NULL` on error.
+ * Evaluate a compiled --exec argument or filename pattern.
+ * 
+ * @param   compiled  The compiled pattern.
+ * @param   fbno      The index of the framebuffer.
+ * @param   frame     The index of the screenshot of the framebuffer.
+ * @param   width     The width of the image/framebuffer.
+ * @param   height    The height of the image/framebuffer.
+ * @param   path      The filename of the saved image, `NULL`
+ *                    during the evaluation of the filename pattern.
+ * @return            The constructed string, `NULL` on error.
  */
-char *evaluate (const char *restrict pattern, int fbno, long width,
+char *evaluate (const struct pattern *restrict compiled, int fbno, long frame, long width,
 		long height, const char *restrict path);
 
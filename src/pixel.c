@@ -0,0 +1,447 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "pixel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+
+
+/*
+ * Rationale:
+ * 
+ *   Converting the pixels is a significant part of the time
+ *   it takes to screenshot a large framebuffer, because it
+ *   is done one byte at a time. With SSSE3 or AVX2 we can
+ *   shuffle whole blocks of pixels at a time. The CPU is
+ *   checked at runtime, so that the binary is portable
+ *   within the architecture.
+ */
+
+
+
+/**
+ * Select the best implementation of `convert_xrgb8888`
+ * and then convert the pixels with it.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+static void select_xrgb8888 (png_byte *restrict pixbuf, const char *restrict buf, size_t n);
+
+
+/**
+ * Convert a run of pixels formatted as `%{blue}%{green}%{red}%{x}`
+ * in big-endian binary, or `%{x}%{red}%{green}%{blue}` in little-endian
+ * binary, to PNG pixel data.
+ * 
+ * This is a pointer to the fastest implementation
+ * supported by the CPU, it is selected on the first call.
+ */
+void (*convert_xrgb8888) (png_byte *restrict pixbuf, const char *restrict buf, size_t n) = select_xrgb8888;
+
+
+
+/**
+ * Portable implementation of `convert_xrgb8888`.
+ * 
+ * This is the reference implementation, all
+ * other implementations must output the same data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+void
+convert_xrgb8888_generic (png_byte *restrict pixbuf, const char *restrict buf, size_t n)
+{
+  const uint32_t *restrict pixel = (const uint32_t *)buf;
+  size_t i;
+  
+  for (i = 0; i < n; i++, pixel++, pixbuf += 3)
+    {
+      pixbuf[0] = (png_byte)((*pixel >> 16) & 255);
+      pixbuf[1] = (png_byte)((*pixel >> 8) & 255);
+      pixbuf[2] = (png_byte)((*pixel >> 0) & 255);
+    }
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * SSSE3 implementation of `convert_xrgb8888`.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+__attribute__ ((target ("ssse3")))
+static void
+convert_xrgb8888_ssse3 (png_byte *restrict pixbuf, const char *restrict buf, size_t n)
+{
+  /* Reorder each pixel's %{b}%{g}%{r}%{x} (in memory) to %{r}%{g}%{b},
+     and pack them, into the 12 lowest bytes. The upper 4 bytes are zeroed. */
+  const __m128i order = _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  __m128i a, b, c, d;
+  size_t i;
+  
+  /* 16 pixels (64 bytes) become exactly three vectors (48 bytes). */
+  for (i = 0; i + 16 <= n; i += 16, buf += 64, pixbuf += 48)
+    {
+      a = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(buf +  0)), order);
+      b = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(buf + 16)), order);
+      c = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(buf + 32)), order);
+      d = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(buf + 48)), order);
+      _mm_storeu_si128 ((__m128i *)(pixbuf +  0), _mm_or_si128 (a, _mm_slli_si128 (b, 12)));
+      _mm_storeu_si128 ((__m128i *)(pixbuf + 16), _mm_or_si128 (_mm_srli_si128 (b, 4), _mm_slli_si128 (c, 8)));
+      _mm_storeu_si128 ((__m128i *)(pixbuf + 32), _mm_or_si128 (_mm_srli_si128 (c, 8), _mm_slli_si128 (d, 4)));
+    }
+  
+  convert_xrgb8888_generic (pixbuf, buf, n - i);
+}
+
+
+/**
+ * AVX2 implementation of `convert_xrgb8888`.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+__attribute__ ((target ("avx2")))
+static void
+convert_xrgb8888_avx2 (png_byte *restrict pixbuf, const char *restrict buf, size_t n)
+{
+  /* Same as for SSSE3, but in both lanes, the packed 12 bytes
+     in each lane are then moved together into the lowest 24 bytes. */
+  const __m256i order = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+					  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7);
+  __m256i v;
+  size_t i;
+  
+  /* Each store writes 32 bytes of which only 24 are used, the
+     rest is overwritten by the next store. We must therefore
+     stop while there still is at least 8 bytes left after it. */
+  for (i = 0; i + 11 <= n; i += 8, buf += 32, pixbuf += 24)
+    {
+      v = _mm256_loadu_si256 ((const __m256i *)buf);
+      v = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (v, order), lanes);
+      _mm256_storeu_si256 ((__m256i *)pixbuf, v);
+    }
+  
+  convert_xrgb8888_ssse3 (pixbuf, buf, n - i);
+}
+
+#endif
+
+
+/**
+ * Select the best implementation of `convert_xrgb8888`
+ * and then convert the pixels with it.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+static void
+select_xrgb8888 (png_byte *restrict pixbuf, const char *restrict buf, size_t n)
+{
+  convert_xrgb8888 = convert_xrgb8888_generic;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    convert_xrgb8888 = convert_xrgb8888_avx2;
+  else if (__builtin_cpu_supports ("ssse3"))
+    convert_xrgb8888 = convert_xrgb8888_ssse3;
+#endif
+  convert_xrgb8888 (pixbuf, buf, n);
+}
+
+
+/**
+ * Convert a run of pixels with `convert_xrgb8888`.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_xrgb8888_format (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+			 const struct pixel_format *restrict format)
+{
+  (void) format;
+  convert_xrgb8888 (pixbuf, buf, n);
+}
+
+
+/**
+ * Convert a run of pixels formatted as `%{x}%{blue}%{green}%{red}`
+ * in little-endian binary, to PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_xbgr8888 (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		  const struct pixel_format *restrict format)
+{
+  const uint32_t *restrict pixel = (const uint32_t *)buf;
+  size_t i;
+  
+  (void) format;
+  for (i = 0; i < n; i++, pixel++, pixbuf += 3)
+    {
+      pixbuf[0] = (png_byte)((*pixel >> 0) & 255);
+      pixbuf[1] = (png_byte)((*pixel >> 8) & 255);
+      pixbuf[2] = (png_byte)((*pixel >> 16) & 255);
+    }
+}
+
+
+/**
+ * Convert a run of pixels formatted as `%{red}%{green}%{blue}`
+ * in little-endian binary, to PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 3 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_rgb888 (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		const struct pixel_format *restrict format)
+{
+  const unsigned char *restrict pixel = (const unsigned char *)buf;
+  size_t i;
+  
+  (void) format;
+  for (i = 0; i < n; i++, pixel += 3, pixbuf += 3)
+    {
+      pixbuf[0] = pixel[2];
+      pixbuf[1] = pixel[1];
+      pixbuf[2] = pixel[0];
+    }
+}
+
+
+/**
+ * Convert a run of pixels formatted as `%{blue}%{green}%{red}`
+ * in little-endian binary, to PNG pixel data. This is the
+ * same as the PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 3 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_bgr888 (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		const struct pixel_format *restrict format)
+{
+  (void) format;
+  memcpy (pixbuf, buf, 3 * n);
+}
+
+
+/**
+ * Convert a run of pixels with a 5-bit red channel, a 6-bit green
+ * channel, and a 5-bit blue channel, in that order from the most
+ * significant bit, to PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 2 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_rgb565 (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		const struct pixel_format *restrict format)
+{
+  const uint16_t *restrict pixel = (const uint16_t *)buf;
+  const png_byte *restrict r = format->lut[0];
+  const png_byte *restrict g = format->lut[1];
+  const png_byte *restrict b = format->lut[2];
+  size_t i;
+  
+  for (i = 0; i < n; i++, pixel++, pixbuf += 3)
+    {
+      pixbuf[0] = r[*pixel >> 11];
+      pixbuf[1] = g[(*pixel >> 5) & 63];
+      pixbuf[2] = b[*pixel & 31];
+    }
+}
+
+
+/**
+ * Convert a run of pixels that are 8-bit indices
+ * into a colour map, to PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 1 byte per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_pseudocolour (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		      const struct pixel_format *restrict format)
+{
+  const unsigned char *restrict pixel = (const unsigned char *)buf;
+  size_t i;
+  
+  for (i = 0; i < n; i++, pixel++, pixbuf += 3)
+    {
+      pixbuf[0] = format->lut[0][*pixel];
+      pixbuf[1] = format->lut[1][*pixel];
+      pixbuf[2] = format->lut[2][*pixel];
+    }
+}
+
+
+/**
+ * Convert a run of pixels of any format, with up
+ * to 4 bytes per pixel, to PNG pixel data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, `format->bytes` bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ * @param  format  The pixel format.
+ */
+static void
+convert_bitfields (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		   const struct pixel_format *restrict format)
+{
+  const unsigned char *restrict pixel = (const unsigned char *)buf;
+  size_t i, bytes = format->bytes;
+  uint32_t value, channel;
+  uint16_t value16;
+  int c;
+  
+  for (i = 0; i < n; i++, pixel += bytes, pixbuf += 3)
+    {
+      /* The pixels are stored in the CPU's byte order. */
+      if (bytes == 1)
+	value = *pixel;
+      else if (bytes == 2)
+	memcpy (&value16, pixel, 2), value = value16;
+      else if (bytes == 4)
+	memcpy (&value, pixel, 4);
+      else
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	value = ((uint32_t)(pixel[0]) << 16) | ((uint32_t)(pixel[1]) << 8) | (uint32_t)(pixel[2]);
+#else
+	value = (uint32_t)(pixel[0]) | ((uint32_t)(pixel[1]) << 8) | ((uint32_t)(pixel[2]) << 16);
+#endif
+      
+      for (c = 0; c < 3; c++)
+	{
+	  if (format->length[c] == 0)
+	    {
+	      pixbuf[c] = 0;
+	      continue;
+	    }
+	  channel = value >> format->offset[c];
+	  if (format->length[c] <= 8)
+	    pixbuf[c] = format->lut[c][channel & ((UINT32_C(1) << format->length[c]) - 1)];
+	  else
+	    pixbuf[c] = (png_byte)(channel >> (format->length[c] - 8));
+	}
+    }
+}
+
+
+/**
+ * Select how to convert pixels of a format.
+ * 
+ * @param   format   Output parameter for the pixel format.
+ * @param   bytes    The number of bytes per pixel.
+ * @param   offset   The number of bits below the red, green, and blue channel.
+ * @param   length   The number of bits in the red, green, and blue channel.
+ * @param   palette  The colour map, as 256 red, green, blue triplets, if
+ *                   the pixels are indices into it, otherwise `NULL`.
+ * @return           Zero on success, -1 on error. `errno` is set to
+ *                   `EINVAL` if the format is not supported.
+ */
+int
+init_pixel_format (struct pixel_format *restrict format, size_t bytes, const unsigned offset[3],
+		   const unsigned length[3], const png_byte *restrict palette)
+{
+#define IS(R_OFF, R_LEN, G_OFF, G_LEN, B_OFF, B_LEN)			\
+  ((offset[0] == R_OFF) && (length[0] == R_LEN) &&			\
+   (offset[1] == G_OFF) && (length[1] == G_LEN) &&			\
+   (offset[2] == B_OFF) && (length[2] == B_LEN))
+  
+  unsigned long mask, v;
+  int c;
+  
+  if ((bytes < 1) || (bytes > 4))
+    return errno = EINVAL, -1;
+  for (c = 0; c < 3; c++)
+    if ((length[c] > 32) || (offset[c] + length[c] > 8 * bytes))
+      return errno = EINVAL, -1;
+  
+  format->bytes = bytes;
+  memcpy (format->offset, offset, sizeof (format->offset));
+  memcpy (format->length, length, sizeof (format->length));
+  
+  /* Pixels that are indices into a colour map. */
+  if (palette != NULL)
+    {
+      if (bytes != 1)
+	return errno = EINVAL, -1;
+      for (v = 0; v < 256; v++)
+	for (c = 0; c < 3; c++)
+	  format->lut[c][v] = palette[3 * v + (unsigned long)c];
+      format->convert = convert_pseudocolour;
+      return 0;
+    }
+  
+  /* Scale each channel to 8 bits, with rounding. */
+  for (c = 0; c < 3; c++)
+    if ((length[c] > 0) && (length[c] <= 8))
+      for (mask = (1UL << length[c]) - 1, v = 0; v <= mask; v++)
+	format->lut[c][v] = (png_byte)((v * 255 + mask / 2) / mask);
+  
+  /* Use a tight loop for common formats. */
+  format->convert = convert_bitfields;
+  if ((bytes == 4) && IS (16, 8, 8, 8, 0, 8))
+    format->convert = convert_xrgb8888_format;
+  else if ((bytes == 4) && IS (0, 8, 8, 8, 16, 8))
+    format->convert = convert_xbgr8888;
+  else if ((bytes == 2) && IS (11, 5, 5, 6, 0, 5))
+    format->convert = convert_rgb565;
+#if !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ != __ORDER_BIG_ENDIAN__)
+  else if ((bytes == 3) && IS (16, 8, 8, 8, 0, 8))
+    format->convert = convert_rgb888;
+  else if ((bytes == 3) && IS (0, 8, 8, 8, 16, 8))
+    format->convert = convert_bgr888;
+#endif
+  
+  return 0;
+#undef IS
+}
+
@@ -0,0 +1,103 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pngtypes.h"
+
+
+
+/**
+ * How the pixels in a framebuffer are stored.
+ */
+struct pixel_format
+{
+  /**
+   * Convert a run of pixels to PNG pixel data.
+   * 
+   * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+   * @param  buf     The framebuffer data, `format->bytes` bytes per pixel.
+   * @param  n       The number of pixels to convert.
+   * @param  format  The pixel format.
+   */
+  void (*convert) (png_byte *restrict pixbuf, const char *restrict buf, size_t n,
+		   const struct pixel_format *restrict format);
+  
+  /**
+   * The number of bytes per pixel.
+   */
+  size_t bytes;
+  
+  /**
+   * The number of bits below the red, green, and blue channel.
+   */
+  unsigned offset[3];
+  
+  /**
+   * The number of bits in the red, green, and blue channel.
+   */
+  unsigned length[3];
+  
+  /**
+   * For each channel, the 8-bit value of each value the channel
+   * can have, if it has at most 8 bits. If the pixels are indices
+   * in a colour map, the value of the channel for each index.
+   */
+  png_byte lut[3][256];
+};
+
+
+
+/**
+ * Select how to convert pixels of a format.
+ * 
+ * @param   format   Output parameter for the pixel format.
+ * @param   bytes    The number of bytes per pixel.
+ * @param   offset   The number of bits below the red, green, and blue channel.
+ * @param   length   The number of bits in the red, green, and blue channel.
+ * @param   palette  The colour map, as 256 red, green, blue triplets, if
+ *                   the pixels are indices into it, otherwise `NULL`.
+ * @return           Zero on success, -1 on error. `errno` is set to
+ *                   `EINVAL` if the format is not supported.
+ */
+int init_pixel_format (struct pixel_format *restrict format, size_t bytes, const unsigned offset[3],
+		       const unsigned length[3], const png_byte *restrict palette);
+
+/**
+ * Convert a run of pixels formatted as `%{blue}%{green}%{red}%{x}`
+ * in big-endian binary, or `%{x}%{red}%{green}%{blue}` in little-endian
+ * binary, to PNG pixel data.
+ * 
+ * This is a pointer to the fastest implementation
+ * supported by the CPU, it is selected on the first call.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+extern void (*convert_xrgb8888) (png_byte *restrict pixbuf, const char *restrict buf, size_t n);
+
+/**
+ * Portable implementation of `convert_xrgb8888`.
+ * 
+ * This is the reference implementation, all
+ * other implementations must output the same data.
+ * 
+ * @param  pixbuf  Output buffer for the PNG pixel data, 3 bytes per pixel.
+ * @param  buf     The framebuffer data, 4 bytes per pixel.
+ * @param  n       The number of pixels to convert.
+ */
+void convert_xrgb8888_generic (png_byte *restrict pixbuf, const char *restrict buf, size_t n);
@@ -16,9 +16,14 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE /* For fopencookie. */
 #include "common.h"
 #include "png.h"
 #include "kern.h"
+#include "reduce.h"
+#include "stats.h"
+#include "sink.h"
+#include "strips.h"
 
 
 /*
@@ -31,38 +36,207 @@
 
 
 /**
- * Create an PNG file.
+ * Make sure that a buffer is large enough.
+ * 
+ * @param   buffer  The buffer.
+ * @param   n       The number of bytes needed.
+ * @return          The buffer, `NULL` on error.
+ */
+png_byte *
+reserve_buffer (struct buffer *restrict buffer, size_t n)
+{
+  void *new;
+  if (n > buffer->size)
+    {
+      new = realloc (buffer->buf, n);
+      if (new == NULL)
+	return NULL;
+      buffer->buf = new;
+      buffer->size = n;
+    }
+  return buffer->buf;
+}
+
+
+/**
+ * Write to the output, for a `FILE *` created by `fdopen_image`.
+ * 
+ * @param   cookie  The sink.
+ * @param   buf     The data to write.
+ * @param   n       The number of bytes to write.
+ * @return          The number of written bytes, -1 on error.
+ */
+static ssize_t
+write_cookie (void *cookie, const char *buf, size_t n)
+{
+  return write_sink (cookie, buf, n) < 0 ? -1 : (ssize_t)n;
+}
+
+
+/**
+ * Close the output, for a `FILE *` created by `fdopen_image`.
+ * 
+ * @param   cookie  The sink.
+ * @return          Zero on success, -1 on error.
+ */
+static int
+close_cookie (void *cookie)
+{
+  struct sink *sink = cookie;
+  int rc, saved_errno;
+  
+  rc = close_sink (sink);
+  saved_errno = errno;
+  if (close (sink->fd) && !rc)
+    rc = -1, saved_errno = errno;
+  free (sink);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Get a `FILE *` for the output, for code that writes with
+ * stdio. The file descriptor is duplicated, so that it is
+ * not closed when the `FILE *` is closed.
+ * 
+ * The output is written through a sink, which writes
+ * it in large blocks, and counts and times the writes
+ * when statistics are collected.
+ * 
+ * @param   imgfd  The file descriptor for the output.
+ * @return         The `FILE *`, `NULL` on error.
+ */
+FILE *
+fdopen_image (int imgfd)
+{
+  cookie_io_functions_t functions = { NULL, write_cookie, NULL, close_cookie };
+  struct sink *sink;
+  FILE *file = NULL;
+  int fd, saved_errno;
+  
+  fd = dup (imgfd);
+  if (fd < 0)
+    return NULL;
+  sink = malloc (sizeof (*sink));
+  if (sink == NULL)
+    goto fail;
+  if (open_sink (sink, fd) < 0)
+    goto fail;
+  file = fopencookie (sink, "w", functions);
+  if (file == NULL)
+    goto fail;
+  return file;
+  
+ fail:
+  saved_errno = errno;
+  if (sink != NULL)
+    close_sink (sink);
+  free (sink);
+  close (fd);
+  errno = saved_errno;
+  return NULL;
+}
+
+
+#ifdef USE_LIBPNG
+/**
+ * Write to the output, for libpng.
+ * 
+ * @param  pngbuf  The PNG structure, its I/O pointer is the sink.
+ * @param  data    The data to write.
+ * @param  n       The number of bytes to write.
+ */
+static void
+write_png_data (png_struct *pngbuf, png_byte *data, png_size_t n)
+{
+  if (write_sink (png_get_io_ptr (pngbuf), data, n) < 0)
+    png_error (pngbuf, "Write Error");
+}
+
+
+/**
+ * Flush the output, for libpng. This does nothing, the
+ * output is flushed when the image is complete.
+ * 
+ * @param  pngbuf  The PNG structure.
+ */
+static void
+flush_png_data (png_struct *pngbuf)
+{
+  (void) pngbuf;
+}
+#endif
+
+
+/**
+ * Convert a framebuffer to PNG pixel data, and store the
+ * entire image in memory rather than writing it to a PNG file.
+ * 
+ * The image is converted directly from the mapped framebuffer,
+ * unless it has been copied with `copy_fb` since it was rewound.
  * 
  * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   image   Output buffer for the image, `width * 3 * height` bytes.
+ * @param   width   The width of the image.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @return          Zero on success, -1 on error.
+ */
+int
+snapshot_fb (int fbfd, png_byte *restrict image, long width, void *restrict data)
+{
+  const char *pixels;
+  size_t n, adjustment;
+  long state = 0;
+  
+  pixels = view_fb (fbfd, &n, data);
+  if (pixels == NULL)
+    return -1;
+  
+  /* Everything after the conversion is encoding. */
+  enter_stage (STAGE_CONVERT);
+  if (convert_fb_to_png (NULL, image, pixels, n, width * 3, &adjustment, &state, data) < 0)
+    return -1;
+  enter_stage (STAGE_ENCODE);
+  return 0;
+}
+
+
+#ifdef USE_LIBPNG
+/**
+ * Create an PNG file of an image.
+ * 
+ * @param   image   The image, `width * 3 * height` bytes, followed
+ *                  by room for one more row, which is overwritten.
  * @param   width   The width of the image.
  * @param   height  The height of the image.
  * @param   imgfd   The file descriptor connected to conversion process's stdin.
- * @param   data    Additional data for `convert_fb_to_png`.
  * @return          Zero on success, -1 on error.
  */
 int
-save_png (int fbfd, long width, long height, int imgfd, void *restrict data)
+encode_png (png_byte *restrict image, long width, long height, int imgfd)
 {
-  char buf[8 << 10];
-  FILE *file = NULL;
-  ssize_t got, off;
-  size_t adjustment;
-  png_byte   *restrict pixbuf = NULL;
+  struct reduction reduction;
+  struct sink sink;
+  png_byte   *restrict row;
   png_struct *pngbuf = NULL;
   png_info   *pnginfo = NULL;
-  long width3, state = 0;
-  int rc, saved_errno;
+  size_t width3 = (size_t)width * 3;
+  long y;
+  int rc, saved_errno = 0;
   
-  /* Get a FILE * for the output, libpng wants a FILE *, not a file descriptor. */
-  file = fdopen (imgfd, "w");
-  if (file == NULL)
-    goto fail;
+  /* The last row of the buffer is used for rows
+     that are converted to the selected colour type. */
+  row = image + width3 * (size_t)height;
+  
+  /* Most of the time, 24 bits per pixel is unnecessary. */
+  analyse_image (image, width, height, width3, &reduction);
+  
+  /* Buffer the output in large blocks. */
+  if (open_sink (&sink, imgfd) < 0)
+    return -1;
   
   /* Allocte structures for the PNG. */
-  width3 = width * 3;
-  pixbuf = malloc ((size_t)width3 * sizeof (png_byte));
-  if (pixbuf == NULL)
-    goto fail;
   pngbuf = png_create_write_struct (png_get_libpng_ver (NULL), NULL, NULL, NULL);
   if (pngbuf == NULL)
     goto fail;
@@ -74,42 +248,23 @@ save_png (int fbfd, long width, long height, int imgfd, void *restrict data)
   errno = 0;
   if (setjmp (png_jmpbuf(pngbuf))) /* Failing libpng calls jump here. */
     goto fail;
-  png_init_io (pngbuf, file);
+  png_set_write_fn (pngbuf, &sink, write_png_data, flush_png_data);
   png_set_IHDR (pngbuf, pnginfo, (png_uint_32)width, (png_uint_32)height,
-		8 /* bit depth */, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+		reduction.depth, reduction.colour, PNG_INTERLACE_NONE,
 		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  if (reduction.colour == PNG_COLOR_TYPE_PALETTE)
+    png_set_PLTE (pngbuf, pnginfo, reduction.palette, reduction.ncolours);
   png_write_info (pngbuf, pnginfo);
   
-  /* TODO (maybe) The image shall be packed. That is, if 24 bits per pixel is
-   *              unnecessary, less shall be used. 6 bits is often sufficient. */
-  
-  /* Convert raw framebuffer data into a PNG image (body). */
-  for (off = 0;;)
-    {
-      /* Read data from the framebuffer, we may have up to 3 bytes buffered. */
-      got = read (fbfd, buf + off, sizeof (buf) - (size_t)off * sizeof (char));
-      if (got < 0)
-	goto fail;
-      if (got == 0)
-	break;
-      got += off;
-      
-      /* Convert read pixels. */
-      if (convert_fb_to_png (pngbuf, pixbuf, buf, (size_t)got,
-			     width3, &adjustment, &state, data) < 0)
-	goto fail;
-      
-      /* If we read a whole number of pixels, reset the buffer, otherwise,
-         move the unconverted bytes to the beginning of the buffer. */
-      if (adjustment)
-	{
-	  off -= (ssize_t)adjustment;
-	  memcpy (buf, buf + off, (size_t)(got - off) * sizeof (char));
-	  off = got - off;
-	}
-      else
-	off = 0;
-    }
+  /* Write the image (body). */
+  for (y = 0; y < height; y++)
+    if (reduction.colour == PNG_COLOR_TYPE_RGB)
+      SAVE_PNG_ROW (pngbuf, image + (size_t)y * width3);
+    else
+      {
+	reduce_row (row, image + (size_t)y * width3, width, &reduction);
+	SAVE_PNG_ROW (pngbuf, row);
+      }
   
   /* Done! */
   png_write_end (pngbuf, pnginfo);
@@ -122,13 +277,61 @@ save_png (int fbfd, long width, long height, int imgfd, void *restrict data)
   
  cleanup: 
   png_destroy_write_struct (&pngbuf, (pnginfo ? &pnginfo : NULL));
-  if (file != NULL)
-    {
-      fflush (file);
-      fclose (file);
-    }
-  free (pixbuf);
+  if ((close_sink (&sink) < 0) && (rc == 0))
+    rc = -1, saved_errno = errno;
   errno = saved_errno;
   return rc;
 }
+#else
+/**
+ * Create an PNG file of an image.
+ * 
+ * Without libpng, the image is encoded as
+ * one strip, with zlib, or the built-in
+ * encoder if it has been selected.
+ * 
+ * @param   image   The image, `width * 3 * height` bytes, followed
+ *                  by room for one more row, which is overwritten.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor connected to conversion process's stdin.
+ * @return          Zero on success, -1 on error.
+ */
+int
+encode_png (png_byte *restrict image, long width, long height, int imgfd)
+{
+  return encode_png_strips (image, width, height, imgfd, 1, NULL, 0);
+}
+#endif
 
+
+/**
+ * Create an PNG file.
+ * 
+ * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor connected to conversion process's stdin.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @param   buffer  Buffer to reuse between images, `NULL` if none.
+ * @return          Zero on success, -1 on error.
+ */
+int
+save_png (int fbfd, long width, long height, int imgfd, void *restrict data, struct buffer *restrict buffer)
+{
+  struct buffer local = {NULL, 0};
+  png_byte *image;
+  int rc = -1, saved_errno;
+  
+  /* Read the entire framebuffer, we need to see all of it to
+     select the colour type. The buffer has an extra row for
+     rows that are converted to that colour type. */
+  image = reserve_buffer (buffer ? buffer : &local, (size_t)width * 3 * (size_t)(height + 1) * sizeof (png_byte));
+  if ((image != NULL) && (snapshot_fb (fbfd, image, width, data) == 0))
+    rc = encode_png (image, width, height, imgfd);
+  
+  saved_errno = errno;
+  free (local.buf);
+  errno = saved_errno;
+  return rc;
+}
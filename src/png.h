@@ -16,14 +16,25 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifdef __GNUC__
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wpadded"
-#endif
-#include <png.h>
-#ifdef __GNUC__
-# pragma GCC diagnostic pop
-#endif
+#include "pngtypes.h"
+
+
+
+/**
+ * A buffer that can be reused between images.
+ */
+struct buffer
+{
+  /**
+   * The buffer.
+   */
+  png_byte *buf;
+  
+  /**
+   * The allocation size of `buf`.
+   */
+  size_t size;
+};
 
 
 
@@ -44,13 +55,72 @@
 /**
  * Store a row to a PNG image.
  * 
+ * Without libpng, there is no PNG image
+ * structure, so it is never called.
+ * 
  * @param  PNGBUF:png_struct *  The PNG image structure.
  * @param  PIXBUF:png_byte *    The pixel buffer for the row.
  */
-#define SAVE_PNG_ROW(PNGBUF, PIXBUF)  \
+#ifdef USE_LIBPNG
+# define SAVE_PNG_ROW(PNGBUF, PIXBUF)  \
   png_write_row (PNGBUF, PIXBUF)
+#else
+# define SAVE_PNG_ROW(PNGBUF, PIXBUF)  \
+  ((void)(PNGBUF), (void)(PIXBUF))
+#endif
 
 
+/**
+ * Make sure that a buffer is large enough.
+ * 
+ * @param   buffer  The buffer.
+ * @param   n       The number of bytes needed.
+ * @return          The buffer, `NULL` on error.
+ */
+png_byte *reserve_buffer (struct buffer *restrict buffer, size_t n);
+
+/**
+ * Get a `FILE *` for the output, for code that writes with
+ * stdio. The file descriptor is duplicated, so that it is
+ * not closed when the `FILE *` is closed.
+ * 
+ * The `FILE *` is a `fopencookie` stream over a sink on
+ * the duplicate, which writes the output in large blocks,
+ * and counts and times the writes when statistics are
+ * collected. Closing the `FILE *` closes the sink.
+ * 
+ * @param   imgfd  The file descriptor for the output.
+ * @return         The `FILE *`, `NULL` on error.
+ */
+FILE *fdopen_image (int imgfd);
+
+/**
+ * Convert a framebuffer to PNG pixel data, and store the
+ * entire image in memory rather than writing it to a PNG file.
+ * 
+ * The image is converted directly from the mapped framebuffer,
+ * unless it has been copied with `copy_fb` since it was rewound.
+ * 
+ * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   image   Output buffer for the image, `width * 3 * height` bytes.
+ * @param   width   The width of the image.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @return          Zero on success, -1 on error.
+ */
+int snapshot_fb (int fbfd, png_byte *restrict image, long width, void *restrict data);
+
+/**
+ * Create an PNG file of an image.
+ * 
+ * @param   image   The image, `width * 3 * height` bytes, followed
+ *                  by room for one more row, which is overwritten.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor connected to conversion process's stdin.
+ * @return          Zero on success, -1 on error.
+ */
+int encode_png (png_byte *restrict image, long width, long height, int imgfd);
+
 /**
  * Create an PNG file.
  * 
@@ -59,8 +129,9 @@
  * @param   height  The height of the image.
  * @param   imgfd   The file descriptor connected to conversion process's stdin.
  * @param   data    Additional data for `convert_fb_to_png`.
+ * @param   buffer  Buffer to reuse between images, `NULL` if none.
  * @return          Zero on success, -1 on error.
  */
 int
-save_png (int fbfd, long width, long height, int imgfd, void *restrict data);
+save_png (int fbfd, long width, long height, int imgfd, void *restrict data, struct buffer *restrict buffer);
 
@@ -0,0 +1,90 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef USE_LIBPNG
+# ifdef __GNUC__
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wpadded"
+# endif
+# include <png.h>
+# ifdef __GNUC__
+#  pragma GCC diagnostic pop
+# endif
+#elif !defined(PNG_COLOR_TYPE_RGB)
+
+
+
+/*
+ * The images are stored in libpng's types, even when
+ * they are encoded without libpng, so without libpng,
+ * the types and constants that are used are defined here.
+ */
+
+
+
+/**
+ * The colour type for grayscale.
+ */
+# define PNG_COLOR_TYPE_GRAY  0
+
+/**
+ * The colour type for RGB.
+ */
+# define PNG_COLOR_TYPE_RGB  2
+
+/**
+ * The colour type for a palette.
+ */
+# define PNG_COLOR_TYPE_PALETTE  3
+
+
+
+/**
+ * A byte in an image.
+ */
+typedef unsigned char png_byte;
+
+/**
+ * libpng's PNG image structure, it is never used without libpng.
+ */
+typedef struct png_struct_def png_struct;
+
+/**
+ * A colour in a palette.
+ */
+typedef struct png_color_struct
+{
+  /**
+   * The [0, 255]-value on the red subpixel.
+   */
+  png_byte red;
+  
+  /**
+   * The [0, 255]-value on the green subpixel.
+   */
+  png_byte green;
+  
+  /**
+   * The [0, 255]-value on the blue subpixel.
+   */
+  png_byte blue;
+} png_color;
+
+
+
+#endif
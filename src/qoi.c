@@ -0,0 +1,225 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "png.h"
+#include "qoi.h"
+#include "chunk.h"
+#include "sink.h"
+
+
+/*
+ * Rationale:
+ * 
+ *   When screenshots are taken many times per second, how
+ *   fast they are saved matters more than how small they
+ *   are. QOI is lossless, like PNG, but each pixel is coded
+ *   on its own, in a single pass, as a run, a reference to
+ *   a recently seen colour, a small difference from the
+ *   previous pixel, or the colour itself. Encoding is then
+ *   about as fast as converting the pixels, and a console,
+ *   with its long runs and few colours, still compresses well.
+ */
+
+
+
+/**
+ * A run of 1 to 62 pixels that are the same as the previous pixel.
+ */
+#define QOI_OP_RUN  0xC0
+
+/**
+ * A pixel that is in the table of recently seen colours.
+ */
+#define QOI_OP_INDEX  0x00
+
+/**
+ * A pixel whose channels differ from the previous pixel by -2 to 1.
+ */
+#define QOI_OP_DIFF  0x40
+
+/**
+ * A pixel whose green channel differs from the previous pixel by
+ * -32 to 31, and whose red and blue channels differ by -8 to 7
+ * more than the green channel.
+ */
+#define QOI_OP_LUMA  0x80
+
+/**
+ * A pixel whose colour is stored as is.
+ */
+#define QOI_OP_RGB  0xFE
+
+/**
+ * The longest run.
+ */
+#define QOI_MAX_RUN  62
+
+
+/**
+ * Get a pixel's position in the table of recently seen colours.
+ * 
+ * @param   R:int  The [0, 255]-value on the red subpixel.
+ * @param   G:int  The [0, 255]-value on the green subpixel.
+ * @param   B:int  The [0, 255]-value on the blue subpixel.
+ * @return         The position, [0, 63]. The pixels are opaque.
+ */
+#define QOI_HASH(R, G, B)  \
+  (((R) * 3 + (G) * 5 + (B) * 7 + 255 * 11) & 63)
+
+
+
+/**
+ * Create a QOI file from an image in memory.
+ * 
+ * @param   image   The image, `width * 3 * height` bytes.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor for the output.
+ * @return          Zero on success, -1 on error.
+ */
+int
+encode_qoi (const png_byte *restrict image, long width, long height, int imgfd)
+{
+  static const unsigned char end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  unsigned char head[14] = {'q', 'o', 'i', 'f'};
+  uint32_t seen[64], pixel, prev = 0;
+  unsigned char *restrict out = NULL;
+  const png_byte *restrict p;
+  struct sink sink;
+  size_t x, n, w = (size_t)width;
+  long y;
+  int r, g, b, dr, dg, db, i, run = 0, rc = -1, saved_errno;
+  
+  if (open_sink (&sink, imgfd) < 0)
+    return -1;
+  
+  /* The header: "qoif", the size, 3 channels, and sRGB with linear alpha. */
+  PUT_UINT32 (head + 4, (uint32_t)width);
+  PUT_UINT32 (head + 8, (uint32_t)height);
+  head[12] = 3, head[13] = 0;
+  if (write_sink (&sink, head, sizeof (head)) < 0)
+    goto fail;
+  
+  /* Each row is coded in a buffer of its own, which is large
+     enough for every pixel to be stored as is, and a run. */
+  out = malloc (w * 4 + 1);
+  if (out == NULL)
+    goto fail;
+  
+  /* The previous pixel starts as opaque black, and the table
+     as transparent black, which none of the pixels are. */
+  memset (seen, 0xFF, sizeof (seen));
+  for (y = 0; y < height; y++)
+    {
+      p = image + (size_t)y * w * 3;
+      for (n = 0, x = 0; x < w; x++, p += 3)
+	{
+	  r = p[0], g = p[1], b = p[2];
+	  pixel = ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+	  if (pixel == prev)
+	    {
+	      if (++run == QOI_MAX_RUN)
+		out[n++] = (unsigned char)(QOI_OP_RUN | (run - 1)), run = 0;
+	      continue;
+	    }
+	  if (run)
+	    out[n++] = (unsigned char)(QOI_OP_RUN | (run - 1)), run = 0;
+	  
+	  i = QOI_HASH (r, g, b);
+	  if (seen[i] == pixel)
+	    {
+	      out[n++] = (unsigned char)(QOI_OP_INDEX | i);
+	      prev = pixel;
+	      continue;
+	    }
+	  seen[i] = pixel;
+	  
+	  /* The differences wrap around, as bytes. */
+	  dr = (signed char)(r - (int)((prev >> 16) & 255));
+	  dg = (signed char)(g - (int)((prev >> 8) & 255));
+	  db = (signed char)(b - (int)(prev & 255));
+	  prev = pixel;
+	  if ((dr >= -2) && (dr <= 1) && (dg >= -2) && (dg <= 1) && (db >= -2) && (db <= 1))
+	    out[n++] = (unsigned char)(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+	  else if ((dg >= -32) && (dg <= 31) &&
+		   (dr - dg >= -8) && (dr - dg <= 7) &&
+		   (db - dg >= -8) && (db - dg <= 7))
+	    {
+	      out[n++] = (unsigned char)(QOI_OP_LUMA | (dg + 32));
+	      out[n++] = (unsigned char)(((dr - dg + 8) << 4) | (db - dg + 8));
+	    }
+	  else
+	    {
+	      out[n++] = QOI_OP_RGB;
+	      out[n++] = (unsigned char)r;
+	      out[n++] = (unsigned char)g;
+	      out[n++] = (unsigned char)b;
+	    }
+	}
+      
+      /* A run can continue on the next row, but not past the last. */
+      if (run && (y + 1 == height))
+	out[n++] = (unsigned char)(QOI_OP_RUN | (run - 1)), run = 0;
+      if (write_sink (&sink, out, n) < 0)
+	goto fail;
+    }
+  
+  if (write_sink (&sink, end, sizeof (end)) < 0)
+    goto fail;
+  rc = 0;
+  
+ fail:
+  saved_errno = errno;
+  if ((close_sink (&sink) < 0) && (rc == 0))
+    rc = -1, saved_errno = errno;
+  free (out);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Create a QOI file.
+ * 
+ * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor for the output.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @param   buffer  Buffer to reuse between images, `NULL` if none.
+ * @return          Zero on success, -1 on error.
+ */
+int
+save_qoi (int fbfd, long width, long height, int imgfd, void *restrict data,
+	  struct buffer *restrict buffer)
+{
+  struct buffer local = {NULL, 0};
+  png_byte *image;
+  int rc = -1, saved_errno;
+  
+  /* The pixels are converted, just like for a PNG image, and then coded. */
+  image = reserve_buffer (buffer ? buffer : &local, (size_t)width * 3 * (size_t)height * sizeof (png_byte));
+  if ((image != NULL) && (snapshot_fb (fbfd, image, width, data) == 0))
+    rc = encode_qoi (image, width, height, imgfd);
+  
+  saved_errno = errno;
+  free (local.buf);
+  errno = saved_errno;
+  return rc;
+}
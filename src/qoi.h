@@ -0,0 +1,49 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * Defined in png.h.
+ */
+struct buffer;
+
+
+
+/**
+ * Create a QOI file from an image in memory.
+ * 
+ * @param   image   The image, `width * 3 * height` bytes.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor for the output.
+ * @return          Zero on success, -1 on error.
+ */
+int encode_qoi (const png_byte *restrict image, long width, long height, int imgfd);
+
+/**
+ * Create a QOI file.
+ * 
+ * @param   fbfd    The file descriptor connected to framebuffer device.
+ * @param   width   The width of the image.
+ * @param   height  The height of the image.
+ * @param   imgfd   The file descriptor for the output.
+ * @param   data    Additional data for `convert_fb_to_png`.
+ * @param   buffer  Buffer to reuse between images, `NULL` if none.
+ * @return          Zero on success, -1 on error.
+ */
+int save_qoi (int fbfd, long width, long height, int imgfd, void *restrict data,
+	      struct buffer *restrict buffer);
@@ -0,0 +1,318 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "raw.h"
+#include "stats.h"
+
+
+/*
+ * A raw framebuffer dump begins with a header of
+ * `RAW_HEADER_SIZE` bytes, with a text that describes
+ * the dump, padded with NUL bytes, and is followed by
+ * the pixels as they were stored in the framebuffer,
+ * from the beginning of the first visible line to the
+ * end of the last visible line. If the pixels are
+ * indices into a colour map, the header has a
+ * `colours` line, and is followed by the colour map,
+ * as red, green, blue byte triplets, before the
+ * pixels. For example:
+ * 
+ *   scrotty raw 1
+ *   fb 0
+ *   width 1024
+ *   height 768
+ *   xoffset 0
+ *   line-length 4096
+ *   bits-per-pixel 32
+ *   red 16 8
+ *   green 8 8
+ *   blue 0 8
+ *   transp 0 0
+ * 
+ * or, for a framebuffer with a colour map:
+ * 
+ *   scrotty raw 1
+ *   fb 0
+ *   width 640
+ *   height 480
+ *   xoffset 0
+ *   line-length 640
+ *   bits-per-pixel 8
+ *   red 0 8
+ *   green 0 8
+ *   blue 0 8
+ *   transp 0 0
+ *   colours 256
+ * 
+ * A dump without a header, for example a copy of
+ * a framebuffer device, is described by a sidecar,
+ * a file with the same lines as the header, except
+ * that the first line, and the `fb`, `xoffset`,
+ * `line-length` and `transp` lines, are optional.
+ * If it has a `colours` line, it must be padded,
+ * like the header, and followed by the colour map.
+ */
+
+
+
+/**
+ * The first line of the header.
+ */
+#define RAW_MAGIC  "scrotty raw 1\n"
+
+
+
+/**
+ * Write the header of a raw framebuffer dump,
+ * and its colour map if it has one.
+ * 
+ * @param   fd      The file descriptor of the output.
+ * @param   header  The header.
+ * @return          Zero on success, -1 on error.
+ */
+int
+write_raw_header (int fd, const struct raw_header *restrict header)
+{
+  char buf[RAW_HEADER_SIZE + sizeof (header->palette)];
+  size_t off = 0, n;
+  unsigned long calls = 0;
+  ssize_t r;
+  int len;
+  
+  memset (buf, 0, sizeof (buf));
+  len = snprintf (buf, RAW_HEADER_SIZE,
+	    RAW_MAGIC
+	    "fb %li\n"
+	    "width %lu\n"
+	    "height %lu\n"
+	    "xoffset %lu\n"
+	    "line-length %lu\n"
+	    "bits-per-pixel %lu\n"
+	    "red %lu %lu\n"
+	    "green %lu %lu\n"
+	    "blue %lu %lu\n"
+	    "transp %lu %lu\n",
+	    header->fbno, header->width, header->height, header->xoffset,
+	    header->line_length, header->bits_per_pixel,
+	    header->red.offset, header->red.length,
+	    header->green.offset, header->green.length,
+	    header->blue.offset, header->blue.length,
+	    header->transp.offset, header->transp.length);
+  if (header->colours)
+    snprintf (buf + len, RAW_HEADER_SIZE - (size_t)len, "colours %lu\n", header->colours);
+  
+  n = RAW_DATA_OFFSET (header);
+  memcpy (buf + RAW_HEADER_SIZE, header->palette, n - RAW_HEADER_SIZE);
+  for (; off < n; calls++)
+    {
+      r = write (fd, buf + off, n - off);
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      off += (size_t)r;
+    }
+  count_write (n, calls);
+  return 0;
+}
+
+
+/**
+ * Read the header of a raw framebuffer dump, or a sidecar.
+ * 
+ * @param   fd       The file descriptor of the dump, or sidecar.
+ * @param   header   Output parameter for the header, and colour map.
+ * @param   sidecar  Is `fd` a sidecar, rather than a dump?
+ * @return           Zero on success, -1 on error. `errno` is set to
+ *                   `EINVAL` if the file is not a valid dump, or sidecar.
+ */
+static int
+read_header (int fd, struct raw_header *restrict header, int sidecar)
+{
+#define FB              0x001
+#define WIDTH           0x002
+#define HEIGHT          0x004
+#define XOFFSET         0x008
+#define LINE_LENGTH     0x010
+#define BITS_PER_PIXEL  0x020
+#define RED             0x040
+#define GREEN           0x080
+#define BLUE            0x100
+#define TRANSP          0x200
+#define REQUIRED_FIELDS  (sidecar ? (WIDTH | HEIGHT | BITS_PER_PIXEL | RED | GREEN | BLUE) : 0x3FF)
+  
+  char buf[RAW_HEADER_SIZE + 2];
+  char *line, *end;
+  size_t off = 0, n;
+  uintmax_t line_length;
+  ssize_t r;
+  int fields = 0;
+  
+  if (lseek (fd, 0, SEEK_SET) < 0)
+    return -1;
+  while (off < RAW_HEADER_SIZE)
+    {
+      r = read (fd, buf + off, RAW_HEADER_SIZE - off);
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (r == 0)
+	{
+	  if (!sidecar)
+	    goto invalid;
+	  break;
+	}
+      off += (size_t)r;
+    }
+  buf[off] = '\0';
+  
+  /* A sidecar may be written by hand, the last
+     line does not have to be terminated. */
+  n = strlen (buf);
+  if (sidecar && n && (buf[n - 1] != '\n'))
+    buf[n] = '\n', buf[n + 1] = '\0';
+  
+  line = buf;
+  if (!strncmp (buf, RAW_MAGIC, sizeof (RAW_MAGIC) - 1))
+    line += sizeof (RAW_MAGIC) - 1;
+  else if (!sidecar)
+    goto invalid;
+  memset (header, 0, sizeof (*header));
+  
+  /* Parse the lines. Unrecognised lines are ignored, so that
+     more information can be added in future versions. */
+  for (; *line; line = end + 1)
+    {
+      end = strchr (line, '\n');
+      if (end == NULL)
+	goto invalid;
+      *end = '\0';
+#define X(NAME, FIELD, BIT)								\
+      else if (sscanf (line, NAME " %lu", &(header->FIELD)) == 1)			\
+	fields |= BIT
+#define Y(NAME, FIELD, BIT)								\
+      else if (sscanf (line, NAME " %lu %lu", &(header->FIELD.offset),			\
+		       &(header->FIELD.length)) == 2)					\
+	fields |= BIT
+      if (sscanf (line, "fb %li", &(header->fbno)) == 1)
+	fields |= FB;
+      X ("width", width, WIDTH);
+      X ("height", height, HEIGHT);
+      X ("xoffset", xoffset, XOFFSET);
+      X ("line-length", line_length, LINE_LENGTH);
+      X ("bits-per-pixel", bits_per_pixel, BITS_PER_PIXEL);
+      Y ("red", red, RED);
+      Y ("green", green, GREEN);
+      Y ("blue", blue, BLUE);
+      Y ("transp", transp, TRANSP);
+      else
+	(void) sscanf (line, "colours %lu", &(header->colours));
+#undef X
+#undef Y
+    }
+  
+  if (((fields & REQUIRED_FIELDS) != REQUIRED_FIELDS) || (header->colours > 256))
+    goto invalid;
+  
+  /* The fields are stored in the kernel's 32-bit fields. */
+#define X(FIELD)  (header->FIELD > UINT32_MAX)
+  if (X (width) || X (height) || X (xoffset) || X (line_length) || X (bits_per_pixel) ||
+      X (red.offset) || X (red.length) || X (green.offset) || X (green.length) ||
+      X (blue.offset) || X (blue.length) || X (transp.offset) || X (transp.length))
+    goto invalid;
+#undef X
+  if (!(fields & LINE_LENGTH))
+    {
+      line_length = ((uintmax_t)(header->xoffset) + header->width) * (header->bits_per_pixel / 8);
+      if (line_length > UINT32_MAX)
+	goto invalid;
+      header->line_length = (unsigned long)line_length;
+    }
+
+  /* Read the colour map, it follows the header, which is padded. */
+  if (header->colours && (lseek (fd, RAW_HEADER_SIZE, SEEK_SET) < 0))
+    return -1;
+  for (off = 0, n = 3 * (size_t)(header->colours); off < n; off += (size_t)r)
+    {
+      r = read (fd, header->palette + off, n - off);
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      r = 0;
+	      continue;
+	    }
+	  return -1;
+	}
+      if (r == 0)
+	goto invalid;
+    }
+  return 0;
+ invalid:
+  return errno = EINVAL, -1;
+  
+#undef FB
+#undef WIDTH
+#undef HEIGHT
+#undef XOFFSET
+#undef LINE_LENGTH
+#undef BITS_PER_PIXEL
+#undef RED
+#undef GREEN
+#undef BLUE
+#undef TRANSP
+#undef REQUIRED_FIELDS
+}
+
+
+/**
+ * Read the header of a raw framebuffer dump.
+ * 
+ * @param   fd      The file descriptor of the dump, it is read
+ *                  from the beginning, and positioned at the
+ *                  first pixel when the function returns.
+ * @param   header  Output parameter for the header, and colour map.
+ * @return          Zero on success, -1 on error. `errno` is set to
+ *                  `EINVAL` if the file is not a raw framebuffer dump.
+ */
+int
+read_raw_header (int fd, struct raw_header *restrict header)
+{
+  return read_header (fd, header, 0);
+}
+
+
+/**
+ * Read the sidecar of a raw framebuffer dump without a header.
+ * 
+ * @param   fd      The file descriptor of the sidecar.
+ * @param   header  Output parameter for the header, and colour map.
+ * @return          Zero on success, -1 on error. `errno` is set to
+ *                  `EINVAL` if the file is not a valid sidecar.
+ */
+int
+read_raw_sidecar (int fd, struct raw_header *restrict header)
+{
+  return read_header (fd, header, 1);
+}
@@ -0,0 +1,155 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * The size of the header of a raw framebuffer
+ * dump, the pixels start at this offset.
+ */
+#define RAW_HEADER_SIZE  512
+
+
+
+/**
+ * The position and size of a colour channel in a pixel.
+ */
+struct raw_channel
+{
+  /**
+   * The number of bits below the channel.
+   */
+  unsigned long offset;
+  
+  /**
+   * The number of bits in the channel.
+   */
+  unsigned long length;
+};
+
+/**
+ * The header of a raw framebuffer dump.
+ */
+struct raw_header
+{
+  /**
+   * The index of the framebuffer.
+   */
+  long fbno;
+  
+  /**
+   * The width of the image.
+   */
+  unsigned long width;
+  
+  /**
+   * The height of the image.
+   */
+  unsigned long height;
+  
+  /**
+   * The number of dead pixels at the
+   * beginning of each line, before the image.
+   */
+  unsigned long xoffset;
+  
+  /**
+   * The number of bytes in each line.
+   */
+  unsigned long line_length;
+  
+  /**
+   * The number of bits per pixel.
+   */
+  unsigned long bits_per_pixel;
+  
+  /**
+   * The red channel.
+   */
+  struct raw_channel red;
+  
+  /**
+   * The green channel.
+   */
+  struct raw_channel green;
+  
+  /**
+   * The blue channel.
+   */
+  struct raw_channel blue;
+  
+  /**
+   * The alpha channel.
+   */
+  struct raw_channel transp;
+  
+  /**
+   * The number of colours in the colour map,
+   * zero if the pixels are not indices into
+   * a colour map.
+   */
+  unsigned long colours;
+  
+  /**
+   * The colour map, as red, green, blue triplets.
+   */
+  unsigned char palette[3 * 256];
+};
+
+
+
+/**
+ * The offset of the first pixel in a raw framebuffer dump.
+ * 
+ * @param   header:const struct raw_header *  The header of the dump.
+ * @return  :size_t                            The number of bytes before the first pixel.
+ */
+#define RAW_DATA_OFFSET(header)  (RAW_HEADER_SIZE + 3 * (size_t)((header)->colours))
+
+
+
+/**
+ * Write the header of a raw framebuffer dump,
+ * and its colour map if it has one.
+ * 
+ * @param   fd      The file descriptor of the output.
+ * @param   header  The header.
+ * @return          Zero on success, -1 on error.
+ */
+int write_raw_header (int fd, const struct raw_header *restrict header);
+
+/**
+ * Read the header of a raw framebuffer dump.
+ * 
+ * @param   fd      The file descriptor of the dump, it is read
+ *                  from the beginning, and positioned at the
+ *                  first pixel when the function returns.
+ * @param   header  Output parameter for the header.
+ * @return          Zero on success, -1 on error. `errno` is set to
+ *                  `EINVAL` if the file is not a raw framebuffer dump.
+ */
+int read_raw_header (int fd, struct raw_header *restrict header);
+
+/**
+ * Read the sidecar of a raw framebuffer dump without a header.
+ * 
+ * @param   fd      The file descriptor of the sidecar.
+ * @param   header  Output parameter for the header, and colour map.
+ * @return          Zero on success, -1 on error. `errno` is set to
+ *                  `EINVAL` if the file is not a valid sidecar.
+ */
+int read_raw_sidecar (int fd, struct raw_header *restrict header);
+
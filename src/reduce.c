@@ -0,0 +1,216 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "png.h"
+#include "reduce.h"
+
+
+/*
+ * Rationale:
+ * 
+ *   Text consoles rarely use more than 16 colours, so
+ *   24 bits per pixel is mostly wasted. With a palette
+ *   of 16 colours, 4 bits per pixel are sufficient; the
+ *   file is smaller, and there is 6 times less data to
+ *   compress. Grayscale images do not need a palette,
+ *   and images with only black and white, or with a
+ *   few evenly spaced grays, can use a lower bit depth.
+ *   Consecutive pixels are very often the same colour,
+ *   so the colour lookup is skipped for them.
+ */
+
+
+
+/**
+ * The slot in the colour lookup table to start looking in.
+ * 
+ * @param   COLOUR:uint32_t  The colour, as `0x1RRGGBB`.
+ * @return  :size_t          The index of the slot.
+ */
+#define HASH(COLOUR)  \
+  ((size_t)(((COLOUR) * UINT32_C(2654435761)) >> 22) & (REDUCTION_TABLE_SIZE - 1))
+
+/**
+ * Get a pixel as `0x1RRGGBB`.
+ * 
+ * @param   P:const png_byte *  The pixel.
+ * @return  :uint32_t           The colour.
+ */
+#define COLOUR(P)  \
+  (UINT32_C(0x1000000) | ((uint32_t)((P)[0]) << 16) | ((uint32_t)((P)[1]) << 8) | (uint32_t)((P)[2]))
+
+
+
+/**
+ * Get the lowest bit depth a gray value can
+ * be stored at without losing precision.
+ * 
+ * @param   value  The value, [0, 255].
+ * @return         The bit depth, 1, 2, 4 or 8.
+ */
+static int
+gray_depth (int value)
+{
+  if (value % 255 == 0)  return 1;
+  if (value % 85 == 0)   return 2;
+  if (value % 17 == 0)   return 4;
+  return 8;
+}
+
+
+/**
+ * Find the colour type and bit depth that stores
+ * an image with the fewest bits per pixel.
+ * 
+ * @param  image      The image, with 3 bytes per pixel.
+ * @param  width      The width of the image.
+ * @param  height     The height of the image.
+ * @param  stride     The number of bytes between the start of each row.
+ * @param  reduction  Output parameter for the colour type, bit depth and palette.
+ */
+void
+analyse_image (const png_byte *restrict image, long width, long height,
+	       size_t stride, struct reduction *restrict reduction)
+{
+  const png_byte *restrict row;
+  const png_byte *restrict end;
+  uint32_t colour, last = 0;
+  size_t i;
+  long y;
+  int gray = 1, graydepth = 1, palettedepth;
+  
+  memset (reduction->keys, 0, sizeof (reduction->keys));
+  reduction->ncolours = 0;
+  
+  for (y = 0; y < height; y++)
+    for (row = image + (size_t)y * stride, end = row + width * 3; row != end; row += 3)
+      {
+	colour = COLOUR (row);
+	if (colour == last)
+	  continue;
+	last = colour;
+	
+	/* Have we seen this colour before? */
+	for (i = HASH (colour); reduction->keys[i]; i = (i + 1) & (REDUCTION_TABLE_SIZE - 1))
+	  if (reduction->keys[i] == colour)
+	    goto next;
+	
+	/* More than 256 colours, it cannot be gray either. */
+	if (reduction->ncolours == 256)
+	  goto rgb;
+	
+	reduction->keys[i] = colour;
+	reduction->values[i] = (png_byte)(reduction->ncolours);
+	reduction->palette[reduction->ncolours].red   = row[0];
+	reduction->palette[reduction->ncolours].green = row[1];
+	reduction->palette[reduction->ncolours].blue  = row[2];
+	reduction->ncolours++;
+	
+	if (gray && (row[0] == row[1]) && (row[1] == row[2]))
+	  graydepth = graydepth > gray_depth (row[0]) ? graydepth : gray_depth (row[0]);
+	else
+	  gray = 0;
+      next:;
+      }
+  
+  /* Use as few bits per pixel as possible, and prefer
+     grayscale over a palette if they are equally good,
+     since grayscale does not need a palette. */
+  palettedepth = reduction->ncolours <= 2 ? 1 : reduction->ncolours <= 4 ? 2 :
+                 reduction->ncolours <= 16 ? 4 : 8;
+  if (gray && (graydepth <= palettedepth))
+    {
+      reduction->colour = PNG_COLOR_TYPE_GRAY;
+      reduction->depth = graydepth;
+    }
+  else
+    {
+      reduction->colour = PNG_COLOR_TYPE_PALETTE;
+      reduction->depth = palettedepth;
+    }
+  return;
+  
+ rgb:
+  reduction->colour = PNG_COLOR_TYPE_RGB;
+  reduction->depth = 8;
+}
+
+
+/**
+ * Get the number of bytes in a row of a reduced image.
+ * 
+ * @param   width      The width of the image.
+ * @param   reduction  The reduction from `analyse_image`.
+ * @return             The number of bytes in a row.
+ */
+size_t
+reduced_row_size (long width, const struct reduction *restrict reduction)
+{
+  size_t channels = reduction->colour == PNG_COLOR_TYPE_RGB ? 3 : 1;
+  return ((size_t)width * channels * (size_t)(reduction->depth) + 7) / 8;
+}
+
+
+/**
+ * Convert a row to the colour type and bit depth
+ * selected by `analyse_image`. Must not be used if
+ * the colour type is `PNG_COLOR_TYPE_RGB`.
+ * 
+ * @param  out        Output buffer, `reduced_row_size (width, reduction)` bytes.
+ * @param  row        The row, with 3 bytes per pixel.
+ * @param  width      The width of the image.
+ * @param  reduction  The reduction from `analyse_image`.
+ */
+void
+reduce_row (png_byte *restrict out, const png_byte *restrict row, long width,
+	    const struct reduction *restrict reduction)
+{
+  const png_byte *restrict end = row + width * 3;
+  int depth = reduction->depth, bits = 0;
+  int divisor = 255 / ((1 << depth) - 1);
+  unsigned acc = 0, value = 0;
+  uint32_t colour, last = 0;
+  size_t i;
+  
+  for (; row != end; row += 3)
+    {
+      if (reduction->colour == PNG_COLOR_TYPE_GRAY)
+	value = (unsigned)(row[0] / divisor);
+      else if ((colour = COLOUR (row)) != last)
+	{
+	  for (i = HASH (colour); reduction->keys[i] != colour; i = (i + 1) & (REDUCTION_TABLE_SIZE - 1));
+	  value = reduction->values[i];
+	  last = colour;
+	}
+      
+      /* Pack the pixels, the first pixel in the most significant bits. */
+      acc = (acc << depth) | value;
+      bits += depth;
+      if (bits == 8)
+	{
+	  *out++ = (png_byte)acc;
+	  acc = 0;
+	  bits = 0;
+	}
+    }
+  
+  if (bits)
+    *out = (png_byte)(acc << (8 - bits));
+}
+
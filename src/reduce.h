@@ -0,0 +1,102 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * The number of slots in the colour lookup table,
+ * must be a power of two, greater than 256.
+ */
+#define REDUCTION_TABLE_SIZE  1024
+
+
+
+/**
+ * How an image can be stored with fewer
+ * bits per pixel than 24-bit RGB.
+ */
+struct reduction
+{
+  /**
+   * The colour type, `PNG_COLOR_TYPE_PALETTE`,
+   * `PNG_COLOR_TYPE_GRAY` or `PNG_COLOR_TYPE_RGB`.
+   */
+  int colour;
+  
+  /**
+   * The bit depth, 1, 2, 4 or 8.
+   */
+  int depth;
+  
+  /**
+   * The number of colours in `palette`.
+   */
+  int ncolours;
+  
+  /**
+   * The palette, when `colour` is `PNG_COLOR_TYPE_PALETTE`.
+   */
+  png_color palette[256];
+  
+  /**
+   * The colours in the palette, as `0x1RRGGBB`,
+   * in a hash table, zero for unused slots.
+   */
+  uint32_t keys[REDUCTION_TABLE_SIZE];
+  
+  /**
+   * The index in the palette of the colours in `keys`.
+   */
+  png_byte values[REDUCTION_TABLE_SIZE];
+};
+
+
+
+/**
+ * Find the colour type and bit depth that stores
+ * an image with the fewest bits per pixel.
+ * 
+ * @param  image      The image, with 3 bytes per pixel.
+ * @param  width      The width of the image.
+ * @param  height     The height of the image.
+ * @param  stride     The number of bytes between the start of each row.
+ * @param  reduction  Output parameter for the colour type, bit depth and palette.
+ */
+void analyse_image (const png_byte *restrict image, long width, long height,
+		    size_t stride, struct reduction *restrict reduction);
+
+/**
+ * Get the number of bytes in a row of a reduced image.
+ * 
+ * @param   width      The width of the image.
+ * @param   reduction  The reduction from `analyse_image`.
+ * @return             The number of bytes in a row.
+ */
+size_t reduced_row_size (long width, const struct reduction *restrict reduction);
+
+/**
+ * Convert a row to the colour type and bit depth
+ * selected by `analyse_image`. Must not be used if
+ * the colour type is `PNG_COLOR_TYPE_RGB`.
+ * 
+ * @param  out        Output buffer, `reduced_row_size (width, reduction)` bytes.
+ * @param  row        The row, with 3 bytes per pixel.
+ * @param  width      The width of the image.
+ * @param  reduction  The reduction from `analyse_image`.
+ */
+void reduce_row (png_byte *restrict out, const png_byte *restrict row, long width,
+		 const struct reduction *restrict reduction);
+
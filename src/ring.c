@@ -0,0 +1,134 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "ring.h"
+
+
+
+/**
+ * Create a ring.
+ * 
+ * @param   ring  The ring.
+ * @param   size  The number of slots.
+ * @return        Zero on success, -1 on error.
+ */
+int
+init_ring (struct ring *restrict ring, size_t size)
+{
+  int saved_errno;
+  
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+  if (sem_init (&(ring->empty), 0, (unsigned)size))
+    return -1;
+  if (sem_init (&(ring->filled), 0, 0))
+    {
+      saved_errno = errno;
+      sem_destroy (&(ring->empty));
+      errno = saved_errno;
+      return -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Destroy a ring, created with `init_ring`.
+ * 
+ * @param  ring  The ring.
+ */
+void
+destroy_ring (struct ring *restrict ring)
+{
+  sem_destroy (&(ring->empty));
+  sem_destroy (&(ring->filled));
+}
+
+
+/**
+ * Wait on a semaphore, until it succeeds.
+ * 
+ * @param  sem  The semaphore.
+ */
+static void
+wait_sem (sem_t *restrict sem)
+{
+  /* `sem_wait` can only fail on interruption, or if
+     the semaphore is invalid, which is a bug. */
+  while (sem_wait (sem))
+    if (errno != EINTR)
+      abort ();
+}
+
+
+/**
+ * Wait for an empty slot. Only the producer may call this.
+ * 
+ * @param   ring  The ring.
+ * @return        The index of the slot.
+ */
+size_t
+ring_acquire (struct ring *restrict ring)
+{
+  wait_sem (&(ring->empty));
+  return ring->head;
+}
+
+
+/**
+ * Hand over the slot returned by `ring_acquire`
+ * to the consumer. Only the producer may call this.
+ * 
+ * @param  ring  The ring.
+ */
+void
+ring_publish (struct ring *restrict ring)
+{
+  ring->head = (ring->head + 1) % ring->size;
+  sem_post (&(ring->filled));
+}
+
+
+/**
+ * Wait for a filled slot. Only the consumer may call this.
+ * 
+ * @param   ring  The ring.
+ * @return        The index of the slot.
+ */
+size_t
+ring_consume (struct ring *restrict ring)
+{
+  wait_sem (&(ring->filled));
+  return ring->tail;
+}
+
+
+/**
+ * Hand back the slot returned by `ring_consume`
+ * to the producer. Only the consumer may call this.
+ * 
+ * @param  ring  The ring.
+ */
+void
+ring_release (struct ring *restrict ring)
+{
+  ring->tail = (ring->tail + 1) % ring->size;
+  sem_post (&(ring->empty));
+}
@@ -0,0 +1,131 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <semaphore.h>
+#include <stddef.h>
+
+
+
+/**
+ * A bounded queue between one producer thread
+ * and one consumer thread.
+ * 
+ * The ring only keeps track of which slots are
+ * filled, the slots themselves are an array,
+ * with `size` elements, owned by the user of
+ * the ring. The producer fills the slot whose
+ * index is returned by `ring_acquire`, and
+ * hands it over with `ring_publish`. The
+ * consumer reads the slot whose index is
+ * returned by `ring_consume`, and hands it
+ * back with `ring_release`.
+ * 
+ * Each index is only modified by one of the
+ * threads, so no lock is needed, the threads
+ * only wait for each other when the ring is
+ * full or empty.
+ * 
+ * The numbers of empty and filled slots are
+ * semaphores rather than atomic indices. They
+ * are atomic counters that only enter the kernel
+ * when a thread must sleep, or wake the other,
+ * and the threads do sleep, for as long as the
+ * interval between screenshots, which atomic
+ * indices would need the same wake-ups for,
+ * or would have to spin through.
+ */
+struct ring
+{
+  /**
+   * The number of slots.
+   */
+  size_t size;
+  
+  /**
+   * The index of the next slot the producer
+   * will fill, only used by the producer.
+   */
+  size_t head;
+  
+  /**
+   * The index of the next slot the consumer
+   * will read, only used by the consumer.
+   */
+  size_t tail;
+  
+  /**
+   * The number of empty slots.
+   */
+  sem_t empty;
+  
+  /**
+   * The number of filled slots.
+   */
+  sem_t filled;
+};
+
+
+
+/**
+ * Create a ring.
+ * 
+ * @param   ring  The ring.
+ * @param   size  The number of slots.
+ * @return        Zero on success, -1 on error.
+ */
+int init_ring (struct ring *restrict ring, size_t size);
+
+/**
+ * Destroy a ring, created with `init_ring`.
+ * 
+ * @param  ring  The ring.
+ */
+void destroy_ring (struct ring *restrict ring);
+
+/**
+ * Wait for an empty slot. Only the producer may call this.
+ * 
+ * @param   ring  The ring.
+ * @return        The index of the slot.
+ */
+size_t ring_acquire (struct ring *restrict ring);
+
+/**
+ * Hand over the slot returned by `ring_acquire`
+ * to the consumer. Only the producer may call this.
+ * 
+ * @param  ring  The ring.
+ */
+void ring_publish (struct ring *restrict ring);
+
+/**
+ * Wait for a filled slot. Only the consumer may call this.
+ * 
+ * @param   ring  The ring.
+ * @return        The index of the slot.
+ */
+size_t ring_consume (struct ring *restrict ring);
+
+/**
+ * Hand back the slot returned by `ring_consume`
+ * to the producer. Only the consumer may call this.
+ * 
+ * @param  ring  The ring.
+ */
+void ring_release (struct ring *restrict ring);
+
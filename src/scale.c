@@ -0,0 +1,447 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "scale.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+
+
+/*
+ * Rationale:
+ * 
+ *   Making a smaller copy of a screenshot with an external
+ *   program means decoding the PNG file that was just encoded,
+ *   and encoding it again. The converted image is still in
+ *   memory, so it can be scaled down directly. Each pixel is
+ *   the average of the pixels it covers, which is both the
+ *   best way to shrink text and the cheapest: every pixel
+ *   of the image is only multiplied and added once, which,
+ *   with SSE4.1 or AVX2, is done for many bytes at a time.
+ */
+
+
+
+/**
+ * Select the best implementation of `accumulate_row`
+ * and then add the row with it.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+static void select_accumulate_row (uint32_t *restrict sums, const png_byte *restrict row,
+				   size_t n, uint32_t weight);
+
+
+/**
+ * Add a row of PNG pixel data, multiplied by a weight, to
+ * the sums of the rows that make up one row of a scaled image.
+ * 
+ * This is a pointer to the fastest implementation
+ * supported by the CPU, it is selected on the first call.
+ */
+void (*accumulate_row) (uint32_t *restrict sums, const png_byte *restrict row,
+			size_t n, uint32_t weight) = select_accumulate_row;
+
+
+/**
+ * The pixels, of a row of an image, that a
+ * pixel of a row of a scaled image covers.
+ */
+struct span
+{
+  /**
+   * The index of the first byte of the first pixel.
+   */
+  size_t first;
+  
+  /**
+   * The number of pixels, between the first
+   * and the last pixel, that are covered whole.
+   */
+  size_t middle;
+  
+  /**
+   * How much of the first pixel is covered.
+   */
+  uint32_t first_weight;
+  
+  /**
+   * How much of the last pixel is covered,
+   * zero if the first pixel is the last.
+   */
+  uint32_t last_weight;
+};
+
+
+
+/**
+ * Get the size of an image that is scaled down
+ * to a percentage of its size, but not to nothing.
+ * 
+ * @param  width       The width of the image.
+ * @param  height      The height of the image.
+ * @param  percent     The percentage, 1 to 100.
+ * @param  out_width   Output parameter for the width of the scaled image.
+ * @param  out_height  Output parameter for the height of the scaled image.
+ */
+void
+scale_size (long width, long height, long percent, long *restrict out_width, long *restrict out_height)
+{
+  *out_width = (width * percent + 50) / 100;
+  *out_height = (height * percent + 50) / 100;
+  if (*out_width < 1)
+    *out_width = 1;
+  if (*out_height < 1)
+    *out_height = 1;
+}
+
+
+/**
+ * Get the size of a thumbnail of an image, the image scaled
+ * down, keeping its aspect ratio, to fit in a square. The
+ * image is not scaled up if it already fits.
+ * 
+ * @param  width       The width of the image.
+ * @param  height      The height of the image.
+ * @param  size        The width and height of the square, positive.
+ * @param  out_width   Output parameter for the width of the thumbnail.
+ * @param  out_height  Output parameter for the height of the thumbnail.
+ */
+void
+thumbnail_size (long width, long height, long size, long *restrict out_width, long *restrict out_height)
+{
+  *out_width = width;
+  *out_height = height;
+  if ((width <= size) && (height <= size))
+    return;
+  if (width >= height)
+    {
+      *out_width = size;
+      *out_height = (height * size + width / 2) / width;
+    }
+  else
+    {
+      *out_height = size;
+      *out_width = (width * size + height / 2) / height;
+    }
+  if (*out_width < 1)
+    *out_width = 1;
+  if (*out_height < 1)
+    *out_height = 1;
+}
+
+
+/**
+ * Portable implementation of `accumulate_row`.
+ * 
+ * This is the reference implementation, all
+ * other implementations must output the same data.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+void
+accumulate_row_generic (uint32_t *restrict sums, const png_byte *restrict row, size_t n, uint32_t weight)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    sums[i] += weight * (uint32_t)(row[i]);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * SSE4.1 implementation of `accumulate_row`.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+__attribute__ ((target ("sse4.1")))
+static void
+accumulate_row_sse41 (uint32_t *restrict sums, const png_byte *restrict row, size_t n, uint32_t weight)
+{
+  const __m128i w = _mm_set1_epi32 ((int)weight);
+  __m128i v;
+  size_t i;
+  
+  /* Widen 4 bytes at a time to 32 bits, and multiply them. */
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      v = _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (*(const int32_t *)(row + i)));
+      v = _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)(sums + i)), _mm_mullo_epi32 (v, w));
+      _mm_storeu_si128 ((__m128i *)(sums + i), v);
+    }
+  
+  accumulate_row_generic (sums + i, row + i, n - i, weight);
+}
+
+
+/**
+ * AVX2 implementation of `accumulate_row`.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+__attribute__ ((target ("avx2")))
+static void
+accumulate_row_avx2 (uint32_t *restrict sums, const png_byte *restrict row, size_t n, uint32_t weight)
+{
+  const __m256i w = _mm256_set1_epi32 ((int)weight);
+  __m256i v;
+  size_t i;
+  
+  /* Same as for SSE4.1, but 8 bytes at a time. */
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      v = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(row + i)));
+      v = _mm256_add_epi32 (_mm256_loadu_si256 ((const __m256i *)(sums + i)), _mm256_mullo_epi32 (v, w));
+      _mm256_storeu_si256 ((__m256i *)(sums + i), v);
+    }
+  
+  accumulate_row_sse41 (sums + i, row + i, n - i, weight);
+}
+
+#endif
+
+
+/**
+ * Select the best implementation of `accumulate_row`
+ * and then add the row with it.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+static void
+select_accumulate_row (uint32_t *restrict sums, const png_byte *restrict row, size_t n, uint32_t weight)
+{
+  accumulate_row = accumulate_row_generic;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    accumulate_row = accumulate_row_avx2;
+  else if (__builtin_cpu_supports ("sse4.1"))
+    accumulate_row = accumulate_row_sse41;
+#endif
+  accumulate_row (sums, row, n, weight);
+}
+
+
+/**
+ * Divide the weighted sum of the pixels that a pixel of
+ * a scaled image covers, by the sum of the weights, and
+ * round to nearest. The quotient is estimated by multiplying
+ * with the reciprocal, and then corrected, which is much
+ * faster than dividing.
+ * 
+ * @param   sum      The weighted sum.
+ * @param   total    The sum of the weights.
+ * @param   inverse  `1 / total`.
+ * @return           The average.
+ */
+static png_byte
+average (uint64_t sum, uint64_t total, double inverse)
+{
+  uint64_t q;
+  sum += total / 2;
+  q = (uint64_t)((double)sum * inverse);
+  while (q * total > sum)
+    q--;
+  while ((q + 1) * total <= sum)
+    q++;
+  return (png_byte)q;
+}
+
+
+/**
+ * Find the pixels, of each row of an image, that
+ * each pixel, of each row of a scaled image, covers.
+ * 
+ * @param  spans      Output parameter for the spans, one per pixel of the scaled image.
+ * @param  width      The width of the image.
+ * @param  out_width  The width of the scaled image.
+ */
+static void
+get_spans (struct span *restrict spans, long width, long out_width)
+{
+  unsigned long left, right, first, last;
+  long x;
+  
+  /* As with the rows, each pixel of the image covers `out_width`
+     units, and each pixel of the scaled image covers `width` units. */
+  for (x = 0; x < out_width; x++, spans++)
+    {
+      left = (unsigned long)x * (unsigned long)width;
+      right = left + (unsigned long)width;
+      first = left / (unsigned long)out_width;
+      last = (right - 1) / (unsigned long)out_width;
+      spans->first = (size_t)first * 3;
+      if (first == last)
+	{
+	  spans->middle = 0;
+	  spans->first_weight = (uint32_t)width;
+	  spans->last_weight = 0;
+	}
+      else
+	{
+	  spans->middle = (size_t)(last - first - 1);
+	  spans->first_weight = (uint32_t)((first + 1) * (unsigned long)out_width - left);
+	  spans->last_weight = (uint32_t)(right - last * (unsigned long)out_width);
+	}
+    }
+}
+
+
+/**
+ * Make one row of a scaled image from the sums of
+ * the rows of the image that it covers.
+ * 
+ * @param  out        Output buffer for the row.
+ * @param  sums       The weighted sums of the rows, their
+ *                    weights add up to `height`.
+ * @param  spans      The pixels that each pixel covers, from `get_spans`.
+ * @param  out_width  The width of the scaled image.
+ * @param  total      The sum of the weights of the pixels, that a
+ *                    pixel covers, in both dimensions.
+ */
+static void
+scale_row (png_byte *restrict out, const uint32_t *restrict sums, const struct span *restrict spans,
+	   long out_width, uint64_t total)
+{
+  double inverse = 1.0 / (double)total;
+  uint64_t r, g, b, mr, mg, mb;
+  const uint32_t *restrict p;
+  size_t i;
+  long x;
+  
+  for (x = 0; x < out_width; x++, spans++)
+    {
+      p = sums + spans->first;
+      r = (uint64_t)(spans->first_weight) * p[0];
+      g = (uint64_t)(spans->first_weight) * p[1];
+      b = (uint64_t)(spans->first_weight) * p[2];
+      p += 3;
+      
+      /* The pixels in between are covered whole. */
+      mr = mg = mb = 0;
+      for (i = 0; i < spans->middle; i++, p += 3)
+	{
+	  mr += p[0];
+	  mg += p[1];
+	  mb += p[2];
+	}
+      r += (uint64_t)out_width * mr;
+      g += (uint64_t)out_width * mg;
+      b += (uint64_t)out_width * mb;
+      
+      if (spans->last_weight)
+	{
+	  r += (uint64_t)(spans->last_weight) * p[0];
+	  g += (uint64_t)(spans->last_weight) * p[1];
+	  b += (uint64_t)(spans->last_weight) * p[2];
+	}
+      
+      *out++ = average (r, total, inverse);
+      *out++ = average (g, total, inverse);
+      *out++ = average (b, total, inverse);
+    }
+}
+
+
+/**
+ * Scale down an image, each pixel becomes the average of the
+ * pixels of the image that it covers, weighted by how much
+ * of them it covers.
+ * 
+ * @param   image       PNG pixel data, 3 bytes per pixel.
+ * @param   width       The width of the image.
+ * @param   height      The height of the image.
+ * @param   out         Output buffer for the scaled image, with room
+ *                      for at least `3 * out_width * out_height` bytes.
+ * @param   out_width   The width of the scaled image, 1 to `width`.
+ * @param   out_height  The height of the scaled image, 1 to `height`.
+ * @return              Zero on success, -1 on error.
+ */
+int
+downscale (const png_byte *restrict image, long width, long height,
+	   png_byte *restrict out, long out_width, long out_height)
+{
+  size_t width3 = (size_t)width * 3, out_width3 = (size_t)out_width * 3;
+  unsigned long edge = (unsigned long)height, top, a;
+  uint64_t total = (uint64_t)width * (uint64_t)height;
+  struct span *spans;
+  uint32_t *sums;
+  long y;
+  
+  if ((width == out_width) && (height == out_height))
+    {
+      memcpy (out, image, width3 * (size_t)height);
+      return 0;
+    }
+  
+  sums = calloc (width3, sizeof (*sums));
+  spans = malloc ((size_t)out_width * sizeof (*spans));
+  if ((sums == NULL) || (spans == NULL))
+    {
+      free (sums);
+      free (spans);
+      return -1;
+    }
+  get_spans (spans, width, out_width);
+  
+  /* Each line of the image covers `out_height` units, and each
+     line of the scaled image covers `height` units, so that the
+     weights are whole numbers. Since the image is not scaled up,
+     a line of the image is split between at most two lines. */
+  for (y = 0; y < height; y++, image += width3)
+    {
+      top = (unsigned long)y * (unsigned long)out_height;
+      if (top + (unsigned long)out_height < edge)
+	{
+	  accumulate_row (sums, image, width3, (uint32_t)out_height);
+	  continue;
+	}
+      a = edge - top;
+      accumulate_row (sums, image, width3, (uint32_t)a);
+      scale_row (out, sums, spans, out_width, total);
+      out += out_width3;
+      edge += (unsigned long)height;
+      memset (sums, 0, width3 * sizeof (*sums));
+      if (a < (unsigned long)out_height)
+	accumulate_row (sums, image, width3, (uint32_t)((unsigned long)out_height - a));
+    }
+  
+  free (sums);
+  free (spans);
+  return 0;
+}
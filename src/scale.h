@@ -0,0 +1,94 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pngtypes.h"
+
+
+
+/**
+ * Get the size of an image that is scaled down
+ * to a percentage of its size, but not to nothing.
+ * 
+ * @param  width       The width of the image.
+ * @param  height      The height of the image.
+ * @param  percent     The percentage, 1 to 100.
+ * @param  out_width   Output parameter for the width of the scaled image.
+ * @param  out_height  Output parameter for the height of the scaled image.
+ */
+void scale_size (long width, long height, long percent,
+		 long *restrict out_width, long *restrict out_height);
+
+/**
+ * Get the size of a thumbnail of an image, the image scaled
+ * down, keeping its aspect ratio, to fit in a square. The
+ * image is not scaled up if it already fits.
+ * 
+ * @param  width       The width of the image.
+ * @param  height      The height of the image.
+ * @param  size        The width and height of the square, positive.
+ * @param  out_width   Output parameter for the width of the thumbnail.
+ * @param  out_height  Output parameter for the height of the thumbnail.
+ */
+void thumbnail_size (long width, long height, long size,
+		     long *restrict out_width, long *restrict out_height);
+
+/**
+ * Scale down an image, each pixel becomes the average of the
+ * pixels of the image that it covers, weighted by how much
+ * of them it covers.
+ * 
+ * @param   image       PNG pixel data, 3 bytes per pixel.
+ * @param   width       The width of the image.
+ * @param   height      The height of the image.
+ * @param   out         Output buffer for the scaled image, with room
+ *                      for at least `3 * out_width * out_height` bytes.
+ * @param   out_width   The width of the scaled image, 1 to `width`.
+ * @param   out_height  The height of the scaled image, 1 to `height`.
+ * @return              Zero on success, -1 on error.
+ */
+int downscale (const png_byte *restrict image, long width, long height,
+	       png_byte *restrict out, long out_width, long out_height);
+
+/**
+ * Add a row of PNG pixel data, multiplied by a weight, to
+ * the sums of the rows that make up one row of a scaled image.
+ * 
+ * This is a pointer to the fastest implementation
+ * supported by the CPU, it is selected on the first call.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+extern void (*accumulate_row) (uint32_t *restrict sums, const png_byte *restrict row,
+			       size_t n, uint32_t weight);
+
+/**
+ * Portable implementation of `accumulate_row`.
+ * 
+ * This is the reference implementation, all
+ * other implementations must output the same data.
+ * 
+ * @param  sums    The sums for each byte in the row.
+ * @param  row     The row.
+ * @param  n       The number of bytes in the row.
+ * @param  weight  The weight of the row.
+ */
+void accumulate_row_generic (uint32_t *restrict sums, const png_byte *restrict row,
+			     size_t n, uint32_t weight);
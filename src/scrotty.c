@@ -21,19 +21,48 @@
 #include "kern.h"
 #include "info.h"
 #include "png.h"
+#include "strips.h"
+#include "delta.h"
+#include "apng.h"
 #include "pattern.h"
+#include "ring.h"
+#include "stats.h"
+#include "jobs.h"
+#include "consumer.h"
+#include "scale.h"
+#include "sink.h"
+#include "qoi.h"
 
 #include <ctype.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <stdarg.h>
 #ifdef USE_GETTEXT
 # include <locale.h>
 #endif
 
 
 
+/**
+ * The number of screenshots of each framebuffer
+ * that can be waiting to be encoded, when recording.
+ */
+#define PIPELINE_DEPTH  4
+
+/**
+ * Appended to the pathname of a dump without
+ * a header, to get the sidecar that describes it.
+ */
+#define SIDECAR_SUFFIX  ".geometry"
+
 /**
  * X-macro that lists all environment variables
  * that indicate that the program is running
@@ -56,240 +85,2379 @@ const char *execname;
 const char *failure_file = NULL;
 
 /**
- * The index of the alternative path-pattern,
- * for the framebuffers, to try.
+ * If a function fails for a reason that
+ * `errno` cannot describe, it will set this
+ * variable to a description of the reason.
+ */
+const char *failure_reason = NULL;
+
+/**
+ * The index of the alternative path-pattern,
+ * for the framebuffers, to try.
+ */
+static int try_alt_fbpath = 0;
+
+/**
+ * The number of threads to compress each image with.
+ */
+static long threads = 1;
+
+/**
+ * The number of screenshots to take of each
+ * framebuffer, zero for no limit.
+ */
+static long frames = 1;
+
+/**
+ * The number of milliseconds between each
+ * screenshot of the same framebuffer.
+ */
+static long interval = 0;
+
+/**
+ * Only store what has changed since the
+ * previous screenshot of the framebuffer?
+ */
+static int use_delta = 0;
+
+/**
+ * Store all screenshots of each framebuffer
+ * in one animated PNG file?
+ */
+static int use_apng = 0;
+
+/**
+ * Dump the framebuffers without converting them?
+ */
+static int use_raw = 0;
+
+/**
+ * Compress the images with the built-in
+ * encoder, rather than with zlib?
+ */
+static int use_fast = 0;
+
+/**
+ * Save the images in the QOI format,
+ * rather than in the PNG format?
+ */
+static int use_qoi = 0;
+
+/**
+ * The extension of the images' pathnames,
+ * for the selected format.
+ */
+#define IMAGE_EXTENSION  (use_qoi ? ".qoi" : ".png")
+
+/**
+ * A dump, made with --raw, to convert
+ * instead of a framebuffer, `NULL` if none.
+ */
+static const char *dumppath = NULL;
+
+/**
+ * Report how long it took to read and
+ * to encode each screenshot?
+ */
+static int use_timing = 0;
+
+/**
+ * Copy each framebuffer into memory before
+ * converting it, rather than converting it
+ * directly from the mapped framebuffer?
+ */
+static int use_snapshot = 0;
+
+/**
+ * Where to print statistics for each
+ * framebuffer, `NULL` if not at all.
+ */
+static FILE *stats_file = NULL;
+
+/**
+ * The number of commands, for the images,
+ * that may run at the same time.
+ */
+static long max_jobs = 0;
+
+/**
+ * Send the images to the program started
+ * with --pipe-to, rather than to stdout,
+ * when no filename pattern is used?
+ */
+static int use_consumer = 0;
+
+/**
+ * The socket to serve screenshots over, as
+ * a daemon, `NULL` if not a daemon.
+ */
+static const char *socketpath = NULL;
+
+/**
+ * The size of the saved images, in percent
+ * of the size of the framebuffers.
+ */
+static long scale = 100;
+
+/**
+ * The sizes of the thumbnails to save
+ * beside each image, `NULL` if none.
+ */
+static long *thumbnails = NULL;
+
+/**
+ * The number of elements in `thumbnails`.
+ */
+static size_t nthumbnails = 0;
+
+
+
+/**
+ * A screenshot that has been read, and is waiting to
+ * be converted and encoded, when recording. While a
+ * screenshot is being converted and encoded, the
+ * next ones are read.
+ */
+struct frame
+{
+  /**
+   * The copy of the framebuffer, from `detach_copy`,
+   * kept for the slot's next screenshot once used.
+   */
+  void *data;
+  
+  /**
+   * The image, with room for one more row.
+   */
+  struct buffer buffer;
+  
+  /**
+   * The width of the image.
+   */
+  long width;
+  
+  /**
+   * The height of the image.
+   */
+  long height;
+  
+  /**
+   * The index of the screenshot.
+   */
+  long frame;
+  
+  /**
+   * The pathname of the output image, `NULL` for piping.
+   */
+  char *imgpath;
+  
+  /**
+   * When the framebuffer was read.
+   */
+  struct timespec taken;
+  
+  /**
+   * The number of milliseconds it took
+   * to read the framebuffer.
+   */
+  double read_time;
+  
+  /**
+   * Set instead of an image when no more
+   * screenshots will be taken.
+   */
+  int last;
+  
+  /**
+   * Set, by the encoding thread, to -1 when the
+   * slot is handed back, if encoding has failed.
+   */
+  int rc;
+  
+  /**
+   * The value of `errno` when encoding failed.
+   */
+  int saved_errno;
+};
+
+/**
+ * A framebuffer that is being screenshot.
+ */
+struct capture
+{
+  /**
+   * The number of the framebuffer.
+   */
+  int fbno;
+  
+  /**
+   * File descriptor for framebuffer device.
+   */
+  int fbfd;
+  
+  /**
+   * The width of the image.
+   */
+  long width;
+  
+  /**
+   * The height of the image.
+   */
+  long height;
+  
+  /**
+   * Additional data for `convert_fb_to_png`.
+   */
+  void *data;
+  
+  /**
+   * The pathname of the output image, `NULL` for piping.
+   */
+  char *imgpath;
+  
+  /**
+   * The file descriptor to write the image to,
+   * rather than to `imgpath`, -1 if none.
+   */
+  int outfd;
+  
+  /**
+   * The pathname of the sidecar for a dump, `NULL` if
+   * a framebuffer, rather than a dump, is screenshot.
+   */
+  char *geompath;
+  
+  /**
+   * The index of the current screenshot of the framebuffer.
+   */
+  long frame;
+  
+  /**
+   * Buffer that is reused between screenshots.
+   */
+  struct buffer buffer;
+  
+  /**
+   * Buffer for the scaled down images,
+   * that is reused between screenshots.
+   */
+  struct buffer reduced;
+  
+  /**
+   * The number of bytes to reserve for the next
+   * image, based on the size of the previous.
+   */
+  size_t estimate;
+  
+  /**
+   * The previous screenshot, and what has changed,
+   * when only changes are stored.
+   */
+  struct delta delta;
+  
+  /**
+   * The animated PNG file, when all screenshots
+   * are stored in one animated PNG file.
+   */
+  struct apng apng;
+  
+  /**
+   * The return value of `save`, when
+   * the screenshot is taken in a thread.
+   */
+  int rc;
+  
+  /**
+   * The value of `errno` when `save` failed,
+   * when the screenshot is taken in a thread.
+   */
+  int saved_errno;
+  
+  /**
+   * The thread that takes the screenshot,
+   * when the screenshot is taken in a thread.
+   */
+  pthread_t thread;
+  
+  /**
+   * Make all threads start reading their
+   * framebuffers at the same time.
+   */
+  struct start_signal *start;
+  
+  /**
+   * Screenshots waiting to be encoded, `NULL`
+   * unless screenshots are encoded in a thread
+   * while the next screenshots are taken.
+   */
+  struct frame *pipeline;
+  
+  /**
+   * Keeps track of the slots in `pipeline`.
+   */
+  struct ring ring;
+  
+  /**
+   * The pattern for the command to run to process
+   * the images, `NULL` for none, when `pipeline` is used.
+   */
+  const struct pattern *execpattern;
+  
+  /**
+   * Statistics for the screenshots, when collected.
+   */
+  struct stats stats;
+  
+  /**
+   * Statistics collected by the thread that encodes the
+   * screenshots, they are added to `stats` when it stops.
+   */
+  struct stats pipeline_stats;
+};
+
+/**
+ * Used to make all threads start reading
+ * their framebuffers at the same time.
+ */
+struct start_signal
+{
+  /**
+   * Mutex for `go`.
+   */
+  pthread_mutex_t mutex;
+  
+  /**
+   * Signalled when `go` is set.
+   */
+  pthread_cond_t cond;
+  
+  /**
+   * Set when all threads have been started.
+   */
+  int go;
+};
+
+
+
+/**
+ * Get the number of milliseconds between two points in time.
+ * 
+ * @param   from  The earlier point in time.
+ * @param   to    The later point in time.
+ * @return        The number of milliseconds from `from` to `to`.
+ */
+static double
+elapsed (const struct timespec *restrict from, const struct timespec *restrict to)
+{
+  return (double)(to->tv_sec - from->tv_sec) * 1000.0 + (double)(to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+
+/**
+ * Add a screenshot of a framebuffer to its animated PNG
+ * file, and finish the file if it is the last frame.
+ * 
+ * @param   cap  The framebuffer.
+ * @return       Zero on success, -1 on error.
+ */
+static int
+save_frame (struct capture *restrict cap)
+{
+  if (save_apng_frame (&(cap->apng), cap->fbfd, cap->width, cap->height,
+		       cap->data, interval, threads) < 0)
+    return -1;
+  return (cap->frame + 1 == frames) ? end_apng (&(cap->apng)) : 0;
+}
+
+
+/**
+ * Open the output file for an image.
+ * 
+ * @param   imgpath   The pathname of the image, `NULL` for piping.
+ * @param   estimate  The number of bytes to reserve for the image, zero for none.
+ * @return            The file descriptor of the output, -1 on error.
+ */
+static int
+open_image (const char *imgpath, size_t estimate)
+{
+  int imgfd = STDOUT_FILENO;
+  if ((imgpath == NULL) && use_consumer)
+    imgfd = open_consumer_image ();
+  else if (imgpath != NULL)
+    {
+      imgfd = open (imgpath, O_WRONLY | O_CREAT | O_TRUNC,
+		    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      if (imgfd == -1)
+	FILE_FAILURE (imgpath);
+      reserve_space (imgfd, estimate);
+    }
+  return imgfd;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Close the output file for an image, opened with `open_image`,
+ * and send the image to the program started with --pipe-to,
+ * if the image is piped to it.
+ * 
+ * @param   imgfd    The file descriptor of the output.
+ * @param   imgpath  The pathname of the image, `NULL` for piping.
+ * @param   fbno     The number of the framebuffer.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   taken     When the framebuffer was read.
+ * @param   estimate  The number of bytes reserved for the image, zero if none.
+ *                    Set to the number of bytes to reserve for the next image.
+ * @return            Zero on success, -1 on error.
+ */
+static int
+close_image (int imgfd, const char *imgpath, int fbno, long width, long height,
+	     const struct timespec *restrict taken, size_t *restrict estimate)
+{
+  int r = 0, saved_errno;
+  if ((imgpath == NULL) && !use_consumer)
+    return 0;
+  if (imgpath == NULL)
+    r = send_image (imgfd, fbno, width, height, taken, use_raw ? "raw " : use_qoi ? "qoi " : "png ");
+  else
+    r = release_space (imgfd, estimate);
+  saved_errno = errno;
+  close (imgfd);
+  errno = saved_errno;
+  return r;
+}
+
+
+/**
+ * Print how long it took to read and encode an image.
+ * 
+ * @param  fbno         The number of the framebuffer.
+ * @param  read_time    The number of milliseconds it took to read the framebuffer.
+ * @param  encode_time  The number of milliseconds it took to encode the image.
+ */
+static void
+print_timing (int fbno, double read_time, double encode_time)
+{
+  fprintf (stderr, _("Read framebuffer %i in %.3f ms, and encoded it in %.3f ms.\n"),
+	   fbno, read_time, encode_time);
+}
+
+
+/**
+ * Get the pathname of a thumbnail of an image: the
+ * image's pathname with the size of the thumbnail
+ * inserted before its ".png" or ".qoi" extension.
+ * 
+ * @param   imgpath  The pathname of the image.
+ * @param   size     The size of the thumbnail.
+ * @return           The pathname of the thumbnail, `NULL` on error.
+ */
+static char *
+thumbnail_path (const char *imgpath, long size)
+{
+  size_t n = strlen (imgpath);
+  char *path;
+  if ((n >= 4) && !strcmp (imgpath + n - 4, IMAGE_EXTENSION))
+    n -= 4;
+  path = malloc (n + 3 * sizeof (long) + sizeof ("..png"));
+  if (path != NULL)
+    sprintf (path, "%.*s.%li%s", (int)n, imgpath, size, IMAGE_EXTENSION);
+  return path;
+}
+
+
+/**
+ * Scale down a converted screenshot, into the buffer
+ * for scaled down images of its framebuffer.
+ * 
+ * @param   cap         The framebuffer.
+ * @param   image       The screenshot.
+ * @param   width       The width of the screenshot.
+ * @param   height      The height of the screenshot.
+ * @param   out_width   The width of the scaled image.
+ * @param   out_height  The height of the scaled image.
+ * @return              The scaled image, with room for
+ *                      one more row, `NULL` on error.
+ */
+static png_byte *
+scale_image (struct capture *restrict cap, const png_byte *restrict image,
+	     long width, long height, long out_width, long out_height)
+{
+  png_byte *out;
+  enum stage stage;
+  int r;
+  
+  out = reserve_buffer (&(cap->reduced), (size_t)out_width * 3 * (size_t)(out_height + 1));
+  if (out == NULL)
+    return NULL;
+  stage = enter_stage (STAGE_CONVERT);
+  r = downscale (image, width, height, out, out_width, out_height);
+  enter_stage (stage);
+  return r < 0 ? NULL : out;
+}
+
+
+/**
+ * Encode a converted screenshot, scaled down if --scale
+ * is used, and save its thumbnails if --thumbnail is used.
+ * 
+ * @param   cap      The framebuffer.
+ * @param   image    The screenshot, with room for one more row.
+ * @param   width    The width of the screenshot.
+ * @param   height   The height of the screenshot.
+ * @param   imgfd    The file descriptor of the output.
+ * @param   imgpath  The pathname of the image, the thumbnails are
+ *                   named after it. `NULL` for piping, in which
+ *                   case there are no thumbnails.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+encode_image (struct capture *restrict cap, png_byte *restrict image, long width, long height,
+	      int imgfd, const char *imgpath)
+{
+  png_byte *out;
+  char *path = NULL;
+  long w, h;
+  size_t i;
+  int fd = -1, r, saved_errno;
+  
+  for (i = 0; i <= nthumbnails; i++)
+    {
+      /* The thumbnails are made from the full image,
+         not from each other, so that they stay sharp. */
+      if (i == 0)
+	scale_size (width, height, scale, &w, &h);
+      else
+	thumbnail_size (width, height, thumbnails[i - 1], &w, &h);
+      out = image;
+      if ((w != width) || (h != height))
+	if ((out = scale_image (cap, image, width, height, w, h)) == NULL)
+	  goto fail;
+      
+      if (i > 0)
+	{
+	  path = thumbnail_path (imgpath, thumbnails[i - 1]);
+	  if (path == NULL)
+	    goto fail;
+	  fd = open_image (path, 0);
+	  if (fd < 0)
+	    {
+	      path = NULL; /* Reported in `main`. */
+	      goto fail;
+	    }
+	}
+      
+      if (use_qoi)
+	r = encode_qoi (out, w, h, i ? fd : imgfd);
+      else if ((threads > 1) || use_fast)
+	r = encode_png_strips (out, w, h, i ? fd : imgfd, threads, NULL, 0);
+      else
+	r = encode_png (out, w, h, i ? fd : imgfd);
+      if (r < 0)
+	goto fail;
+      
+      if (i > 0)
+	{
+	  close (fd);
+	  fd = -1;
+	  fprintf (stderr, _("Saved framebuffer %i to %s.\n"), cap->fbno, path);
+	  free (path);
+	  path = NULL;
+	}
+    }
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close (fd);
+  free (path);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Create an image of a framebuffer.
+ * 
+ * @param   cap  The framebuffer.
+ * @return       Zero on success, -1 on error.
+ */
+static int
+save (struct capture *restrict cap)
+{
+  int imgfd = -1, piping = (cap->imgpath == NULL) && !use_consumer;
+  int r, saved_errno;
+  struct timespec begin, copied, end, taken;
+  png_byte *image;
+  long width, height;
+  size_t n;
+  
+  /* With --snapshot, copy the framebuffer before anything else,
+     so that it changes as little as possible while it is being
+     read. The image is then converted and compressed from the copy.
+     Otherwise it is converted directly from the mapped framebuffer.
+     A dump is not converted, so it is written from the framebuffer. */
+  use_stats (&(cap->stats));
+  enter_stage (use_raw ? STAGE_WRITE : STAGE_READ);
+  if (use_timing && clock_gettime (CLOCK_MONOTONIC, &begin))
+    goto fail;
+  if (use_consumer && clock_gettime (CLOCK_REALTIME, &taken))
+    goto fail;
+  if (!use_raw && use_snapshot && (copy_fb (cap->fbfd, &n, cap->data) == NULL))
+    goto fail;
+  if (use_timing && clock_gettime (CLOCK_MONOTONIC, &copied))
+    goto fail;
+  cap->stats.images++;
+  cap->stats.pixels += (uint64_t)(cap->width) * (uint64_t)(cap->height);
+  
+  /* All frames of an animation are written to the file opened for the first frame. */
+  if (use_apng && (cap->frame > 0))
+    {
+      if (save_frame (cap) < 0)
+	goto fail;
+      goto done;
+    }
+  
+  /* Open output file. */
+  imgfd = (cap->outfd >= 0) ? cap->outfd : open_image (cap->imgpath, cap->estimate);
+  if (imgfd < 0)
+    goto fail;
+  
+  /* Save image. */
+  if (use_raw)
+    {
+      if (save_raw (cap->fbno, cap->fbfd, imgfd, cap->data) < 0)
+	goto fail;
+    }
+  else if (use_apng)
+    {
+      if (begin_apng (&(cap->apng), imgfd, cap->width, cap->height, frames) < 0)
+	goto fail;
+      if (save_frame (cap) < 0)
+	goto fail;
+    }
+  else if (use_delta)
+    {
+      if (save_png_delta (cap->fbfd, cap->width, cap->height, imgfd, cap->data,
+			  cap->frame, threads, &(cap->delta)) < 0)
+	goto fail;
+    }
+  else if ((scale < 100) || nthumbnails)
+    {
+      /* The whole image is converted, so that it can be scaled down. */
+      image = reserve_buffer (&(cap->buffer), (size_t)(cap->width) * 3 * (size_t)(cap->height + 1));
+      if (image == NULL)
+	goto fail;
+      if (snapshot_fb (cap->fbfd, image, cap->width, cap->data) < 0)
+	goto fail;
+      if (encode_image (cap, image, cap->width, cap->height, imgfd, cap->imgpath) < 0)
+	goto fail;
+    }
+  else if (use_qoi)
+    {
+      if (save_qoi (cap->fbfd, cap->width, cap->height, imgfd, cap->data, &(cap->buffer)) < 0)
+	goto fail;
+    }
+  else if ((threads > 1) || use_fast)
+    {
+      if (save_png_strips (cap->fbfd, cap->width, cap->height, imgfd,
+			   cap->data, threads, &(cap->buffer)) < 0)
+	goto fail;
+    }
+  else if (save_png (cap->fbfd, cap->width, cap->height, imgfd, cap->data, &(cap->buffer)) < 0)
+    goto fail;
+  
+  scale_size (cap->width, cap->height, scale, &width, &height);
+  r = close_image (imgfd, cap->imgpath, cap->fbno, width, height, &taken, &(cap->estimate));
+  imgfd = -1;
+  if (r < 0)
+    goto fail;
+  
+ done:
+  use_stats (NULL);
+  if (use_timing)
+    {
+      if (clock_gettime (CLOCK_MONOTONIC, &end))
+	return -1;
+      if (use_raw)
+	fprintf (stderr, _("Dumped framebuffer %i in %.3f ms.\n"),
+		 cap->fbno, elapsed (&begin, &end));
+      else
+	print_timing (cap->fbno, elapsed (&begin, &copied), elapsed (&copied, &end));
+    }
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  use_stats (NULL);
+  if ((imgfd >= 0) && !piping)
+    close (imgfd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Split a command, evaluated from an --exec pattern, into its arguments.
+ * 
+ * @param   flatten_args  The arguments, 255 delimits the arguments, this
+ *                        string is modified and used in the returned array.
+ * @return                The arguments, `NULL`-terminated, `NULL` on error.
+ */
+static char **
+split_args (char *flatten_args)
+{
+  char **args;
+  char *arg;
+  size_t i, arg_count = 1;
+  
+  /* Count arguments. */
+  for (i = 0; flatten_args[i]; i++)
+    if ((unsigned char)(flatten_args[i]) == 255)
+      arg_count++;
+  
+  /* Allocate argument array. */
+  args = malloc ((arg_count + 1) * sizeof (char*));
+  if (args == NULL)
+    return NULL;
+  
+  /* Unflatten argument array. */
+  for (arg = flatten_args, i = 0;;)
+    {
+      args[i++] = arg;
+      arg = strchr (arg, 255);
+      if (arg == NULL)
+	break;
+      *arg++ = '\0';
+    }
+  args[i] = NULL;
+  return args;
+}
+
+
+/**
+ * Start a command for an image, the command is not
+ * waited for, so the next screenshot can be taken
+ * while it runs.
+ * 
+ * @param   flatten_args  The arguments to run, 255 delimits the arguments
+ * @return                Zero on success -1 on error
+ */
+static int
+exec_image (char *flatten_args)
+{
+  char **args;
+  int r, saved_errno;
+  
+  args = split_args (flatten_args);
+  if (args == NULL)
+    return -1;
+  
+  /* Start the command, its CPU time is counted when it exits. */
+  r = start_job (args, current_stats ());
+  saved_errno = errno;
+  free (args);
+  errno = saved_errno;
+  return r;
+}
+
+
+/**
+ * Open and measure a framebuffer.
+ * 
+ * @param   cap   Output parameter for the framebuffer.
+ * @param   fbno  The number of the framebuffer.
+ * @param   dump  A dump to open instead of the framebuffer, `NULL` if none.
+ * @return        Zero on success, -1 on error, 1 if the framebuffer does not exist.
+ */
+static int
+open_fb (struct capture *restrict cap, int fbno, const char *dump)
+{
+  char *fbpath; /* Statically allocate string is returned. */
+  int geomfd = -1, r, saved_errno;
+  
+  memset (cap, 0, sizeof (*cap));
+  cap->fbno = fbno;
+  cap->fbfd = -1;
+  cap->outfd = -1;
+  cap->frame = -1;
+  cap->delta.keyframe = -1;
+  use_stats (&(cap->stats));
+  enter_stage (STAGE_MEASURE);
+  
+  /* Get pathname for framebuffer, and stop if we have read all existing ones. */
+  if (dump != NULL)
+    fbpath = (char *)dump;
+  else
+    {
+      fbpath = get_fbpath (try_alt_fbpath, fbno);
+      if (access (fbpath, F_OK))
+	return use_stats (NULL), 1;
+    }
+  
+  /* Open the framebuffer device for reading. */
+  cap->fbfd = open (fbpath, O_RDONLY);
+  if (cap->fbfd == -1)
+    FILE_FAILURE (fbpath);
+  
+  /* A dump without a header is described by a sidecar. */
+  if (dump != NULL)
+    {
+      cap->geompath = malloc (strlen (dump) + sizeof (SIDECAR_SUFFIX));
+      if (cap->geompath == NULL)
+	goto fail;
+      stpcpy (stpcpy (cap->geompath, dump), SIDECAR_SUFFIX);
+      geomfd = open (cap->geompath, O_RDONLY);
+      if ((geomfd == -1) && (errno != ENOENT))
+	FILE_FAILURE (cap->geompath);
+    }
+  
+  /* Get the size of the framebuffer. */
+  if (geomfd >= 0)
+    {
+      r = measure_file (fbno, cap->fbfd, geomfd, &(cap->width), &(cap->height), &(cap->data));
+      saved_errno = errno;
+      close (geomfd);
+      errno = saved_errno;
+    }
+  else
+    r = measure (fbno, cap->fbfd, &(cap->width), &(cap->height), &(cap->data));
+  if (r < 0)
+    {
+      if ((dump != NULL) || (failure_reason != NULL))
+	FILE_FAILURE (fbpath);
+      goto fail;
+    }
+  
+  use_stats (NULL);
+  return 0;
+ fail:
+  use_stats (NULL);
+  return -1;
+}
+
+
+/**
+ * Prepare a framebuffer, opened with `open_fb`,
+ * for its next screenshot, and get the pathname
+ * for the image.
+ * 
+ * @param   cap          The framebuffer.
+ * @param   filepattern  The pattern for the filename, `NULL` for piping.
+ * @return               Zero on success, -1 on error.
+ */
+static int
+prepare_fb (struct capture *restrict cap, const struct pattern *filepattern)
+{
+  long width, height;
+  int r;
+  
+  /* The framebuffer was measured when it was opened, but if we have
+     already taken a screenshot, its configurations may have changed. */
+  if (cap->frame++ >= 0)
+    {
+      use_stats (&(cap->stats));
+      enter_stage (STAGE_MEASURE);
+      /* If it could not be measured again last time, try again. */
+      r = cap->data ? rewind_fb (cap->fbfd, cap->data) : 1;
+      if (r > 0)
+	{
+	  release_fb (cap->data);
+	  cap->data = NULL;
+	  r = measure (cap->fbno, cap->fbfd, &(cap->width), &(cap->height), &(cap->data));
+	}
+      use_stats (NULL);
+      if (r < 0)
+	return -1;
+    }
+  
+  /* Get output pathname, an animation is named after its first frame. */
+  if (use_apng && (cap->frame > 0))
+    return 0;
+  free (cap->imgpath);
+  cap->imgpath = NULL;
+  if (filepattern != NULL)
+    {
+      scale_size (cap->width, cap->height, scale, &width, &height);
+      cap->imgpath = evaluate (filepattern, cap->fbno, cap->frame, width, height, NULL);
+      if (cap->imgpath == NULL)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Close a framebuffer opened with `open_fb`.
+ * 
+ * @param  cap  The framebuffer.
+ */
+static void
+close_fb (struct capture *restrict cap)
+{
+  int saved_errno = errno;
+  /* The commands' CPU time is counted when they have exited. */
+  wait_jobs (&(cap->stats));
+  if ((stats_file != NULL) && (cap->fbfd >= 0))
+    print_stats (stats_file, cap->fbno, cap->width, cap->height, &(cap->stats));
+  if (cap->fbfd >= 0)
+    close (cap->fbfd);
+  release_fb (cap->data);
+  if (cap->imgpath != failure_file) /* Reported in `main`. */
+    free (cap->imgpath);
+  if (cap->geompath != failure_file)
+    free (cap->geompath);
+  free (cap->buffer.buf);
+  free (cap->reduced.buf);
+  destroy_delta (&(cap->delta));
+  destroy_apng (&(cap->apng));
+  errno = saved_errno;
+}
+
+
+/**
+ * Report that an image has been saved, and
+ * run the command for the image, if any.
+ * 
+ * @param   fbno         The number of the framebuffer.
+ * @param   frame        The index of the screenshot.
+ * @param   width        The width of the image.
+ * @param   height       The height of the image.
+ * @param   imgpath      The pathname of the image, `NULL` if it was piped.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the image, `NULL` for none.
+ * @return               Zero on success, -1 on error.
+ */
+static int
+saved_image (int fbno, long frame, long width, long height, const char *imgpath,
+	     const struct pattern *execpattern)
+{
+  char *execargs = NULL;
+  enum stage stage;
+  int r, saved_errno;
+  
+  if (imgpath)
+    fprintf (stderr, _("Saved framebuffer %i to %s.\n"), fbno, imgpath);
+  
+  /* Should we run a command over the image? */
+  if (execpattern == NULL)
+    return 0;
+  
+  /* Get execute arguments. */
+  execargs = evaluate (execpattern, fbno, frame, width, height, imgpath);
+  if (execargs == NULL)
+    goto fail;
+  
+  /* Run command over image. */
+  stage = enter_stage (STAGE_EXEC);
+  r = exec_image (execargs);
+  enter_stage (stage);
+  if (r < 0)
+    goto fail;
+  
+  free (execargs);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free (execargs);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Report that a screenshot has been saved, and
+ * run the command for the image, if any.
+ * 
+ * @param   cap          The framebuffer.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the image, `NULL` for none.
+ * @return               Zero on success, -1 on error.
+ */
+static int
+saved_fb (struct capture *restrict cap, const struct pattern *execpattern)
+{
+  long width, height;
+  int r;
+  
+  /* An animation is not saved until its last frame. */
+  if (use_apng && (cap->frame + 1 < frames))
+    return 0;
+  
+  scale_size (cap->width, cap->height, scale, &width, &height);
+  use_stats (&(cap->stats));
+  r = saved_image (cap->fbno, cap->frame, width, height, cap->imgpath, execpattern);
+  use_stats (NULL);
+  return r;
+}
+
+
+/**
+ * Take a screenshot of a framebuffer.
+ * 
+ * @param   fbno         The number of the framebuffer.
+ * @param   filepattern  The pattern for the filename, `NULL` for piping.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the image, `NULL` for none.
+ * @return               Zero on success, -1 on error, 1 if the framebuffer does not exist.
+ */
+static int
+save_fb (int fbno, const struct pattern *filepattern, const struct pattern *execpattern)
+{
+  struct capture cap;
+  int rc;
+  
+  rc = open_fb (&cap, fbno, dumppath);
+  if (rc)
+    goto done;
+  
+  /* Take a screenshot of the current framebuffer. */
+  rc = prepare_fb (&cap, filepattern);
+  if (rc == 0)
+    rc = save (&cap);
+  if (rc == 0)
+    rc = saved_fb (&cap, execpattern);
+  
+ done:
+  close_fb (&cap);
+  return rc;
+}
+
+
+/**
+ * Take a screenshot of a framebuffer, opened with
+ * `open_fb`, in a thread of its own.
+ * 
+ * @param   cap_  The framebuffer, `struct capture *`.
+ * @return        `NULL`, the result is stored in `cap_`.
+ */
+static void *
+save_fb_thread (void *cap_)
+{
+  struct capture *cap = cap_;
+  
+  /* Wait for the other framebuffers, so
+     that they are read at the same time. */
+  pthread_mutex_lock (&(cap->start->mutex));
+  while (!cap->start->go)
+    pthread_cond_wait (&(cap->start->cond), &(cap->start->mutex));
+  pthread_mutex_unlock (&(cap->start->mutex));
+  
+  cap->rc = save (cap);
+  cap->saved_errno = errno;
+  return NULL;
+}
+
+
+/**
+ * Take a screenshot of multiple framebuffers, opened
+ * with `open_fb` and prepared with `prepare_fb`,
+ * at the same time.
+ * 
+ * @param   caps         The framebuffers.
+ * @param   n            The number of framebuffers.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process thes image, `NULL` for none.
+ * @return               Zero on success, -1 on error.
+ */
+static int
+save_fbs_simultaneously (struct capture *restrict caps, size_t n, const struct pattern *execpattern)
+{
+  struct start_signal start = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+  size_t i, started;
+  int rc = 0, saved_errno = 0;
+  
+  /* Start a thread for each framebuffer. */
+  for (started = 0; started < n; started++)
+    {
+      caps[started].start = &start;
+      if (pthread_create (&(caps[started].thread), NULL, save_fb_thread, caps + started))
+	break;
+    }
+  
+  /* Let all threads start at the same time. */
+  pthread_mutex_lock (&(start.mutex));
+  start.go = 1;
+  pthread_cond_broadcast (&(start.cond));
+  pthread_mutex_unlock (&(start.mutex));
+  
+  /* If we could not start all threads, take the
+     remaining screenshots in this thread. */
+  for (i = started; i < n; i++)
+    {
+      caps[i].rc = save (caps + i);
+      caps[i].saved_errno = errno;
+    }
+  
+  /* Wait for all threads, and report the screenshots in order. */
+  for (i = 0; i < n; i++)
+    {
+      if (i < started)
+	pthread_join (caps[i].thread, NULL);
+      if (rc < 0)
+	continue;
+      if (caps[i].rc < 0)
+	rc = -1, saved_errno = caps[i].saved_errno;
+      else if (saved_fb (caps + i, execpattern) < 0)
+	rc = -1, saved_errno = errno;
+    }
+  
+  pthread_cond_destroy (&(start.cond));
+  pthread_mutex_destroy (&(start.mutex));
+  return errno = saved_errno, rc;
+}
+
+
+/**
+ * Convert and encode a screenshot that was read by `queue_frame`.
+ * 
+ * @param   cap  The framebuffer.
+ * @param   f    The screenshot.
+ * @return       Zero on success, -1 on error.
+ */
+static int
+encode_frame (struct capture *restrict cap, struct frame *restrict f)
+{
+  struct timespec begin, end;
+  int imgfd = -1, r, saved_errno;
+  long width, height;
+  
+  if (use_timing && clock_gettime (CLOCK_MONOTONIC, &begin))
+    return -1;
+  
+  /* The copy is converted here, rather than when it is read,
+     so that the next screenshot can be read meanwhile. */
+  if (reserve_buffer (&(f->buffer), (size_t)(f->width) * 3 * (size_t)(f->height + 1)) == NULL)
+    goto fail;
+  if (snapshot_fb (-1, f->buffer.buf, f->width, f->data) < 0)
+    goto fail;
+  imgfd = open_image (f->imgpath, cap->estimate);
+  if (imgfd < 0)
+    goto fail;
+  if (encode_image (cap, f->buffer.buf, f->width, f->height, imgfd, f->imgpath) < 0)
+    goto fail;
+  scale_size (f->width, f->height, scale, &width, &height);
+  r = close_image (imgfd, f->imgpath, cap->fbno, width, height, &(f->taken), &(cap->estimate));
+  imgfd = -1;
+  if (r < 0)
+    goto fail;
+  
+  if (use_timing)
+    {
+      if (clock_gettime (CLOCK_MONOTONIC, &end))
+	return -1;
+      print_timing (cap->fbno, f->read_time, elapsed (&begin, &end));
+    }
+  return saved_image (cap->fbno, f->frame, width, height, f->imgpath, cap->execpattern);
+  
+ fail:
+  saved_errno = errno;
+  if ((imgfd >= 0) && ((f->imgpath != NULL) || use_consumer))
+    close (imgfd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Encode the screenshots of a framebuffer, in the order
+ * they are read, until the last screenshot has been read.
+ * This runs in a thread of its own.
+ * 
+ * @param   cap_  The framebuffer, `struct capture *`.
+ * @return        `NULL`.
+ */
+static void *
+encode_frames (void *cap_)
+{
+  struct capture *cap = cap_;
+  struct frame *f;
+  int rc = 0, saved_errno = 0;
+  
+  use_stats (&(cap->pipeline_stats));
+  for (;;)
+    {
+      f = cap->pipeline + ring_consume (&(cap->ring));
+      if (f->last)
+	break;
+      
+      /* After a failure, the remaining screenshots are discarded,
+         and the failure is reported when the slot is reused. */
+      if ((rc == 0) && (encode_frame (cap, f) < 0))
+	rc = -1, saved_errno = errno;
+      enter_stage (STAGE_NONE);
+      f->rc = rc;
+      f->saved_errno = saved_errno;
+      ring_release (&(cap->ring));
+    }
+  ring_release (&(cap->ring));
+  use_stats (NULL);
+  
+  cap->rc = rc;
+  cap->saved_errno = saved_errno;
+  return NULL;
+}
+
+
+/**
+ * Start encoding the screenshots of a framebuffer in a
+ * thread of its own, so that the next screenshots can be
+ * read while the previous ones are being encoded.
+ * 
+ * @param   cap          The framebuffer.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the images, `NULL` for none.
+ * @return               Zero on success, -1 on error.
+ */
+static int
+start_pipeline (struct capture *restrict cap, const struct pattern *execpattern)
+{
+  int saved_errno;
+  
+  cap->pipeline = calloc (PIPELINE_DEPTH, sizeof (*(cap->pipeline)));
+  if (cap->pipeline == NULL)
+    return -1;
+  if (init_ring (&(cap->ring), PIPELINE_DEPTH) < 0)
+    goto fail;
+  cap->execpattern = execpattern;
+  if ((errno = pthread_create (&(cap->thread), NULL, encode_frames, cap)))
+    {
+      saved_errno = errno;
+      destroy_ring (&(cap->ring));
+      errno = saved_errno;
+      goto fail;
+    }
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  free (cap->pipeline);
+  cap->pipeline = NULL;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Read a screenshot of a framebuffer, and hand it over
+ * to the thread started by `start_pipeline` for encoding.
+ * This waits if too many screenshots are already waiting.
+ * 
+ * @param   cap  The framebuffer, prepared with `prepare_fb`.
+ * @return       Zero on success, -1 on error, including if
+ *               encoding of a previous screenshot failed.
+ */
+static int
+queue_frame (struct capture *restrict cap)
+{
+  struct frame *f = cap->pipeline + ring_acquire (&(cap->ring));
+  struct timespec begin, end;
+  void *data;
+  size_t n;
+  int saved_errno;
+  
+  if (f->rc < 0)
+    return errno = f->saved_errno, -1;
+  
+  /* Copy the framebuffer, as fast as possible, and hand
+     over the copy, it is converted by the encoding thread. */
+  use_stats (&(cap->stats));
+  enter_stage (STAGE_READ);
+  if (use_timing && clock_gettime (CLOCK_MONOTONIC, &begin))
+    goto fail;
+  if (use_consumer && clock_gettime (CLOCK_REALTIME, &(f->taken)))
+    goto fail;
+  if (copy_fb (cap->fbfd, &n, cap->data) == NULL)
+    goto fail;
+  if (use_timing && clock_gettime (CLOCK_MONOTONIC, &end))
+    goto fail;
+  data = detach_copy (cap->data, f->data);
+  if (data == NULL)
+    goto fail;
+  f->data = data;
+  use_stats (NULL);
+  cap->stats.images++;
+  cap->stats.pixels += (uint64_t)(cap->width) * (uint64_t)(cap->height);
+  
+  /* The image's pathname is evaluated again for the next screenshot. */
+  free (f->imgpath);
+  f->imgpath = cap->imgpath;
+  cap->imgpath = NULL;
+  f->width = cap->width;
+  f->height = cap->height;
+  f->frame = cap->frame;
+  f->read_time = use_timing ? elapsed (&begin, &end) : 0;
+  ring_publish (&(cap->ring));
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  use_stats (NULL);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Wait until all screenshots of a framebuffer, read with
+ * `queue_frame`, have been encoded, and stop the thread
+ * started by `start_pipeline`.
+ * 
+ * This must be called after `start_pipeline` has
+ * succeeded, even if `queue_frame` has failed.
+ * 
+ * @param   cap  The framebuffer.
+ * @return       Zero on success, -1 if any screenshot could not be encoded.
+ */
+static int
+stop_pipeline (struct capture *restrict cap)
+{
+  struct frame *f;
+  size_t i;
+  
+  /* If `queue_frame` failed, it has not handed over its slot,
+     but `ring_acquire` will return the same slot again. */
+  f = cap->pipeline + ring_acquire (&(cap->ring));
+  f->last = 1;
+  ring_publish (&(cap->ring));
+  pthread_join (cap->thread, NULL);
+  
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    {
+      release_fb (cap->pipeline[i].data);
+      free (cap->pipeline[i].buffer.buf);
+      if (cap->pipeline[i].imgpath != failure_file) /* Reported in `main`. */
+	free (cap->pipeline[i].imgpath);
+    }
+  free (cap->pipeline);
+  cap->pipeline = NULL;
+  destroy_ring (&(cap->ring));
+  wait_jobs (&(cap->pipeline_stats));
+  merge_stats (&(cap->stats), &(cap->pipeline_stats));
+  
+  return cap->rc < 0 ? (errno = cap->saved_errno, -1) : 0;
+}
+
+
+/**
+ * Take screenshots of framebuffers, opened with `open_fb`,
+ * repeatedly, as selected by `frames` and `interval`.
+ * 
+ * Unless the screenshots are stored as dumps, deltas, or
+ * animations, or are taken simultaneously, each framebuffer
+ * gets a thread that encodes its screenshots, whilst this
+ * thread reads the next screenshots.
+ * 
+ * @param   caps          The framebuffers.
+ * @param   n             The number of framebuffers.
+ * @param   filepattern   The pattern for the filename, `NULL` for piping.
+ * @param   execpattern   The pattern for the command to run to
+ *                        process thes image, `NULL` for none.
+ * @param   simultaneous  Screenshot the framebuffers at the same time?
+ * @return                Zero on success, -1 on error.
+ */
+static int
+record_fbs (struct capture *restrict caps, size_t n, const struct pattern *filepattern,
+	    const struct pattern *execpattern, int simultaneous)
+{
+  struct timespec next, now;
+  long frame;
+  size_t i, started = 0;
+  int r, rc = -1, saved_errno;
+  int pipelined = !simultaneous && !use_raw && !use_delta && !use_apng;
+  
+  if (clock_gettime (CLOCK_MONOTONIC, &next))
+    goto fail;
+  
+  if (pipelined)
+    for (; started < n; started++)
+      if (start_pipeline (caps + started, execpattern) < 0)
+	goto fail;
+  
+  for (frame = 0; !frames || (frame < frames); frame++)
+    {
+      /* Wait until it is time for the next screenshot. The time is
+         absolute, so that the time it takes to take the screenshots
+         does not add up, but if we fall behind we do not try to catch up. */
+      if (frame > 0)
+	{
+	  next.tv_nsec += (interval % 1000) * 1000000L;
+	  next.tv_sec += (time_t)(interval / 1000 + next.tv_nsec / 1000000000L);
+	  next.tv_nsec %= 1000000000L;
+	  while ((r = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)))
+	    if (r != EINTR)
+	      {
+		errno = r;
+		goto fail;
+	      }
+	  if (clock_gettime (CLOCK_MONOTONIC, &now))
+	    goto fail;
+	  if ((now.tv_sec - next.tv_sec) * 1000L + (now.tv_nsec - next.tv_nsec) / 1000000L > interval)
+	    next = now;
+	}
+      
+      /* Take a screenshot of each framebuffer. */
+      for (i = 0; i < n; i++)
+	if (prepare_fb (caps + i, filepattern) < 0)
+	  goto fail;
+      if (simultaneous)
+	{
+	  if (save_fbs_simultaneously (caps, n, execpattern) < 0)
+	    goto fail;
+	}
+      else if (pipelined)
+	{
+	  for (i = 0; i < n; i++)
+	    if (queue_frame (caps + i) < 0)
+	      goto fail;
+	}
+      else
+	for (i = 0; i < n; i++)
+	  if ((save (caps + i) < 0) || (saved_fb (caps + i, execpattern) < 0))
+	    goto fail;
+    }
+  
+  rc = 0;
+ fail:
+  saved_errno = errno;
+  /* Wait for the remaining screenshots to be encoded. */
+  for (i = 0; i < started; i++)
+    if ((stop_pipeline (caps + i) < 0) && (rc == 0))
+      rc = -1, saved_errno = errno;
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Parse a non-negative integer, saturating at `LONG_MAX`.
+ * 
+ * @param   str    The string to parse.
+ * @param   value  Output parameter for the value.
+ * @return         Zero on success, -1 if the string is not a non-negative integer.
+ */
+static int
+parse_nonnegative (const char *restrict str, long *restrict value)
+{
+  char *end;
+  if (!isdigit (*str))
+    return -1;
+  errno = 0;
+  *value = strtol (str, &end, 10);
+  return *end ? -1 : 0;
+}
+
+
+/**
+ * Parse the argument of --crop: four non-negative
+ * integers, separated by commas, saturating at `LONG_MAX`.
+ * 
+ * @param   str     The string to parse.
+ * @param   region  Output parameter for the left-most column,
+ *                  the top-most line, the width, and the height.
+ * @return          Zero on success, -1 if the string is invalid,
+ *                  or if the width or the height is zero.
+ */
+static int
+parse_crop (const char *restrict str, long region[4])
+{
+  char *end;
+  int i;
+  for (i = 0; i < 4; i++, str = end + 1)
+    {
+      if (!isdigit (*str))
+	return -1;
+      errno = 0;
+      region[i] = strtol (str, &end, 10);
+      if (*end != (i < 3 ? ',' : '\0'))
+	return -1;
+    }
+  return (region[2] && region[3]) ? 0 : -1;
+}
+
+
+/**
+ * Parse the argument of --thumbnail: positive integers,
+ * separated by commas, saturating at `LONG_MAX`.
+ * 
+ * @param   str    The string to parse.
+ * @param   sizes  Output parameter for the sizes, it
+ *                 shall be deallocated with `free`.
+ * @param   n      Output parameter for the number of sizes.
+ * @return         Zero on success, -1 on error,
+ *                 `errno` is set to `EINVAL` if the string is invalid.
+ */
+static int
+parse_sizes (const char *restrict str, long **restrict sizes, size_t *restrict n)
+{
+  const char *p;
+  char *end;
+  size_t i;
+  
+  for (*n = 1, p = str; *p; p++)
+    *n += (*p == ',');
+  *sizes = malloc (*n * sizeof (**sizes));
+  if (*sizes == NULL)
+    return -1;
+  
+  for (i = 0; i < *n; i++, str = end + 1)
+    {
+      if (!isdigit (*str))
+	goto invalid;
+      errno = 0;
+      (*sizes)[i] = strtol (str, &end, 10);
+      if (!(*sizes)[i] || (*end != (i + 1 < *n ? ',' : '\0')))
+	goto invalid;
+    }
+  return 0;
+  
+ invalid:
+  free (*sizes);
+  *sizes = NULL;
+  return errno = EINVAL, -1;
+}
+
+
+/**
+ * Set, by a signal handler, when the daemon shall stop.
+ */
+static volatile sig_atomic_t stop_serving = 0;
+
+
+/**
+ * Make the daemon stop, when it has served the
+ * current client, this is a signal handler.
+ * 
+ * @param  signo  The signal.
+ */
+static void
+stop_daemon (int signo)
+{
+  (void) signo;
+  stop_serving = 1;
+}
+
+
+/**
+ * Create the socket that the daemon listens on.
+ * 
+ * @param   path  The pathname of the socket.
+ * @return        The file descriptor of the socket, -1 on error.
+ */
+static int
+open_socket (const char *path)
+{
+  struct sockaddr_un addr;
+  mode_t old_umask;
+  int fd, r, saved_errno;
+  
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      failure_file = path;
+      return -1;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  
+  /* Only the user may take screenshots through the socket. */
+  old_umask = umask (S_IRWXG | S_IRWXO);
+  r = bind (fd, (struct sockaddr *)&addr, sizeof (addr));
+  umask (old_umask);
+  if (r)
+    FILE_FAILURE (path);
+  if (listen (fd, SOMAXCONN))
+    goto fail;
+  return fd;
+  
+ fail:
+  saved_errno = errno;
+  close (fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Send a reply to a client of the daemon.
+ * 
+ * @param   connfd  The connection to the client.
+ * @param   format  The reply, formatted as by `printf`.
+ * @param   ...     The arguments for `format`.
+ * @return          Zero on success, -1 on error.
+ */
+static int
+reply (int connfd, const char *format, ...)
+{
+  char buf[512];
+  char *msg = buf;
+  va_list args;
+  ssize_t r;
+  size_t i, n;
+  int len, saved_errno;
+  
+  va_start (args, format);
+  len = vsnprintf (buf, sizeof (buf), format, args);
+  va_end (args);
+  if (len < 0)
+    return -1;
+  n = (size_t)len;
+  
+  /* A reply with a long pathname does not fit in the buffer,
+     it must not be cut off, since it ends with a new line. */
+  if (n >= sizeof (buf))
+    {
+      msg = malloc (n + 1);
+      if (msg == NULL)
+	return -1;
+      va_start (args, format);
+      vsnprintf (msg, n + 1, format, args);
+      va_end (args);
+    }
+  
+  for (i = 0; i < n; i += (size_t)r)
+    {
+      r = write (connfd, msg + i, n - i);
+      if (r < 0)
+	{
+	  if (errno != EINTR)
+	    goto fail;
+	  r = 0;
+	}
+    }
+  if (msg != buf)
+    free (msg);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  if (msg != buf)
+    free (msg);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Tell a client of the daemon why its request failed.
+ * 
+ * @param   connfd  The connection to the client.
+ * @return          Zero on success, -1 on error.
+ */
+static int
+reply_failure (int connfd)
+{
+  const char *file = failure_file;
+  const char *reason = failure_reason ? failure_reason : strerror (errno ? errno : EIO);
+  failure_file = NULL;
+  failure_reason = NULL;
+  if (file != NULL)
+    return reply (connfd, "error %s: %s\n", reason, file);
+  return reply (connfd, "error %s\n", reason);
+}
+
+
+/**
+ * Receive from a client of the daemon, and take
+ * the file descriptor it passed along, if any.
+ * 
+ * @param   connfd  The connection to the client.
+ * @param   buf     Output buffer for the received data.
+ * @param   n       The size of `buf`.
+ * @param   fd      The file descriptor passed by the client, -1 if none.
+ *                  If a new file descriptor is received, the old one is
+ *                  closed and replaced.
+ * @return          The number of bytes received, 0 at end
+ *                  of the connection, -1 on error.
+ */
+static ssize_t
+receive_request (int connfd, char *restrict buf, size_t n, int *restrict fd)
+{
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  ssize_t r;
+  int newfd;
+  
+  iov.iov_base = buf;
+  iov.iov_len = n;
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  
+  r = recvmsg (connfd, &msg, MSG_CMSG_CLOEXEC);
+  if (r < 0)
+    return -1;
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+	(cmsg->cmsg_len == CMSG_LEN (sizeof (int))))
+      {
+	memcpy (&newfd, CMSG_DATA (cmsg), sizeof (int));
+	if (*fd >= 0)
+	  close (*fd);
+	*fd = newfd;
+      }
+  return r;
+}
+
+
+/**
+ * Take a screenshot requested by a client of the daemon.
+ * 
+ * The request is "DEVICE FORMAT [PATH]", where DEVICE is the
+ * number of the framebuffer, and FORMAT is "png", "qoi" or "raw".
+ * The image is saved to PATH, or if omitted, written to the file
+ * descriptor passed with the request, or if none, sent over the
+ * connection. The reply is "ok WIDTH HEIGHT", or "ok WIDTH HEIGHT
+ * SIZE" followed by the image if it is sent over the connection,
+ * or "error MESSAGE".
+ * 
+ * @param   caps     The framebuffers.
+ * @param   n        The number of framebuffers.
+ * @param   connfd   The connection to the client.
+ * @param   request  The request, it is modified.
+ * @param   fd       The file descriptor passed by the client, -1 if
+ *                   none, it is closed and set to -1 if it is used.
+ * @return           Zero on success, even if the screenshot could not
+ *                   be taken, -1 if the client could not be replied to.
+ */
+static int
+serve_request (struct capture *restrict caps, size_t n, int connfd,
+	       char *restrict request, int *restrict fd)
+{
+  struct capture *cap = NULL;
+  struct stat attr;
+  const char *format;
+  char *path = NULL, *p;
+  off_t off = 0;
+  ssize_t r;
+  size_t i;
+  long fbno;
+  int raw = 0, qoi = 0, memfd = -1, rc = -1, saved_errno;
+  
+  /* Parse the request. */
+  if (!isdigit (*request))
+    return reply (connfd, "error Invalid request\n");
+  errno = 0;
+  fbno = strtol (request, &p, 10);
+  if (errno || (*p++ != ' '))
+    return reply (connfd, "error Invalid request\n");
+  format = p;
+  p = strchr (p, ' ');
+  if (p != NULL)
+    *p++ = '\0', path = p;
+  if (!strcmp (format, "raw"))
+    raw = 1;
+  else if (!strcmp (format, "qoi"))
+    qoi = 1;
+  else if (strcmp (format, "png"))
+    return reply (connfd, "error Unknown format: %s\n", format);
+  for (i = 0; i < n; i++)
+    if (caps[i].fbno == fbno)
+      cap = caps + i;
+  if (cap == NULL)
+    return reply (connfd, "error The selected device does not exist\n");
+  
+  /* The framebuffer is only measured again if it has been reconfigured. */
+  if (prepare_fb (cap, NULL) < 0)
+    return reply_failure (connfd);
+  
+  /* Select the output. The daemon serves one request at a time, so the
+     format can be selected by setting the options for --raw and --format. */
+  use_raw = raw;
+  use_qoi = qoi;
+  if ((path != NULL) && *path)
+    {
+      cap->imgpath = strdup (path);
+      if (cap->imgpath == NULL)
+	return reply_failure (connfd);
+    }
+  else if (*fd >= 0)
+    cap->outfd = *fd;
+  else
+    {
+      memfd = open_consumer_image ();
+      if (memfd < 0)
+	return reply_failure (connfd);
+      cap->outfd = memfd;
+    }
+  
+  if (save (cap) < 0)
+    {
+      saved_errno = errno;
+      rc = 0;
+      goto fail;
+    }
+  if (memfd < 0)
+    {
+      rc = reply (connfd, "ok %li %li\n", cap->width, cap->height);
+      goto done;
+    }
+  
+  /* Send the image over the connection, after its size. */
+  if (fstat (memfd, &attr))
+    {
+      saved_errno = errno;
+      rc = 0;
+      goto fail;
+    }
+  if (reply (connfd, "ok %li %li %lli\n", cap->width, cap->height, (long long int)(attr.st_size)) < 0)
+    goto done;
+  while (off < attr.st_size)
+    {
+      r = sendfile (connfd, memfd, &off, (size_t)(attr.st_size - off));
+      if ((r < 0) && (errno == EINTR))
+	continue;
+      if (r <= 0)
+	goto done;
+    }
+  rc = 0;
+  goto done;
+  
+ fail:
+  errno = saved_errno;
+  if (reply_failure (connfd) < 0)
+    rc = -1;
+ done:
+  if ((*fd >= 0) && (cap->outfd == *fd))
+    {
+      close (*fd);
+      *fd = -1;
+    }
+  if (memfd >= 0)
+    close (memfd);
+  cap->outfd = -1;
+  free (cap->imgpath);
+  cap->imgpath = NULL;
+  return rc;
+}
+
+
+/**
+ * Serve the requests of a client of the daemon, one
+ * per line, until the client closes the connection.
+ * 
+ * @param  caps    The framebuffers.
+ * @param  n       The number of framebuffers.
+ * @param  connfd  The connection to the client.
+ */
+static void
+serve_client (struct capture *restrict caps, size_t n, int connfd)
+{
+  char buf[PATH_MAX + 64];
+  char *nl;
+  size_t len = 0;
+  ssize_t r;
+  int fd = -1;
+  
+  while (!stop_serving)
+    {
+      /* Serve each complete request. */
+      while ((nl = memchr (buf, '\n', len)) != NULL)
+	{
+	  *nl++ = '\0';
+	  if (serve_request (caps, n, connfd, buf, &fd) < 0)
+	    goto done;
+	  len -= (size_t)(nl - buf);
+	  memmove (buf, nl, len);
+	}
+      if (len == sizeof (buf))
+	{
+	  reply (connfd, "error Request too long\n");
+	  break;
+	}
+      
+      r = receive_request (connfd, buf + len, sizeof (buf) - len, &fd);
+      if (r <= 0)
+	break;
+      len += (size_t)r;
+    }
+  
+ done:
+  if (fd >= 0)
+    close (fd);
+}
+
+
+/**
+ * Serve requests for screenshots, over a Unix socket, of
+ * framebuffers opened with `open_fb`, until the process
+ * is interrupted, terminated, or hung up.
+ * 
+ * @param   caps  The framebuffers.
+ * @param   n     The number of framebuffers.
+ * @param   path  The pathname of the socket, it is removed when done.
+ * @return        Zero on success, -1 on error.
+ */
+static int
+serve (struct capture *restrict caps, size_t n, const char *path)
+{
+  struct sigaction action;
+  int sockfd, connfd, rc = -1, saved_errno;
+  
+  sockfd = open_socket (path);
+  if (sockfd < 0)
+    return -1;
+  
+  /* Without SA_RESTART, so that waiting for a client is interrupted.
+     A client that leaves early shall not kill the daemon. */
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = stop_daemon;
+  sigemptyset (&(action.sa_mask));
+  if (sigaction (SIGINT, &action, NULL) || sigaction (SIGTERM, &action, NULL) ||
+      sigaction (SIGHUP, &action, NULL))
+    goto fail;
+  signal (SIGPIPE, SIG_IGN);
+  
+  while (!stop_serving)
+    {
+      connfd = accept4 (sockfd, NULL, NULL, SOCK_CLOEXEC);
+      if (connfd == -1)
+	{
+	  if ((errno == EINTR) || (errno == ECONNABORTED))
+	    continue;
+	  goto fail;
+	}
+      serve_client (caps, n, connfd);
+      close (connfd);
+    }
+  
+  rc = 0;
+ fail:
+  saved_errno = errno;
+  close (sockfd);
+  unlink (path);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Take a screenshot of all, or one, framebuffers.
+ * 
+ * @param   filepattern   The pattern for the filename, `NULL` for piping.
+ * @param   execpattern   The pattern for the command to run to
+ *                        process thes image, `NULL` for none.
+ * @param   all           All framebuffers?
+ * @param   devno         The index of the framebuffer.
+ * @param   simultaneous  Open and measure all framebuffers first,
+ *                        and then screenshot them at the same time?
+ * @return                Zero on success, -1 on error, 1 if no framebuffer exists.
+ */
+static
+int save_fbs (const struct pattern *filepattern, const struct pattern *exec, int all, int devno, int simultaneous)
+{
+  struct capture *caps = NULL;
+  void *new;
+  size_t i, n = 0;
+  int r, fbno, found = 0, saved_errno;
+  int last = all ? INT_MAX : (devno + 1);
+  int keep_open = simultaneous || (frames != 1) || (socketpath != NULL);
+  
+ retry:
+  /* Take a screenshot of each framebuffer, or open them all so that
+     we can screenshoot them simultaneously, or more than once. */
+  for (fbno = (all ? 0 : devno); fbno < last; fbno++)
+    {
+      if (keep_open)
+	{
+	  new = realloc (caps, (n + 1) * sizeof (*caps));
+	  if (new == NULL)
+	    goto fail;
+	  caps = new;
+	  r = open_fb (caps + n, fbno, dumppath);
+	  if (r)
+	    close_fb (caps + n);
+	  else
+	    n++;
+	}
+      else
+	r = save_fb (fbno, filepattern, exec);
+      if (r < 0)
+	goto fail;
+      else if (r == 0)
+	found = 1;
+      else if (fbno > 0)
+	break;
+      else
+	continue; /* Perhaps framebuffer 1 is the first. */
+    }
+  
+  /* Did not find any framebuffer? */
+  if (found == 0)
+    {
+      if (all && (try_alt_fbpath++ < alt_fbpath_limit))
+	goto retry;
+      free (caps);
+      return 1;
+    }
+  
+  if (keep_open && (socketpath != NULL))
+    {
+      if (serve (caps, n, socketpath) < 0)
+	goto fail;
+    }
+  else if (keep_open && (record_fbs (caps, n, filepattern, exec, simultaneous) < 0))
+    goto fail;
+  
+  for (i = 0; i < n; i++)
+    close_fb (caps + i);
+  free (caps);
+  return 0;
+ fail:
+  saved_errno = errno;
+  for (i = 0; i < n; i++)
+    close_fb (caps + i);
+  free (caps);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Print the reason a function failed.
+ */
+static void
+report_failure (void)
+{
+  const char *reason = failure_reason ? failure_reason : strerror (errno);
+  if (failure_file != NULL)
+    fprintf (stderr, _("%s: %s: %s\n"),
+	     execname, reason, failure_file);
+  else if (failure_reason != NULL)
+    fprintf (stderr, _("%s: %s\n"), execname, reason);
+  else if (errno)
+    perror (execname);
+  failure_file = NULL;
+  failure_reason = NULL;
+}
+
+
+/**
+ * Get the pathname of the image a dump is converted to.
+ * 
+ * @param   dump    The pathname of the dump.
+ * @param   outdir  The directory to save the image in,
+ *                  `NULL` for the dump's directory.
+ * @return          The pathname of the image, `NULL` on error.
  */
-static int try_alt_fbpath = 0;
-
+static char *
+dump_image_path (const char *dump, const char *outdir)
+{
+  const char *base, *dot;
+  char *imgpath;
+  size_t dirlen;
+  
+  /* The image is named after the dump, with its suffix replaced. */
+  base = strrchr (dump, '/') ? (strrchr (dump, '/') + 1) : dump;
+  dot = strrchr (base, '.');
+  if ((dot == NULL) || (dot == base))
+    dot = base + strlen (base);
+  
+  dirlen = outdir ? (strlen (outdir) + 1) : (size_t)(base - dump);
+  imgpath = malloc (dirlen + (size_t)(dot - base) + sizeof (".png"));
+  if (imgpath == NULL)
+    return NULL;
+  if (outdir)
+    sprintf (imgpath, "%s/", outdir);
+  else
+    memcpy (imgpath, dump, dirlen);
+  memcpy (imgpath + dirlen, base, (size_t)(dot - base));
+  strcpy (imgpath + dirlen + (size_t)(dot - base), IMAGE_EXTENSION);
+  return imgpath;
+}
 
 
 /**
- * Create an image of a framebuffer.
+ * Convert a dump to PNG.
  * 
- * @param   fbfd      File descriptor for framebuffer device.
- * @param   imgname   The pathname of the output image, `NULL` for piping.
- * @param   width     The width of the image.
- * @param   height    The height of the image.
- * @param   data      Additional data for  `convert_fb_to_png`.
- * @return            Zero on success, -1 on error.
+ * @param   dump         The pathname of the dump.
+ * @param   outdir       The directory to save the image in,
+ *                       `NULL` for the dump's directory.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the image, `NULL` for none.
+ * @return               Zero on success, -1 on error.
  */
 static int
-save (int fbfd, const char *imgpath, long width,
-      long height, void *restrict data)
+convert_dump (const char *dump, const char *outdir, const struct pattern *execpattern)
 {
-  int imgfd = STDOUT_FILENO, piping = (imgpath == NULL);
-  int saved_errno;
+  struct capture cap;
+  int rc;
   
-  /* Open output file. */
-  if (!piping)
+  rc = open_fb (&cap, 0, dump);
+  if (rc == 0)
     {
-      imgfd = open (imgpath, O_WRONLY | O_CREAT | O_TRUNC,
-		    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-      if (imgfd == -1)
-	FILE_FAILURE (imgpath);
+      cap.frame = 0;
+      cap.imgpath = dump_image_path (dump, outdir);
+      rc = cap.imgpath ? save (&cap) : -1;
     }
-  
-  /* Save image. */
-  if (save_png (fbfd, width, height, imgfd, data) < 0)
-    goto fail;
-  
-  close (fbfd);
-  if (!piping)
-    close (imgfd);
-  return 0;
-  
- fail:
-  saved_errno = errno;
-  if ((imgfd >= 0) && !piping)
-    close (imgfd);
-  errno = saved_errno;
-  return -1;
+  if (rc == 0)
+    rc = saved_fb (&cap, execpattern);
+  close_fb (&cap);
+  return rc ? -1 : 0;
 }
 
 
 /**
- * Run a command for an image
+ * Convert the dumps, listed by `convert_dir`, whose indices
+ * are read from a pipe, until the pipe is closed. This
+ * runs in a process of its own.
  * 
- * @param   flatten_args  The arguments to run, 255 delimits the arguments
- * @return                Zero on success -1 on error
+ * @param   dumps        The pathnames of the dumps.
+ * @param   jobfd        The read end of the pipe.
+ * @param   outdir       The directory to save the images in,
+ *                       `NULL` for the dumps' directory.
+ * @param   execpattern  The pattern for the command to run to
+ *                       process the images, `NULL` for none.
+ * @return               Zero on success, 1 if any dump could not be converted.
  */
 static int
-exec_image (char *flatten_args)
+convert_dumps (char **dumps, int jobfd, const char *outdir, const struct pattern *execpattern)
 {
-  char **args = NULL;
-  char *arg;
-  size_t i, arg_count = 1;
-  pid_t pid;
-  int status, saved_errno;
-  
-  /* Count arguments. */
-  for (i = 0; flatten_args[i]; i++)
-    if ((unsigned char)(flatten_args[i]) == 255)
-      arg_count++;
-  
-  /* Allocate argument array. */
-  args = malloc ((arg_count + 1) * sizeof (char*));
-  if (args == NULL)
-    goto fail;
+  size_t i;
+  ssize_t r;
+  int failed = 0;
   
-  /* Unflatten argument array. */
-  for (arg = flatten_args, i = 0;;)
+  /* The indices are smaller than `PIPE_BUF`, so they are not split. */
+  for (;;)
     {
-      args[i++] = arg;
-      arg = strchr (arg, 255);
-      if (arg == NULL)
+      r = read (jobfd, &i, sizeof (i));
+      if ((r < 0) && (errno == EINTR))
+	continue;
+      if (r != (ssize_t)sizeof (i))
 	break;
-      *arg++ = '\0';
-    }
-  args[i] = NULL;
-  
-  /* Fork process. */
-  pid = fork ();
-  if (pid == -1)
-    goto fail;
-
-  /* Child process: */
-  if (pid == 0)
-    {
-      execvp (*args, args);
-      perror (execname);
-      _exit (1);
+      if (convert_dump (dumps[i], outdir, execpattern) < 0)
+	report_failure (), failed = 1;
     }
-  
-  /* Parent process: */
-  
-  /* Wait for child to exit. */
-  if (waitpid (pid, &status, 0) < 0)
-    goto fail;
-  
-  /* Return successfully if and only if `the child` did. */
-  free (args);
-  return status == 0 ? 0 : -1;
-  
- fail:
-  saved_errno = errno;
-  free (args);
-  errno = saved_errno;
-  return -1;
+  if (r < 0)
+    report_failure (), failed = 1;
+  if (wait_jobs (NULL) < 0)
+    report_failure (), failed = 1;
+  if (failed_jobs ())
+    failed = 1;
+  return failed;
 }
 
 
 /**
- * Take a screenshot of a framebuffer.
+ * Compare two strings, for `qsort`.
  * 
- * @param   fbno         The number of the framebuffer.
- * @param   filepattern  The pattern for the filename, `NULL` for piping.
- * @param   execpattern  The pattern for the command to run to
- *                       process the image, `NULL` for none.
- * @return               Zero on success, -1 on error, 1 if the framebuffer does not exist.
+ * @param   a  The first string, `char **`.
+ * @param   b  The second string, `char **`.
+ * @return     Negative if `a` sorts before `b`,
+ *             positive if after, zero if equal.
  */
 static int
-save_fb (int fbno, const char *filepattern, const char *execpattern)
+compare_strings (const void *a, const void *b)
 {
-  char *imgpath = NULL;
-  char *fbpath; /* Statically allocate string is returned. */
-  char *execargs = NULL;
-  long width, height;
-  void *data = NULL;
-  int fbfd = -1;
-  int rc = 0, saved_errno = 0;
-  
-  /* Get pathname for framebuffer, and stop if we have read all existing ones. */
-  fbpath = get_fbpath (try_alt_fbpath, fbno);
-  if (access (fbpath, F_OK))
-    return 1;
-  
-  /* Open the framebuffer device for reading. */
-  fbfd = open (fbpath, O_RDONLY);
-  if (fbfd == -1)
-    FILE_FAILURE (fbpath);
+  return strcmp (*(char *const *)a, *(char *const *)b);
+}
+
+
+/**
+ * List the dumps in a directory. Hidden files, sidecars,
+ * PNG files, and anything that is not a regular file,
+ * are skipped.
+ * 
+ * @param   dirpath  The directory.
+ * @param   n        Output parameter for the number of dumps.
+ * @return           The pathnames of the dumps, sorted, `NULL` on
+ *                   error. Each element, and the array, shall be freed.
+ */
+static char **
+list_dumps (const char *dirpath, size_t *restrict n)
+{
+  DIR *dir;
+  struct dirent *f;
+  struct stat attr;
+  char **dumps = NULL, *dump = NULL;
+  size_t len, namelen, size = 0, i;
+  void *new;
+  int saved_errno;
   
-  /* Get the size of the framebuffer. */
-  if (measure (fbno, fbfd, &width, &height, &data) < 0)
-    goto fail;
+  *n = 0;
+  dir = opendir (dirpath);
+  if (dir == NULL)
+    FILE_FAILURE (dirpath);
   
-  /* Get output pathname. */
-  if (filepattern != NULL)
+  for (;;)
     {
-      imgpath = evaluate (filepattern, fbno, width, height, NULL);
-      if (imgpath == NULL)
+      errno = 0;
+      f = readdir (dir);
+      if (f == NULL)
+	{
+	  if (errno)
+	    FILE_FAILURE (dirpath);
+	  break;
+	}
+      namelen = strlen (f->d_name);
+      len = sizeof (SIDECAR_SUFFIX) - 1;
+      if ((*(f->d_name) == '.') ||
+	  ((namelen > len) && !strcmp (f->d_name + namelen - len, SIDECAR_SUFFIX)) ||
+	  ((namelen > 4) && !strcmp (f->d_name + namelen - 4, ".png")) ||
+	  ((namelen > 4) && !strcmp (f->d_name + namelen - 4, ".qoi")))
+	continue;
+      
+      dump = malloc (strlen (dirpath) + namelen + 2);
+      if (dump == NULL)
 	goto fail;
+      sprintf (dump, "%s/%s", dirpath, f->d_name);
+      if (stat (dump, &attr) || !S_ISREG (attr.st_mode))
+	{
+	  free (dump), dump = NULL;
+	  continue;
+	}
+      
+      if (*n == size)
+	{
+	  new = realloc (dumps, (size = size ? (size << 1) : 64) * sizeof (*dumps));
+	  if (new == NULL)
+	    goto fail;
+	  dumps = new;
+	}
+      dumps[(*n)++] = dump, dump = NULL;
     }
   
-  /* Take a screenshot of the current framebuffer. */
-  if (save (fbfd, imgpath, width, height, data) < 0)
-    goto fail;
-  if (imgpath)
-    fprintf (stderr, _("Saved framebuffer %i to %s.\n"), fbno, imgpath);
-  
-  /* Should we run a command over the image? */
-  if (execpattern == NULL)
-    goto done;
-  
-  /* Get execute arguments. */
-  execargs = evaluate (execpattern, fbno, width, height, imgpath);
-  if (execargs == NULL)
-    goto fail;
-  
-  /* Run command over image. */
-  if (exec_image (execargs) < 0)
-    goto fail;
-  
-  goto done;
+  closedir (dir);
+  if (*n)
+    qsort (dumps, *n, sizeof (*dumps), compare_strings);
+  return dumps ? dumps : calloc (1, sizeof (*dumps));
   
  fail:
   saved_errno = errno;
-  rc = -1;
- done:
-  if (fbfd >= 0)
-    close (fbfd);
-  free (execargs);
-  free (imgpath);
-  return errno = saved_errno, rc;
+  if (dir != NULL)
+    closedir (dir);
+  free (dump);
+  for (i = 0; i < *n; i++)
+    free (dumps[i]);
+  free (dumps);
+  errno = saved_errno;
+  return NULL;
 }
 
 
 /**
- * Take a screenshot of all, or one, framebuffers.
+ * Convert all dumps in a directory to PNG, in as
+ * many processes as there are CPUs. Dumps that
+ * cannot be converted are reported, and skipped.
  * 
- * @param   filepattern  The pattern for the filename, `NULL` for piping.
+ * @param   dirpath      The directory.
+ * @param   outdir       The directory to save the images in,
+ *                       `NULL` for `dirpath`.
  * @param   execpattern  The pattern for the command to run to
- *                       process thes image, `NULL` for none.
- * @param   all          All framebuffers?
- * @param   devno        The index of the framebuffer.
- * @return               Zero on success, -1 on error, 1 if no framebuffer exists.
+ *                       process the images, `NULL` for none.
+ * @return               Zero on success, -1 on error,
+ *                       1 if any dump could not be converted.
  */
-static
-int save_fbs (const char *filepattern, const char *exec, int all, int devno)
+static int
+convert_dir (const char *dirpath, const char *outdir, const struct pattern *execpattern)
 {
-  int r, fbno, found = 0;
-  int last = all ? INT_MAX : (devno + 1);
+  char **dumps;
+  size_t i, n;
+  long jobs, started;
+  int fds[2], status, failed = 0, saved_errno;
+  pid_t pid;
   
- retry:
-  /* Take a screenshot of each framebuffer. */
-  for (fbno = (all ? 0 : devno); fbno < last; fbno++)
+  dumps = list_dumps (dirpath, &n);
+  if (dumps == NULL)
+    return -1;
+  if (n == 0)
+    goto done;
+  
+  jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+  if ((size_t)jobs > n)
+    jobs = (long)n;
+  /* Each process must be allowed to run at least one command. */
+  if ((execpattern != NULL) && (jobs > max_jobs))
+    jobs = max_jobs;
+  
+  /* Each process converts the next dump whose index is sent over
+     the pipe, so that they are kept busy even if the dumps are of
+     different sizes. Output that is buffered is flushed, so that
+     it is not printed again by every process. */
+  if (pipe (fds))
+    goto fail;
+  fflush (NULL);
+  for (started = 0; started < jobs; started++)
     {
-      r = save_fb (fbno, filepattern, exec);
-      if (r < 0)
-	goto fail;
-      else if (r == 0)
-	found = 1;
-      else if (fbno > 0)
-	break;
-      else
-	continue; /* Perhaps framebuffer 1 is the first. */
+      pid = fork ();
+      if (pid == -1)
+	{
+	  if (started)
+	    break;
+	  saved_errno = errno;
+	  close (fds[0]);
+	  close (fds[1]);
+	  errno = saved_errno;
+	  goto fail;
+	}
+      if (pid == 0)
+	{
+	  /* Share the commands for the images between the processes. */
+	  close (fds[1]);
+	  if (init_jobs ((size_t)(max_jobs / jobs + (started < max_jobs % jobs))) < 0)
+	    report_failure (), exit (1);
+	  exit (convert_dumps (dumps, fds[0], outdir, execpattern));
+	}
     }
+  close (fds[0]);
   
-  /* Did not find any framebuffer? */
-  if (found == 0)
+  /* If all processes have died, there is no one to send the
+     rest of the dumps to, and the failure is reported by them. */
+  signal (SIGPIPE, SIG_IGN);
+  for (i = 0; i < n; i++)
+    if (write (fds[1], &i, sizeof (i)) != (ssize_t)sizeof (i))
+      {
+	if (errno == EINTR)
+	  i--;
+	else
+	  break;
+      }
+  close (fds[1]);
+  
+  while (started)
     {
-      if (all && (try_alt_fbpath++ < alt_fbpath_limit))
-	goto retry;
-      return 1;
+      if (wait (&status) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  goto fail;
+	}
+      started--;
+      if (status)
+	failed = 1;
     }
   
-  return 0;
+ done:
+  for (i = 0; i < n; i++)
+    free (dumps[i]);
+  free (dumps);
+  return failed;
+  
  fail:
+  saved_errno = errno;
+  for (i = 0; i < n; i++)
+    free (dumps[i]);
+  free (dumps);
+  errno = saved_errno;
   return -1;
 }
 
@@ -323,8 +2491,18 @@ main (int argc, char *argv[])
 #define USAGE_ASSERT(ASSERTION, MSG)  \
   do { if (!(ASSERTION))  EXIT_USAGE (MSG); } while (0)
   
-  int r, all = 1, devno = -1;
-  long devno_;
+  int r, all = 1, devno = -1, simultaneous = 0, have_threads = 0;
+  int have_interval = 0, have_count = 0, have_stats = 0, have_jobs = 0, batch = 0;
+  int have_crop = 0, have_scale = 0, have_encoder = 0, have_format = 0;
+  int stopped, child_failed = 0;
+  size_t i;
+  long devno_, crop[4];
+  const char *statspath = NULL;
+  struct stat attr;
+  struct pattern filepat, execpat, pipepat;
+  char **pipeargv = NULL;
+  char *pipeargs = NULL;
+  char *pipe_to = NULL;
   char *exec = NULL;
   char *filepattern = NULL;
   char *p;
@@ -335,6 +2513,25 @@ main (int argc, char *argv[])
       {"copyright", no_argument,       NULL, 'c'},
       {"device",    required_argument, NULL, 'd'},
       {"exec",      required_argument, NULL, 'e'},
+      {"simultaneous", no_argument,    NULL, 's'},
+      {"threads",   required_argument, NULL, 't'},
+      {"interval",  required_argument, NULL, 'I'},
+      {"count",     required_argument, NULL, 'C'},
+      {"delta",     no_argument,       NULL, 'D'},
+      {"apng",      no_argument,       NULL, 'A'},
+      {"raw",       no_argument,       NULL, 'R'},
+      {"convert",   required_argument, NULL, 'V'},
+      {"timing",    no_argument,       NULL, 'T'},
+      {"snapshot",  no_argument,       NULL, 'W'},
+      {"stats",     optional_argument, NULL, 'S'},
+      {"jobs",      required_argument, NULL, 'J'},
+      {"pipe-to",   required_argument, NULL, 'P'},
+      {"daemon",    required_argument, NULL, 'L'},
+      {"crop",      required_argument, NULL, 'X'},
+      {"scale",     required_argument, NULL, 'Z'},
+      {"thumbnail", required_argument, NULL, 'N'},
+      {"encoder",   required_argument, NULL, 'E'},
+      {"format",    required_argument, NULL, 'F'},
       {NULL,        0,                 NULL,  0 }
     };
   
@@ -349,7 +2546,7 @@ main (int argc, char *argv[])
   execname = argc ? *argv : "scrotty";
   for (;;)
     {
-      r = getopt_long (argc, argv, "hvcd:e:", long_options, NULL);
+      r = getopt_long (argc, argv, "hvcd:e:st:", long_options, NULL);
       if      (r == -1)   break;
       else if (r == 'h')  return -(print_help ());
       else if (r == 'v')  return -(print_version ());
@@ -374,6 +2571,135 @@ main (int argc, char *argv[])
 	  USAGE_ASSERT (exec == NULL, _("--exec is used twice"));
 	  exec = optarg;
 	}
+      else if (r == 's')
+	{
+	  USAGE_ASSERT (!simultaneous, _("--simultaneous is used twice"));
+	  simultaneous = 1;
+	}
+      else if (r == 't')
+	{
+	  USAGE_ASSERT (!have_threads, _("--threads is used twice"));
+	  have_threads = 1;
+	  if (parse_nonnegative (optarg, &threads))
+	    EXIT_USAGE (_("Invalid thread count, not a non-negative integer"));
+	  if ((threads == LONG_MAX) || (threads > INT_MAX))
+	    threads = INT_MAX;
+	  else if (threads == 0)
+	    threads = sysconf (_SC_NPROCESSORS_ONLN);
+	}
+      else if (r == 'I')
+	{
+	  USAGE_ASSERT (!have_interval, _("--interval is used twice"));
+	  have_interval = 1;
+	  if (parse_nonnegative (optarg, &interval))
+	    EXIT_USAGE (_("Invalid interval, not a non-negative integer"));
+	}
+      else if (r == 'C')
+	{
+	  USAGE_ASSERT (!have_count, _("--count is used twice"));
+	  have_count = 1;
+	  if (parse_nonnegative (optarg, &frames))
+	    EXIT_USAGE (_("Invalid screenshot count, not a non-negative integer"));
+	}
+      else if (r == 'D')
+	{
+	  USAGE_ASSERT (!use_delta, _("--delta is used twice"));
+	  use_delta = 1;
+	}
+      else if (r == 'A')
+	{
+	  USAGE_ASSERT (!use_apng, _("--apng is used twice"));
+	  use_apng = 1;
+	}
+      else if (r == 'R')
+	{
+	  USAGE_ASSERT (!use_raw, _("--raw is used twice"));
+	  use_raw = 1;
+	}
+      else if (r == 'V')
+	{
+	  USAGE_ASSERT (dumppath == NULL, _("--convert is used twice"));
+	  dumppath = optarg;
+	}
+      else if (r == 'T')
+	{
+	  USAGE_ASSERT (!use_timing, _("--timing is used twice"));
+	  use_timing = 1;
+	}
+      else if (r == 'W')
+	{
+	  USAGE_ASSERT (!use_snapshot, _("--snapshot is used twice"));
+	  use_snapshot = 1;
+	}
+      else if (r == 'S')
+	{
+	  USAGE_ASSERT (!have_stats, _("--stats is used twice"));
+	  have_stats = 1;
+	  statspath = optarg;
+	}
+      else if (r == 'J')
+	{
+	  USAGE_ASSERT (!have_jobs, _("--jobs is used twice"));
+	  have_jobs = 1;
+	  if (parse_nonnegative (optarg, &max_jobs))
+	    EXIT_USAGE (_("Invalid job count, not a non-negative integer"));
+	  if (max_jobs == LONG_MAX)
+	    max_jobs = INT_MAX;
+	}
+      else if (r == 'P')
+	{
+	  USAGE_ASSERT (pipe_to == NULL, _("--pipe-to is used twice"));
+	  pipe_to = optarg;
+	}
+      else if (r == 'L')
+	{
+	  USAGE_ASSERT (socketpath == NULL, _("--daemon is used twice"));
+	  socketpath = optarg;
+	}
+      else if (r == 'X')
+	{
+	  USAGE_ASSERT (!have_crop, _("--crop is used twice"));
+	  have_crop = 1;
+	  if (parse_crop (optarg, crop))
+	    EXIT_USAGE (_("Invalid region, not X,Y,WIDTH,HEIGHT with a positive WIDTH and HEIGHT"));
+	  set_crop (crop[0], crop[1], crop[2], crop[3]);
+	}
+      else if (r == 'Z')
+	{
+	  USAGE_ASSERT (!have_scale, _("--scale is used twice"));
+	  have_scale = 1;
+	  if (parse_nonnegative (optarg, &scale) || (scale < 1) || (scale > 100))
+	    EXIT_USAGE (_("Invalid scale, not a percentage from 1 to 100"));
+	}
+      else if (r == 'N')
+	{
+	  USAGE_ASSERT (thumbnails == NULL, _("--thumbnail is used twice"));
+	  if (parse_sizes (optarg, &thumbnails, &nthumbnails) < 0)
+	    {
+	      if (errno == EINVAL)
+		EXIT_USAGE (_("Invalid thumbnail size, not a positive integer"));
+	      goto fail;
+	    }
+	}
+      else if (r == 'E')
+	{
+	  USAGE_ASSERT (!have_encoder, _("--encoder is used twice"));
+	  have_encoder = 1;
+	  if (!strcmp (optarg, "fast"))
+	    use_fast = 1;
+	  else if (strcmp (optarg, "zlib"))
+	    EXIT_USAGE (_("Invalid encoder, not 'zlib' or 'fast'"));
+	  use_fast_encoder (use_fast);
+	}
+      else if (r == 'F')
+	{
+	  USAGE_ASSERT (!have_format, _("--format is used twice"));
+	  have_format = 1;
+	  if (!strcmp (optarg, "qoi"))
+	    use_qoi = 1;
+	  else if (strcmp (optarg, "png"))
+	    EXIT_USAGE (_("Invalid format, not 'png' or 'qoi'"));
+	}
       else if (r == '?')
 	EXIT_USAGE (_("Invalid input"));
       else
@@ -384,35 +2710,189 @@ main (int argc, char *argv[])
       USAGE_ASSERT (filepattern == NULL, _("FILENAME-PATTERN is used twice"));
       filepattern = argv[optind++];
     }
-  if (filepattern == NULL)
+  if (!have_format && (filepattern != NULL))
+    {
+      /* The format can be selected by the extension in the filename pattern. */
+      i = strlen (filepattern);
+      use_qoi = !use_raw && (i >= 4) && !strcmp (filepattern + i - 4, ".qoi");
+    }
+  if (have_interval && !have_count)
+    frames = 0;
+  USAGE_ASSERT (!use_apng || frames, _("--apng cannot be used without a limited --count"));
+  USAGE_ASSERT (!use_apng || !use_delta, _("--apng cannot be combined with --delta"));
+  USAGE_ASSERT (!use_raw || !use_delta, _("--raw cannot be combined with --delta"));
+  USAGE_ASSERT (!use_raw || !use_apng, _("--raw cannot be combined with --apng"));
+  USAGE_ASSERT (!use_raw || !use_snapshot, _("--raw cannot be combined with --snapshot"));
+  USAGE_ASSERT (!have_scale || !use_raw, _("--scale cannot be combined with --raw"));
+  USAGE_ASSERT (!have_scale || (!use_delta && !use_apng), _("--scale cannot be combined with --delta or --apng"));
+  USAGE_ASSERT (!nthumbnails || !use_raw, _("--thumbnail cannot be combined with --raw"));
+  USAGE_ASSERT (!nthumbnails || (!use_delta && !use_apng), _("--thumbnail cannot be combined with --delta or --apng"));
+  USAGE_ASSERT (!have_encoder || !use_raw, _("--encoder cannot be combined with --raw"));
+  USAGE_ASSERT (!have_format || !use_raw, _("--format cannot be combined with --raw"));
+  USAGE_ASSERT (!use_qoi || (!use_delta && !use_apng), _("QOI images cannot be combined with --delta or --apng"));
+  USAGE_ASSERT (!use_qoi || !have_encoder, _("QOI images cannot be combined with --encoder"));
+  if (dumppath != NULL)
+    {
+      USAGE_ASSERT (all, _("--convert cannot be combined with --device"));
+      all = 0, devno = 0;
+      batch = !stat (dumppath, &attr) && S_ISDIR (attr.st_mode);
+    }
+  if (pipe_to != NULL)
+    {
+      USAGE_ASSERT (filepattern == NULL, _("--pipe-to cannot be combined with FILENAME-PATTERN"));
+      USAGE_ASSERT (exec == NULL, _("--pipe-to cannot be combined with --exec"));
+      USAGE_ASSERT (!use_apng, _("--pipe-to cannot be combined with --apng"));
+      USAGE_ASSERT (!nthumbnails, _("--pipe-to cannot be combined with --thumbnail"));
+      use_consumer = 1;
+    }
+  if (socketpath != NULL)
+    {
+      USAGE_ASSERT (filepattern == NULL, _("--daemon cannot be combined with FILENAME-PATTERN"));
+      USAGE_ASSERT (!have_interval && !have_count, _("--daemon cannot be combined with --count or --interval"));
+      USAGE_ASSERT (exec == NULL, _("--daemon cannot be combined with --exec"));
+      USAGE_ASSERT (pipe_to == NULL, _("--daemon cannot be combined with --pipe-to"));
+      USAGE_ASSERT (dumppath == NULL, _("--daemon cannot be combined with --convert"));
+      USAGE_ASSERT (!simultaneous, _("--daemon cannot be combined with --simultaneous"));
+      USAGE_ASSERT (!use_delta && !use_apng, _("--daemon cannot be combined with --delta or --apng"));
+      USAGE_ASSERT (!use_raw && !have_format, _("--daemon cannot be combined with --raw or --format, the format is selected for each request"));
+      USAGE_ASSERT (!have_scale && !nthumbnails, _("--daemon cannot be combined with --scale or --thumbnail"));
+    }
+  if (batch)
+    {
+      USAGE_ASSERT (!use_consumer, _("--pipe-to cannot be used when converting a directory"));
+      USAGE_ASSERT (frames == 1, _("--count and --interval cannot be used when converting a directory"));
+      USAGE_ASSERT (!use_raw, _("--raw cannot be used when converting a directory"));
+    }
+  else if ((filepattern == NULL) && !use_consumer && (socketpath == NULL))
     {
       if (isatty(STDOUT_FILENO))
-	filepattern = "%Y-%m-%d_%H:%M:%S_$wx$h.$i.png";
+	{
+	  if ((frames == 1) || use_apng)
+	    filepattern = use_raw ? "%Y-%m-%d_%H:%M:%S_$wx$h.$i.raw" :
+			  use_qoi ? "%Y-%m-%d_%H:%M:%S_$wx$h.$i.qoi" : "%Y-%m-%d_%H:%M:%S_$wx$h.$i.png";
+	  else
+	    filepattern = use_raw ? "%Y-%m-%d_%H:%M:%S_$wx$h.$i.$c.raw" :
+			  use_qoi ? "%Y-%m-%d_%H:%M:%S_$wx$h.$i.$c.qoi" : "%Y-%m-%d_%H:%M:%S_$wx$h.$i.$c.png";
+	}
       else
-	USAGE_ASSERT (exec == NULL, _("--exec cannot be combined with piping"));
+	{
+	  USAGE_ASSERT (exec == NULL, _("--exec cannot be combined with piping"));
+	  USAGE_ASSERT (!simultaneous, _("--simultaneous cannot be combined with piping"));
+	  USAGE_ASSERT (!nthumbnails, _("--thumbnail cannot be combined with piping"));
+	  USAGE_ASSERT (!use_apng || !all, _("--apng cannot be combined with piping, unless --device is used"));
+	}
+    }
+  
+  /* Parse the patterns once, rather than for every image. */
+  if (exec != NULL)
+    if (compile_pattern (&execpat, exec, 1) < 0)
+      {
+	if (errno == EINVAL)
+	  EXIT_USAGE (_("Invalid --exec argument"));
+	goto fail;
+      }
+  if (!batch && (filepattern != NULL))
+    if (compile_pattern (&filepat, filepattern, 0) < 0)
+      {
+	if (errno == EINVAL)
+	  EXIT_USAGE (_("Invalid filename pattern"));
+	goto fail;
+      }
+  
+  /* The command for --pipe-to is only evaluated once, so
+     it cannot use the special strings, only strftime. */
+  if (pipe_to != NULL)
+    {
+      if (compile_pattern (&pipepat, pipe_to, 1) < 0)
+	{
+	  if (errno == EINVAL)
+	    EXIT_USAGE (_("Invalid --pipe-to argument"));
+	  goto fail;
+	}
+      for (i = 0; i < pipepat.n; i++)
+	if ((pipepat.parts[i].op != PATTERN_TEXT) && (pipepat.parts[i].op != PATTERN_TIME))
+	  {
+	    free_pattern (&pipepat);
+	    EXIT_USAGE (_("Invalid --pipe-to argument"));
+	  }
+      pipeargs = evaluate (&pipepat, 0, 0, 0, 0, NULL);
+      free_pattern (&pipepat);
+      if ((pipeargs == NULL) || ((pipeargv = split_args (pipeargs)) == NULL))
+	goto fail;
+    }
+  
+  /* Open the file for the statistics, they are printed when each framebuffer is closed. */
+  if (have_stats)
+    {
+      if (init_stats () < 0)
+	goto fail;
+      stats_file = statspath ? fopen (statspath, "w") : stderr;
+      if (stats_file == NULL)
+	FILE_FAILURE (statspath);
+    }
+  
+  /* The commands for the images are run in the background. */
+  if (max_jobs == 0)
+    max_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (max_jobs < 1)
+    max_jobs = 1;
+  if ((exec != NULL) && (init_jobs ((size_t)max_jobs) < 0))
+    goto fail;
+  
+  /* Start the program that the images are sent to. If it exits
+     early, writing to it fails, rather than kills this process. */
+  if (use_consumer)
+    {
+      if (start_consumer (pipeargv) < 0)
+	goto fail;
+      signal (SIGPIPE, SIG_IGN);
     }
   
-  /* Take a screenshot of each framebuffer. */
-  r = save_fbs (filepattern, exec, all, devno);
+  /* Take a screenshot of each framebuffer, or convert each dump,
+     in which case the filename pattern is the output directory. */
+  if (batch)
+    r = convert_dir (dumppath, filepattern, exec ? &execpat : NULL);
+  else
+    r = save_fbs (filepattern ? &filepat : NULL, exec ? &execpat : NULL, all, devno, simultaneous);
+  if (exec != NULL)
+    {
+      /* Wait for the remaining commands, and fail if any command failed. */
+      if ((wait_jobs (NULL) < 0) && (r >= 0))
+	goto fail;
+      child_failed = failed_jobs () > 0;
+      destroy_jobs ();
+      free_pattern (&execpat);
+    }
+  if (use_consumer)
+    {
+      /* Let the program finish, and fail if it failed. */
+      stopped = stop_consumer ();
+      if ((stopped < 0) && (r >= 0))
+	goto fail;
+      child_failed |= (stopped > 0);
+      free (pipeargv);
+      free (pipeargs);
+    }
+  if (!batch && (filepattern != NULL))
+    free_pattern (&filepat);
+  free (thumbnails);
   if (r < 0)
     goto fail;
-  if (r > 0)
+  if ((r > 0) && !batch)
     goto no_fb;
+  if ((statspath != NULL) && fclose (stats_file))
+    FILE_FAILURE (statspath);
   
   /* Warn about being inside a display server. */
-  if (have_display ())
+  if ((dumppath == NULL) && have_display ())
     fprintf (stderr, _("%s: It looks like you are inside a display server. "
 		       "If this is correct, what you see is probably not "
 		       "what you get.\n"), execname);
   
-  return 0;
+  return r ? r : child_failed;
   
  fail:
-  if (failure_file != NULL)
-    fprintf (stderr, _("%s: %s: %s\n"),
-	     execname, strerror (errno), failure_file);
-  else if (errno)
-    perror (execname);
+  report_failure ();
   return 1;
   
  no_fb:
@@ -0,0 +1,359 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE /* For fallocate. */
+#include "common.h"
+#include "sink.h"
+#include "stats.h"
+
+#include <sys/stat.h>
+
+
+
+/*
+ * Rationale:
+ * 
+ *   libpng hands over its output in small pieces, and a `FILE *`
+ *   buffers them in blocks of a few kilobytes, which means
+ *   many calls to write(3) for a large image, each of which
+ *   is made while the compression waits. Writing large blocks,
+ *   in a thread of its own, means few calls, and that the
+ *   compression can continue while the previous block is
+ *   being written. A screenshot that fits in one block is
+ *   written with a single call, without starting a thread.
+ */
+
+
+
+/**
+ * The alignment of the buffers, a page.
+ */
+#define SINK_ALIGNMENT  4096
+
+
+
+/**
+ * Write an entire block to a file.
+ * 
+ * @param   fd       The file descriptor of the file.
+ * @param   buf      The block.
+ * @param   n        The number of bytes in the block.
+ * @param   written  Output parameter for the number of written bytes.
+ * @param   calls    Output parameter for the number of calls to write(3).
+ * @return           Zero on success, the value of `errno` on error.
+ */
+static int
+write_block (int fd, const unsigned char *restrict buf, size_t n,
+	     size_t *restrict written, unsigned long *restrict calls)
+{
+  ssize_t r;
+  
+  *written = 0;
+  *calls = 0;
+  while (*written < n)
+    {
+      r = write (fd, buf + *written, n - *written);
+      ++*calls;
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      if (r == 0)
+	return EIO;
+      *written += (size_t)r;
+    }
+  return 0;
+}
+
+
+/**
+ * The thread that writes the blocks of a sink.
+ * 
+ * @param   arg  The sink.
+ * @return       Nothing.
+ */
+static void *
+sink_thread (void *arg)
+{
+  struct sink *restrict sink = arg;
+  size_t n, written;
+  unsigned long calls;
+  int error;
+  
+  pthread_mutex_lock (&(sink->mutex));
+  for (;;)
+    {
+      while (!sink->pending && !sink->stop)
+	pthread_cond_wait (&(sink->cond), &(sink->mutex));
+      if (!sink->pending)
+	break;
+      n = sink->pending;
+      pthread_mutex_unlock (&(sink->mutex));
+      
+      error = write_block (sink->fd, sink->buffers[1], n, &written, &calls);
+      
+      pthread_mutex_lock (&(sink->mutex));
+      sink->written += written;
+      sink->calls += calls;
+      if (error && !sink->error)
+	sink->error = error;
+      sink->pending = 0;
+      pthread_cond_broadcast (&(sink->cond));
+    }
+  pthread_mutex_unlock (&(sink->mutex));
+  
+  return NULL;
+}
+
+
+/**
+ * Start the thread of a sink.
+ * 
+ * @param   sink  The sink.
+ * @return        Zero on success, -1 on error.
+ */
+static int
+start_thread (struct sink *restrict sink)
+{
+  void *buffer;
+  
+  if ((errno = posix_memalign (&buffer, SINK_ALIGNMENT, SINK_BUFFER_SIZE)))
+    return -1;
+  sink->buffers[1] = buffer;
+  if ((errno = pthread_mutex_init (&(sink->mutex), NULL)))
+    goto fail_mutex;
+  if ((errno = pthread_cond_init (&(sink->cond), NULL)))
+    goto fail_cond;
+  if ((errno = pthread_create (&(sink->thread), NULL, sink_thread, sink)))
+    goto fail_thread;
+  sink->threaded = 1;
+  return 0;
+  
+ fail_thread:
+  pthread_cond_destroy (&(sink->cond));
+ fail_cond:
+  pthread_mutex_destroy (&(sink->mutex));
+ fail_mutex:
+  free (sink->buffers[1]);
+  sink->buffers[1] = NULL;
+  return -1;
+}
+
+
+/**
+ * Write the block that has been filled, and start
+ * on the next. The block is handed over to the thread,
+ * after the thread has written the previous block.
+ * 
+ * @param   sink  The sink.
+ * @return        Zero on success, -1 on error.
+ */
+static int
+flush_block (struct sink *restrict sink)
+{
+  unsigned char *buffer;
+  size_t written = 0;
+  unsigned long calls = 0;
+  enum stage stage;
+  int error;
+  
+  /* Waiting for the thread is time spent writing. */
+  stage = enter_stage (STAGE_WRITE);
+  
+  if (!sink->threaded && (start_thread (sink) < 0))
+    {
+      /* Without a thread, the block can still be written. */
+      error = write_block (sink->fd, sink->buffers[0], sink->fill, &written, &calls);
+    }
+  else
+    {
+      pthread_mutex_lock (&(sink->mutex));
+      while (sink->pending)
+	pthread_cond_wait (&(sink->cond), &(sink->mutex));
+      error = sink->error;
+      if (!error)
+	{
+	  buffer = sink->buffers[1];
+	  sink->buffers[1] = sink->buffers[0];
+	  sink->buffers[0] = buffer;
+	  sink->pending = sink->fill;
+	  pthread_cond_broadcast (&(sink->cond));
+	}
+      written = sink->written, sink->written = 0;
+      calls = sink->calls, sink->calls = 0;
+      pthread_mutex_unlock (&(sink->mutex));
+    }
+  sink->fill = 0;
+  
+  count_write (written, calls);
+  enter_stage (stage);
+  return error ? (errno = error, -1) : 0;
+}
+
+
+/**
+ * Start buffering output to a file descriptor.
+ * 
+ * @param   sink  The sink to initialise.
+ * @param   fd    The file descriptor of the output, it is
+ *                not closed when the sink is closed.
+ * @return        Zero on success, -1 on error.
+ */
+int
+open_sink (struct sink *restrict sink, int fd)
+{
+  void *buffer;
+  
+  memset (sink, 0, sizeof (*sink));
+  sink->fd = fd;
+  if ((errno = posix_memalign (&buffer, SINK_ALIGNMENT, SINK_BUFFER_SIZE)))
+    return -1;
+  sink->buffers[0] = buffer;
+  return 0;
+}
+
+
+/**
+ * Write to a sink.
+ * 
+ * @param   sink  The sink.
+ * @param   data  The data to write.
+ * @param   n     The number of bytes to write.
+ * @return        Zero on success, -1 on error.
+ */
+int
+write_sink (struct sink *restrict sink, const void *restrict data, size_t n)
+{
+  const unsigned char *restrict bytes = data;
+  size_t m;
+  
+  while (n)
+    {
+      m = SINK_BUFFER_SIZE - sink->fill;
+      m = n < m ? n : m;
+      memcpy (sink->buffers[0] + sink->fill, bytes, m);
+      sink->fill += m, bytes += m, n -= m;
+      if ((sink->fill == SINK_BUFFER_SIZE) && (flush_block (sink) < 0))
+	return -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Write everything that is buffered in a sink,
+ * and release its resources.
+ * 
+ * @param   sink  The sink.
+ * @return        Zero on success, -1 on error.
+ */
+int
+close_sink (struct sink *restrict sink)
+{
+  size_t written = 0, last = 0;
+  unsigned long calls = 0, last_calls = 0;
+  enum stage stage;
+  int error = 0;
+  
+  stage = enter_stage (STAGE_WRITE);
+  
+  if (sink->threaded)
+    {
+      pthread_mutex_lock (&(sink->mutex));
+      while (sink->pending)
+	pthread_cond_wait (&(sink->cond), &(sink->mutex));
+      error = sink->error;
+      written = sink->written;
+      calls = sink->calls;
+      sink->stop = 1;
+      pthread_cond_broadcast (&(sink->cond));
+      pthread_mutex_unlock (&(sink->mutex));
+      pthread_join (sink->thread, NULL);
+      pthread_cond_destroy (&(sink->cond));
+      pthread_mutex_destroy (&(sink->mutex));
+    }
+  
+  /* The last block is written here, the
+     caller is waiting for it anyway. */
+  if (!error && sink->fill)
+    error = write_block (sink->fd, sink->buffers[0], sink->fill, &last, &last_calls);
+  
+  count_write (written + last, calls + last_calls);
+  enter_stage (stage);
+  
+  free (sink->buffers[0]);
+  free (sink->buffers[1]);
+  sink->buffers[0] = sink->buffers[1] = NULL;
+  return error ? (errno = error, -1) : 0;
+}
+
+
+/**
+ * Reserve space for a file that is about to be written,
+ * so that the filesystem can allocate it all at once,
+ * rather than bit by bit as the file grows.
+ * 
+ * @param  fd    The file descriptor of the file, which shall be empty.
+ * @param  size  The number of bytes to reserve, zero for none.
+ */
+void
+reserve_space (int fd, size_t size)
+{
+  /* This is only an optimisation, if the file is not a
+     regular file, or if the filesystem does not support
+     it, the file is simply allocated as it grows. */
+  if (size)
+    fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+}
+
+
+/**
+ * Release the space, reserved with `reserve_space`,
+ * that was not used, and get the size to reserve
+ * for the next file, which is expected to be about
+ * as large as this file.
+ * 
+ * @param   fd        The file descriptor of the file.
+ * @param   estimate  The number of bytes that was reserved, zero
+ *                    if none. Set to the size to reserve next.
+ * @return            Zero on success, -1 on error.
+ */
+int
+release_space (int fd, size_t *restrict estimate)
+{
+  struct stat attr;
+  size_t size;
+  
+  if (fstat (fd, &attr))
+    return -1;
+  if (!S_ISREG (attr.st_mode))
+    return *estimate = 0, 0;
+  
+  /* Reserved blocks past the end of the file are kept by
+     the file until it is truncated, even to its own size. */
+  if (*estimate && ((off_t)*estimate > attr.st_size))
+    if (ftruncate (fd, attr.st_size))
+      return -1;
+  
+  /* Leave some room for the next screenshot to grow. */
+  size = (size_t)attr.st_size;
+  *estimate = size + size / 4;
+  return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <pthread.h>
+
+
+
+/**
+ * The size of each of the buffers of a `struct sink`.
+ */
+#define SINK_BUFFER_SIZE  ((size_t)1 << 18)
+
+
+
+/**
+ * Buffered output for an image. The image is written in
+ * large blocks, and once it has outgrown the first block,
+ * the blocks are written by a thread of its own, so that
+ * writing one block overlaps compressing the next.
+ */
+struct sink
+{
+  /**
+   * The file descriptor of the output.
+   */
+  int fd;
+  
+  /**
+   * Whether the thread has been started.
+   */
+  int threaded;
+  
+  /**
+   * The block that is being filled, and the
+   * block that is being written by the thread.
+   */
+  unsigned char *buffers[2];
+  
+  /**
+   * The number of bytes in `buffers[0]`.
+   */
+  size_t fill;
+  
+  /**
+   * The number of bytes in `buffers[1]` that the thread
+   * shall write, zero when the thread is idle.
+   */
+  size_t pending;
+  
+  /**
+   * The number of bytes the thread has
+   * written, that have not been counted.
+   */
+  size_t written;
+  
+  /**
+   * The number of calls the thread has made
+   * to write, that have not been counted.
+   */
+  unsigned long calls;
+  
+  /**
+   * The value of `errno` when the thread
+   * failed to write, zero if it has not.
+   */
+  int error;
+  
+  /**
+   * Set when the thread shall exit.
+   */
+  int stop;
+  
+  /**
+   * The thread that writes the blocks.
+   */
+  pthread_t thread;
+  
+  /**
+   * Mutex for `pending`, `written`, `calls`, `error` and `stop`.
+   */
+  pthread_mutex_t mutex;
+  
+  /**
+   * Signalled when `pending` or `stop` is changed.
+   */
+  pthread_cond_t cond;
+};
+
+
+
+/**
+ * Start buffering output to a file descriptor.
+ * 
+ * @param   sink  The sink to initialise.
+ * @param   fd    The file descriptor of the output, it is
+ *                not closed when the sink is closed.
+ * @return        Zero on success, -1 on error.
+ */
+int open_sink (struct sink *restrict sink, int fd);
+
+/**
+ * Write to a sink.
+ * 
+ * @param   sink  The sink.
+ * @param   data  The data to write.
+ * @param   n     The number of bytes to write.
+ * @return        Zero on success, -1 on error.
+ */
+int write_sink (struct sink *restrict sink, const void *restrict data, size_t n);
+
+/**
+ * Write everything that is buffered in a sink,
+ * and release its resources.
+ * 
+ * @param   sink  The sink.
+ * @return        Zero on success, -1 on error.
+ */
+int close_sink (struct sink *restrict sink);
+
+/**
+ * Reserve space for a file that is about to be written,
+ * so that the filesystem can allocate it all at once,
+ * rather than bit by bit as the file grows.
+ * 
+ * @param  fd    The file descriptor of the file, which shall be empty.
+ * @param  size  The number of bytes to reserve, zero for none.
+ */
+void reserve_space (int fd, size_t size);
+
+/**
+ * Release the space, reserved with `reserve_space`,
+ * that was not used, and get the size to reserve
+ * for the next file, which is expected to be about
+ * as large as this file.
+ * 
+ * @param   fd        The file descriptor of the file.
+ * @param   estimate  The number of bytes that was reserved, zero
+ *                    if none. Set to the size to reserve next.
+ * @return            Zero on success, -1 on error.
+ */
+int release_space (int fd, size_t *restrict estimate);
@@ -0,0 +1,302 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "stats.h"
+
+#include <pthread.h>
+
+
+
+/**
+ * The names of the stages, in the output.
+ */
+static const char *const stage_names[STAGE_COUNT] =
+  {
+    "measure", "read", "convert", "encode", "write", "exec"
+  };
+
+/**
+ * Are statistics being collected?
+ */
+static int enabled = 0;
+
+/**
+ * The statistics each thread is collecting.
+ */
+static pthread_key_t key;
+
+
+
+/**
+ * Start collecting statistics. Until this is
+ * called, the other functions do nothing.
+ * 
+ * This must be called before any thread is started.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int
+init_stats (void)
+{
+  if (enabled)
+    return 0;
+  if ((errno = pthread_key_create (&key, NULL)))
+    return -1;
+  enabled = 1;
+  return 0;
+}
+
+
+/**
+ * Are statistics being collected?
+ * 
+ * @return  Whether `init_stats` has been called.
+ */
+int
+collecting_stats (void)
+{
+  return enabled;
+}
+
+
+/**
+ * Get the number of nanoseconds between two points in time.
+ * 
+ * @param   from  The earlier point in time.
+ * @param   to    The later point in time.
+ * @return        The number of nanoseconds from `from` to `to`.
+ */
+static uint64_t
+nanoseconds (const struct timespec *restrict from, const struct timespec *restrict to)
+{
+  return (uint64_t)((to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec));
+}
+
+
+/**
+ * Select where statistics are collected by the
+ * calling thread, and end its current stage.
+ * 
+ * @param  stats  The statistics, `NULL` for none.
+ */
+void
+use_stats (struct stats *restrict stats)
+{
+  if (!enabled)
+    return;
+  enter_stage (STAGE_NONE);
+  if (stats != NULL)
+    stats->stage = STAGE_NONE;
+  pthread_setspecific (key, stats);
+}
+
+
+/**
+ * Begin a stage, in the calling thread,
+ * and end the thread's current stage.
+ * 
+ * @param   stage  The stage, `STAGE_NONE` to end the current stage only.
+ * @return         The stage that was ended.
+ */
+enum stage
+enter_stage (enum stage stage)
+{
+  struct stats *stats;
+  struct timespec wall, cpu;
+  enum stage ended;
+  
+  if (!enabled || !(stats = pthread_getspecific (key)))
+    return STAGE_NONE;
+  
+  ended = stats->stage;
+  if (clock_gettime (CLOCK_MONOTONIC, &wall) ||
+      clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu))
+    {
+      /* Not worth failing over, the stage is just not counted. */
+      stats->stage = STAGE_NONE;
+      return ended;
+    }
+  
+  if (ended != STAGE_NONE)
+    {
+      stats->wall[ended] += nanoseconds (&(stats->wall_begin), &wall);
+      stats->cpu[ended] += nanoseconds (&(stats->cpu_begin), &cpu);
+    }
+  stats->stage = stage;
+  stats->wall_begin = wall;
+  stats->cpu_begin = cpu;
+  return ended;
+}
+
+
+/**
+ * Count an `ioctl` call on the framebuffer.
+ */
+void
+count_ioctl (void)
+{
+  struct stats *stats;
+  if (enabled && (stats = pthread_getspecific (key)))
+    stats->ioctls++;
+}
+
+
+/**
+ * Count reads from the framebuffer.
+ * 
+ * @param  n      The number of bytes read.
+ * @param  calls  The number of calls made to read them.
+ */
+void
+count_read (size_t n, unsigned long calls)
+{
+  struct stats *stats;
+  if (enabled && (stats = pthread_getspecific (key)))
+    stats->bytes_read += n, stats->reads += calls;
+}
+
+
+/**
+ * Count writes to an output.
+ * 
+ * @param  n      The number of bytes written.
+ * @param  calls  The number of calls made to write them.
+ */
+void
+count_write (size_t n, unsigned long calls)
+{
+  struct stats *stats;
+  if (enabled && (stats = pthread_getspecific (key)))
+    stats->bytes_written += n, stats->writes += calls;
+}
+
+
+/**
+ * Get the statistics the calling thread is collecting.
+ * 
+ * @return  The statistics selected with `use_stats`,
+ *          `NULL` if none or if statistics are not
+ *          being collected.
+ */
+struct stats *
+current_stats (void)
+{
+  return enabled ? pthread_getspecific (key) : NULL;
+}
+
+
+/**
+ * Count the CPU time used by the command for an image.
+ * 
+ * This may be called from any thread, but calls
+ * for the same statistics must be serialised.
+ * 
+ * @param  stats  The statistics, `NULL` for none.
+ * @param  usage  The resource usage of the command.
+ */
+void
+count_exec (struct stats *restrict stats, const struct rusage *restrict usage)
+{
+  if (stats != NULL)
+    stats->exec_cpu += (uint64_t)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000000ULL
+      + (uint64_t)(usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1000ULL;
+}
+
+
+/**
+ * Add statistics to other statistics.
+ * 
+ * @param  stats  The statistics to add to.
+ * @param  other  The statistics to add, they must not be in use.
+ */
+void
+merge_stats (struct stats *restrict stats, const struct stats *restrict other)
+{
+  int i;
+  for (i = 0; i < STAGE_COUNT; i++)
+    {
+      stats->wall[i] += other->wall[i];
+      stats->cpu[i] += other->cpu[i];
+    }
+  stats->exec_cpu += other->exec_cpu;
+  stats->bytes_read += other->bytes_read;
+  stats->bytes_written += other->bytes_written;
+  stats->pixels += other->pixels;
+  stats->images += other->images;
+  stats->ioctls += other->ioctls;
+  stats->reads += other->reads;
+  stats->writes += other->writes;
+}
+
+
+/**
+ * Print statistics as a line of JSON.
+ * 
+ * @param   file    The output.
+ * @param   fbno    The number of the framebuffer.
+ * @param   width   The width of the images.
+ * @param   height  The height of the images.
+ * @param   stats   The statistics.
+ * @return          Zero on success, -1 on error.
+ */
+int
+print_stats (FILE *file, int fbno, long width, long height, const struct stats *restrict stats)
+{
+  struct rusage usage;
+  unsigned long long ratio;
+  char buf[2048];
+  size_t n;
+  int i;
+  
+  if (getrusage (RUSAGE_SELF, &usage))
+    return -1;
+  
+#define P(...)  n += (size_t)snprintf (buf + n, sizeof (buf) - n, __VA_ARGS__)
+  
+  /* Times are printed in whole microseconds, and the ratio
+     in fixed point, so that the locale does not matter.
+     The line is written at once, so that lines written
+     by different threads or processes are not mixed. */
+  n = 0;
+  P ("{\"framebuffer\": %i, \"images\": %lu, \"width\": %li, \"height\": %li, \"stages\": {",
+     fbno, stats->images, width, height);
+  for (i = 0; i < STAGE_COUNT; i++)
+    P ("%s\"%s\": {\"wall_us\": %llu, \"cpu_us\": %llu}", i ? ", " : "", stage_names[i],
+       (unsigned long long)(stats->wall[i] / 1000),
+       (unsigned long long)((stats->cpu[i] + (i == STAGE_EXEC ? stats->exec_cpu : 0)) / 1000));
+  P ("}, \"bytes_read\": %llu, \"bytes_written\": %llu, "
+     "\"syscalls\": {\"ioctl\": %lu, \"read\": %lu, \"write\": %lu}, \"compression_ratio\": ",
+     (unsigned long long)(stats->bytes_read), (unsigned long long)(stats->bytes_written),
+     stats->ioctls, stats->reads, stats->writes);
+  if (stats->bytes_written)
+    {
+      ratio = (unsigned long long)(stats->pixels * 3 * 1000 / stats->bytes_written);
+      P ("%llu.%03llu", ratio / 1000, ratio % 1000);
+    }
+  else
+    P ("null");
+  P (", \"peak_rss_kib\": %li}\n", usage.ru_maxrss);
+  
+#undef P
+  
+  /* The line always fits in the buffer. */
+  if ((fwrite (buf, 1, n, file) != n) || fflush (file))
+    return -1;
+  return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+
+
+/**
+ * The stages of taking a screenshot,
+ * that statistics are collected for.
+ */
+enum stage
+  {
+    /**
+     * Not taking a screenshot.
+     */
+    STAGE_NONE = -1,
+    
+    /**
+     * Opening and measuring the framebuffer.
+     */
+    STAGE_MEASURE,
+    
+    /**
+     * Copying the framebuffer.
+     */
+    STAGE_READ,
+    
+    /**
+     * Converting the copy to PNG pixel data.
+     */
+    STAGE_CONVERT,
+    
+    /**
+     * Compressing the image.
+     */
+    STAGE_ENCODE,
+    
+    /**
+     * Writing the image, or dump, to its output.
+     */
+    STAGE_WRITE,
+    
+    /**
+     * Running the command for the image.
+     */
+    STAGE_EXEC,
+    
+    /**
+     * The number of stages.
+     */
+    STAGE_COUNT
+  };
+
+
+/**
+ * Statistics for the screenshots of a framebuffer.
+ */
+struct stats
+{
+  /**
+   * The number of nanoseconds spent in each stage.
+   */
+  uint64_t wall[STAGE_COUNT];
+  
+  /**
+   * The number of nanoseconds of CPU time spent
+   * in each stage, by the thread that ran it.
+   */
+  uint64_t cpu[STAGE_COUNT];
+  
+  /**
+   * The number of nanoseconds of CPU time spent by the
+   * commands for the images. This is counted by the thread
+   * that waited for the command, and is printed as part
+   * of the CPU time of `STAGE_EXEC`.
+   */
+  uint64_t exec_cpu;
+  
+  /**
+   * The number of bytes read from the framebuffer.
+   */
+  uint64_t bytes_read;
+  
+  /**
+   * The number of bytes written to the outputs.
+   */
+  uint64_t bytes_written;
+  
+  /**
+   * The number of pixels in the images.
+   */
+  uint64_t pixels;
+  
+  /**
+   * The number of images, or frames.
+   */
+  unsigned long images;
+  
+  /**
+   * The number of `ioctl` calls on the framebuffer.
+   */
+  unsigned long ioctls;
+  
+  /**
+   * The number of `read`-like calls on the framebuffer.
+   */
+  unsigned long reads;
+  
+  /**
+   * The number of `write`-like calls on the outputs.
+   */
+  unsigned long writes;
+  
+  /**
+   * The current stage.
+   */
+  enum stage stage;
+  
+  /**
+   * When the current stage began.
+   */
+  struct timespec wall_begin;
+  
+  /**
+   * The thread's CPU time when the current stage began.
+   */
+  struct timespec cpu_begin;
+};
+
+
+
+/**
+ * Start collecting statistics. Until this is
+ * called, the other functions do nothing.
+ * 
+ * This must be called before any thread is started.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int init_stats (void);
+
+/**
+ * Are statistics being collected?
+ * 
+ * @return  Whether `init_stats` has been called.
+ */
+int collecting_stats (void);
+
+/**
+ * Select where statistics are collected by the
+ * calling thread, and end its current stage.
+ * 
+ * @param  stats  The statistics, `NULL` for none.
+ */
+void use_stats (struct stats *restrict stats);
+
+/**
+ * Begin a stage, in the calling thread,
+ * and end the thread's current stage.
+ * 
+ * @param   stage  The stage, `STAGE_NONE` to end the current stage only.
+ * @return         The stage that was ended.
+ */
+enum stage enter_stage (enum stage stage);
+
+/**
+ * Count an `ioctl` call on the framebuffer.
+ */
+void count_ioctl (void);
+
+/**
+ * Count reads from the framebuffer.
+ * 
+ * @param  n      The number of bytes read.
+ * @param  calls  The number of calls made to read them.
+ */
+void count_read (size_t n, unsigned long calls);
+
+/**
+ * Count writes to an output.
+ * 
+ * @param  n      The number of bytes written.
+ * @param  calls  The number of calls made to write them.
+ */
+void count_write (size_t n, unsigned long calls);
+
+/**
+ * Get the statistics the calling thread is collecting.
+ * 
+ * @return  The statistics selected with `use_stats`,
+ *          `NULL` if none or if statistics are not
+ *          being collected.
+ */
+struct stats *current_stats (void);
+
+/**
+ * Count the CPU time used by the command for an image.
+ * 
+ * This may be called from any thread, but calls
+ * for the same statistics must be serialised.
+ * 
+ * @param  stats  The statistics, `NULL` for none.
+ * @param  usage  The resource usage of the command.
+ */
+void count_exec (struct stats *restrict stats, const struct rusage *restrict usage);
+
+/**
+ * Add statistics to other statistics.
+ * 
+ * @param  stats  The statistics to add to.
+ * @param  other  The statistics to add, they must not be in use.
+ */
+void merge_stats (struct stats *restrict stats, const struct stats *restrict other);
+
+/**
+ * Print statistics as a line of JSON.
+ * 
+ * @param   file    The output.
+ * @param   fbno    The number of the framebuffer.
+ * @param   width   The width of the images.
+ * @param   height  The height of the images.
+ * @param   stats   The statistics.
+ * @return          Zero on success, -1 on error.
+ */
+int print_stats (FILE *file, int fbno, long width, long height, const struct stats *restrict stats);
+
@@ -0,0 +1,723 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "png.h"
+#include "strips.h"
+#include "chunk.h"
+#include "reduce.h"
+#include "fastdeflate.h"
+
+#include <pthread.h>
+#include <zlib.h>
+
+
+/*
+ * Rationale:
+ * 
+ *   libpng compresses the image as one deflate stream,
+ *   so only one CPU is used, and that is most of the
+ *   time that is spent on large framebuffers. Like pigz,
+ *   we can cut the image into strips and compress them
+ *   in parallel. Each strip (but the last) ends with a
+ *   sync flush, so that it ends on a byte boundary and
+ *   the strips can simply be concatenated. Each strip
+ *   is primed with the end of the strip before it, so
+ *   the compression ratio is almost unaffected. The
+ *   checksums of the strips are combined, so it is a
+ *   single valid IDAT chunk.
+ * 
+ *   With the built-in encoder, the rows are filtered
+ *   with a choice that is cheap to make, and the strips
+ *   are compressed with `fast_deflate` instead of zlib.
+ */
+
+
+
+/**
+ * The number of bytes to aim for in each strip.
+ */
+#define STRIP_SIZE  (256L << 10)
+
+/**
+ * The size of the deflate window, and thus how much
+ * of the previous strip a strip can refer to.
+ */
+#define WINDOW_SIZE  (32L << 10)
+
+/**
+ * How far apart the bytes are that `filter_row_fast`
+ * compares the filters with.
+ */
+#define FAST_FILTER_SAMPLE  4
+
+
+
+/**
+ * Whether the strips are compressed with
+ * the built-in encoder, rather than zlib.
+ */
+static int fast_encoder = 0;
+
+
+/**
+ * A horizontal strip of the image.
+ */
+struct strip
+{
+  /**
+   * The compressed strip.
+   */
+  unsigned char *out;
+  
+  /**
+   * The size of `out`.
+   */
+  size_t outlen;
+  
+  /**
+   * The size of the filtered strip, before compression.
+   */
+  size_t inlen;
+  
+  /**
+   * The Adler-32 checksum of the filtered strip.
+   */
+  uLong adler;
+  
+  /**
+   * The CRC-32 of the compressed strip.
+   */
+  uLong crc;
+  
+  /**
+   * The index of the first row in the strip.
+   */
+  long first;
+  
+  /**
+   * The number of rows in the strip.
+   */
+  long rows;
+  
+  /**
+   * Zero if the strip has been compressed,
+   * otherwise the `errno` of the failure.
+   */
+  int error;
+};
+
+/**
+ * The job shared by all threads.
+ */
+struct job
+{
+  /**
+   * The entire image.
+   */
+  const png_byte *image;
+  
+  /**
+   * The number of bytes in each row, before filtering.
+   */
+  long rowsize;
+  
+  /**
+   * The number of bytes per pixel, rounded up,
+   * 0 if the rows shall not be filtered.
+   */
+  size_t bpp;
+  
+  /**
+   * The number of bytes between the start
+   * of each row in `image`.
+   */
+  size_t stride;
+  
+  /**
+   * The strips.
+   */
+  struct strip *strips;
+  
+  /**
+   * The number of strips.
+   */
+  size_t n;
+  
+  /**
+   * The index of the next strip to compress.
+   */
+  size_t next;
+  
+  /**
+   * Mutex for `next`.
+   */
+  pthread_mutex_t mutex;
+};
+
+
+
+/**
+ * Filter a row of the image, with the filter type that
+ * probably compresses best, as selected by libpng's
+ * heuristic: the smallest sum of absolute values.
+ * 
+ * The result only depends on the row and the previous
+ * row, so different threads get the same result.
+ * 
+ * @param  out      Output buffer, `rowsize + 1` bytes.
+ * @param  scratch  Scratch buffer, `4 * rowsize` bytes.
+ * @param  row      The row.
+ * @param  prev     The previous row, `NULL` for the first row.
+ * @param  rowsize  The number of bytes in the row.
+ * @param  bpp      The number of bytes per pixel, rounded up, 0 to
+ *                  not filter the row, as recommended for palettes
+ *                  and bit depths lower than 8.
+ */
+static void
+filter_row (unsigned char *restrict out, unsigned char *restrict scratch,
+	    const png_byte *restrict row, const png_byte *restrict prev,
+	    size_t rowsize, size_t bpp)
+{
+#define SUM(V)  (((V) & 128) ? 256 - (V) : (V))
+  
+  unsigned char *restrict f[5];
+  unsigned long sum[5] = {0, 0, 0, 0, 0};
+  size_t i;
+  int a, b, c, p, pa, pb, pc, best, t;
+  
+  if (bpp == 0)
+    {
+      out[0] = 0;
+      memcpy (out + 1, row, rowsize);
+      return;
+    }
+  
+  f[0] = NULL, f[1] = scratch, f[2] = f[1] + rowsize, f[3] = f[2] + rowsize, f[4] = f[3] + rowsize;
+  
+  for (i = 0; i < rowsize; i++)
+    {
+      a = (i < bpp) ? 0 : row[i - bpp];
+      b = prev ? prev[i] : 0;
+      c = (prev && (i >= bpp)) ? prev[i - bpp] : 0;
+      p = a + b - c;
+      pa = abs (p - a), pb = abs (p - b), pc = abs (p - c);
+      p = ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
+      f[1][i] = (unsigned char)(row[i] - a);
+      f[2][i] = (unsigned char)(row[i] - b);
+      f[3][i] = (unsigned char)(row[i] - ((a + b) >> 1));
+      f[4][i] = (unsigned char)(row[i] - p);
+      sum[0] += SUM (row[i]);
+      sum[1] += SUM (f[1][i]);
+      sum[2] += SUM (f[2][i]);
+      sum[3] += SUM (f[3][i]);
+      sum[4] += SUM (f[4][i]);
+    }
+  
+  for (best = 0, t = 1; t < 5; t++)
+    if (sum[t] < sum[best])
+      best = t;
+  
+  out[0] = (unsigned char)best;
+  memcpy (out + 1, best ? f[best] : row, rowsize);
+}
+
+
+/**
+ * Filter a row of the image for the built-in encoder. A
+ * row that is the same as the row above it, which is most
+ * of the rows on a console, is filtered to zeroes. Other
+ * rows are filtered with the difference to the pixel to
+ * the left, so that flat colours are also zeroes, unless
+ * the difference to the pixel above has a clearly smaller
+ * sum of absolute values, over a sample of the row, as in
+ * a vertical gradient. Palette rows are not filtered,
+ * with this encoder, that makes them the smallest.
+ * 
+ * @param  out      Output buffer, `rowsize + 1` bytes.
+ * @param  row      The row.
+ * @param  prev     The previous row, `NULL` for the first row.
+ * @param  rowsize  The number of bytes in the row.
+ * @param  bpp      The number of bytes per pixel, rounded up, 0 to not
+ *                  filter the row, as recommended for palettes and bit
+ *                  depths lower than 8.
+ */
+static void
+filter_row_fast (unsigned char *restrict out, const png_byte *restrict row,
+		 const png_byte *restrict prev, size_t rowsize, size_t bpp)
+{
+  unsigned long sub = 0, up = 0;
+  size_t i;
+  
+  if (prev && !memcmp (row, prev, rowsize))
+    {
+      out[0] = 2;
+      memset (out + 1, 0, rowsize);
+      return;
+    }
+  if (bpp == 0)
+    {
+      out[0] = 0;
+      memcpy (out + 1, row, rowsize);
+      return;
+    }
+  
+  /* A sample of the row is enough to tell the filters apart. */
+  if (prev)
+    for (i = bpp; i < rowsize; i += FAST_FILTER_SAMPLE)
+      {
+	sub += SUM ((unsigned char)(row[i] - row[i - bpp]));
+	up += SUM ((unsigned char)(row[i] - prev[i]));
+      }
+  
+  /* Rows filtered with Sub are more often repeated, for example
+     lines of text, which the encoder can refer back to, so Up
+     must be clearly better to be used. */
+  if (up + up / 4 < sub)
+    {
+      out[0] = 2;
+      for (i = 0; i < rowsize; i++)
+	out[1 + i] = (unsigned char)(row[i] - prev[i]);
+    }
+  else
+    {
+      out[0] = 1;
+      memcpy (out + 1, row, bpp < rowsize ? bpp : rowsize);
+      for (i = bpp; i < rowsize; i++)
+	out[1 + i] = (unsigned char)(row[i] - row[i - bpp]);
+    }
+}
+
+
+/**
+ * Compress a filtered strip with zlib.
+ * 
+ * @param   stream   The deflate stream, it will be reset.
+ * @param   strip    The strip, `out` and `outlen` are set.
+ * @param   in       The filtered strip.
+ * @param   dictlen  The number of bytes of the filtered
+ *                   previous strip, that are before `in`.
+ * @param   last     Whether this is the last strip.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+deflate_strip (z_stream *restrict stream, struct strip *restrict strip,
+	       unsigned char *restrict in, size_t dictlen, int last)
+{
+  size_t size;
+  void *new;
+  int r, flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+  
+  /* Prime the stream with the end of the previous strip. */
+  if (deflateReset (stream) != Z_OK)
+    goto zfail;
+  if (dictlen)
+    {
+      size = dictlen < (size_t)WINDOW_SIZE ? dictlen : (size_t)WINDOW_SIZE;
+      if (deflateSetDictionary (stream, in - size, (uInt)size) != Z_OK)
+	goto zfail;
+    }
+  
+  /* Compress the strip. */
+  size = deflateBound (stream, (uLong)(strip->inlen)) + 16;
+  strip->out = malloc (size);
+  if (strip->out == NULL)
+    return -1;
+  stream->next_in = in;
+  stream->avail_in = (uInt)(strip->inlen);
+  stream->next_out = strip->out;
+  stream->avail_out = (uInt)size;
+  for (;;)
+    {
+      r = deflate (stream, flush);
+      if ((r != Z_OK) && (r != Z_STREAM_END) && (r != Z_BUF_ERROR))
+	goto zfail;
+      if ((flush == Z_FINISH) ? (r == Z_STREAM_END) : (stream->avail_out > 0))
+	break;
+      /* Out of space, which should not happen. */
+      new = realloc (strip->out, size << 1);
+      if (new == NULL)
+	return -1;
+      strip->out = new;
+      stream->next_out = strip->out + (size - stream->avail_out);
+      stream->avail_out += (uInt)size;
+      size <<= 1;
+    }
+  strip->outlen = size - stream->avail_out;
+  return 0;
+  
+ zfail:
+  errno = ENOMEM; /* zlib only fails on allocation error, or on programming error. */
+  return -1;
+}
+
+
+/**
+ * Filter and compress a strip.
+ * 
+ * @param   job      The job.
+ * @param   strip    The strip.
+ * @param   stream   The deflate stream, it will be reset,
+ *                   unused with the built-in encoder.
+ * @param   scratch  Scratch buffer, `4 * rowsize` bytes.
+ * @return           Zero on success, -1 on error.
+ */
+static int
+compress_strip (struct job *restrict job, struct strip *restrict strip,
+		z_stream *restrict stream, unsigned char *restrict scratch)
+{
+  size_t w3 = (size_t)(job->rowsize), rowlen = w3 + 1, dictrows, stride = job->stride;
+  const png_byte *image = job->image;
+  unsigned char *restrict in;
+  unsigned char *dict = NULL;
+  long y, first = strip->first;
+  int last = (strip + 1 == job->strips + job->n), saved_errno;
+  
+  /* Filter the rows in the strip, and the rows in the previous strip
+     that are within the window; they are needed for the dictionary. */
+  dictrows = ((size_t)WINDOW_SIZE + rowlen - 1) / rowlen;
+  if (dictrows > (size_t)first)
+    dictrows = (size_t)first;
+  strip->inlen = (size_t)(strip->rows) * rowlen;
+  dict = malloc ((dictrows * rowlen + strip->inlen) * sizeof (unsigned char));
+  if (dict == NULL)
+    goto fail;
+  for (y = first - (long)dictrows; y < first + strip->rows; y++)
+    if (fast_encoder)
+      filter_row_fast (dict + (size_t)(y - first + (long)dictrows) * rowlen, image + (size_t)y * stride,
+		       y ? image + (size_t)(y - 1) * stride : NULL, w3, job->bpp);
+    else
+      filter_row (dict + (size_t)(y - first + (long)dictrows) * rowlen, scratch, image + (size_t)y * stride,
+		  y ? image + (size_t)(y - 1) * stride : NULL, w3, job->bpp);
+  in = dict + dictrows * rowlen;
+  
+  /* Compress the strip. */
+  if (fast_encoder)
+    {
+      strip->out = malloc (fast_deflate_bound (strip->inlen));
+      if (strip->out == NULL)
+	goto fail;
+      strip->outlen = fast_deflate (strip->out, dict, dictrows * rowlen, strip->inlen, last);
+      if (strip->outlen == 0)
+	goto fail;
+    }
+  else if (deflate_strip (stream, strip, in, dictrows * rowlen, last) < 0)
+    goto fail;
+  
+  /* Calculate the checksums, they are combined later. */
+  strip->adler = adler32 (adler32 (0, NULL, 0), in, (uInt)(strip->inlen));
+  strip->crc = crc32 (crc32 (0, NULL, 0), strip->out, (uInt)(strip->outlen));
+  
+  free (dict);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  free (dict);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Compress strips until all strips are compressed.
+ * 
+ * @param   job_  The job, `struct job *`.
+ * @return        `NULL`.
+ */
+static void *
+compress_strips (void *job_)
+{
+  struct job *job = job_;
+  unsigned char *scratch;
+  z_stream stream;
+  size_t i;
+  int error = 0;
+  
+  memset (&stream, 0, sizeof (stream));
+  scratch = malloc (4 * (size_t)(job->rowsize));
+  if (scratch == NULL)
+    error = errno;
+  else if (!fast_encoder && (deflateInit2 (&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK))
+    free (scratch), scratch = NULL, error = ENOMEM;
+  
+  for (;;)
+    {
+      pthread_mutex_lock (&(job->mutex));
+      i = job->next++;
+      pthread_mutex_unlock (&(job->mutex));
+      if (i >= job->n)
+	break;
+      if (error)
+	job->strips[i].error = error;
+      else if (compress_strip (job, job->strips + i, &stream, scratch) < 0)
+	job->strips[i].error = errno;
+    }
+  
+  if ((scratch != NULL) && !fast_encoder)
+    deflateEnd (&stream);
+  free (scratch);
+  return NULL;
+}
+
+
+/**
+ * Write an image to a PNG file, as a single IDAT or fdAT chunk,
+ * compressing horizontal strips of the image in parallel.
+ * 
+ * @param   file       The output image file.
+ * @param   type       The chunk type, four characters.
+ * @param   prefix     Data to put at the beginning of the chunk, before the
+ *                     image, for example a sequence number, `NULL` for none.
+ * @param   prefixlen  The size of `prefix`.
+ * @param   image      The image.
+ * @param   rowsize    The number of bytes in each row, before filtering.
+ * @param   height     The height of the image.
+ * @param   stride     The number of bytes between the start of each row in `image`.
+ * @param   bpp        The number of bytes per pixel, rounded up, 0 to not
+ *                     filter the rows, as recommended for palettes and bit
+ *                     depths lower than 8.
+ * @param   threads    The number of threads to use.
+ * @return             Zero on success, -1 on error.
+ */
+int
+write_png_image_chunk (FILE *file, const char *type, const unsigned char *restrict prefix,
+		       size_t prefixlen, const png_byte *restrict image, size_t rowsize,
+		       long height, size_t stride, size_t bpp, long threads)
+{
+  static const unsigned char zlib_heads[2][2] = {{0x78, 0x9C}, {0x78, 0x01}};
+  const unsigned char *zlib_head = zlib_heads[fast_encoder];
+  unsigned char adler_buf[4];
+  struct job job;
+  pthread_t *workers = NULL;
+  long rows, started = 0;
+  size_t i, total;
+  uLong adler, crc;
+  int rc = -1, saved_errno = 0;
+  
+  memset (&job, 0, sizeof (job));
+  pthread_mutex_init (&(job.mutex), NULL);
+  job.rowsize = (long)rowsize;
+  job.bpp = bpp;
+  job.stride = stride;
+  job.image = image;
+  
+  /* Cut the image into strips, small enough for each thread to get
+     at least one strip, but not so small that the overhead matters. */
+  rows = STRIP_SIZE / (job.rowsize + 1);
+  if (rows < 1)
+    rows = 1;
+  if ((height + rows - 1) / rows < threads)
+    rows = (height + threads - 1) / threads;
+  job.n = (size_t)((height + rows - 1) / rows);
+  job.strips = calloc (job.n, sizeof (*(job.strips)));
+  if (job.strips == NULL)
+    goto fail;
+  for (i = 0; i < job.n; i++)
+    {
+      job.strips[i].first = (long)i * rows;
+      job.strips[i].rows = (long)i + 1 < (long)(job.n) ? rows : height - (long)i * rows;
+    }
+  
+  /* Compress the strips, this thread is one of the workers. */
+  if ((size_t)threads > job.n)
+    threads = (long)(job.n);
+  workers = malloc ((size_t)threads * sizeof (*workers));
+  if (workers == NULL)
+    goto fail;
+  for (started = 0; started + 1 < threads; started++)
+    if (pthread_create (workers + started, NULL, compress_strips, &job))
+      break;
+  compress_strips (&job);
+  while (started--)
+    pthread_join (workers[started], NULL);
+  
+  /* Combine the checksums of the strips, and get the size of the chunk. */
+  adler = adler32 (0, NULL, 0);
+  crc = crc32 (0, (const Bytef *)type, 4);
+  if (prefixlen)
+    crc = crc32 (crc, prefix, (uInt)prefixlen);
+  crc = crc32 (crc, zlib_head, 2);
+  total = prefixlen + 2 + sizeof (adler_buf);
+  for (i = 0; i < job.n; i++)
+    {
+      if (job.strips[i].error)
+	{
+	  errno = job.strips[i].error;
+	  goto fail;
+	}
+      adler = adler32_combine (adler, job.strips[i].adler, (z_off_t)(job.strips[i].inlen));
+      crc = crc32_combine (crc, job.strips[i].crc, (z_off_t)(job.strips[i].outlen));
+      total += job.strips[i].outlen;
+    }
+  PUT_UINT32 (adler_buf, (uint32_t)adler);
+  crc = crc32 (crc, adler_buf, sizeof (adler_buf));
+  
+  /* Write the chunk. */
+  if (write_png_chunk_head (file, type, total) < 0)
+    goto fail;
+  if (prefixlen && (fwrite (prefix, prefixlen, 1, file) != 1))
+    goto fail;
+  if (fwrite (zlib_head, 2, 1, file) != 1)
+    goto fail;
+  for (i = 0; i < job.n; i++)
+    if (fwrite (job.strips[i].out, job.strips[i].outlen, 1, file) != 1)
+      goto fail;
+  if (fwrite (adler_buf, sizeof (adler_buf), 1, file) != 1)
+    goto fail;
+  if (write_png_crc (file, (uint32_t)crc) < 0)
+    goto fail;
+  
+  rc = 0;
+  goto cleanup;
+ fail:
+  saved_errno = errno;
+ cleanup:
+  if (job.strips != NULL)
+    for (i = 0; i < job.n; i++)
+      free (job.strips[i].out);
+  free (job.strips);
+  free (workers);
+  pthread_mutex_destroy (&(job.mutex));
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Create an PNG file from an image in memory,
+ * compressing horizontal strips of the image in parallel.
+ * 
+ * @param   image    The image, `width * 3 * height` bytes.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   threads  The number of threads to use.
+ * @param   text     The data of a tEXt chunk to add, `NULL` for none.
+ * @param   textlen  The size of `text`.
+ * @return           Zero on success, -1 on error.
+ */
+int
+encode_png_strips (const png_byte *restrict image, long width, long height, int imgfd,
+		   long threads, const char *restrict text, size_t textlen)
+{
+  struct reduction reduction;
+  unsigned char palette[3 * 256];
+  png_byte *reduced = NULL;
+  FILE *file = NULL;
+  size_t rowsize = (size_t)width * 3, bpp = 3;
+  long y;
+  int i, rc = -1, saved_errno;
+  
+  /* Most of the time, 24 bits per pixel is unnecessary. */
+  analyse_image (image, width, height, rowsize, &reduction);
+  if (reduction.colour != PNG_COLOR_TYPE_RGB)
+    {
+      rowsize = reduced_row_size (width, &reduction);
+      reduced = malloc (rowsize * (size_t)height * sizeof (png_byte));
+      if (reduced == NULL)
+	goto fail;
+      for (y = 0; y < height; y++)
+	reduce_row (reduced + (size_t)y * rowsize, image + (size_t)y * (size_t)width * 3, width, &reduction);
+      image = reduced;
+      bpp = (reduction.colour == PNG_COLOR_TYPE_GRAY) && (reduction.depth == 8) ? 1 : 0;
+    }
+  
+  file = fdopen_image (imgfd);
+  if (file == NULL)
+    goto fail;
+  
+  if (write_png_head (file, width, height, reduction.depth, reduction.colour) < 0)
+    goto fail;
+  if (reduction.colour == PNG_COLOR_TYPE_PALETTE)
+    {
+      for (i = 0; i < reduction.ncolours; i++)
+	{
+	  palette[3 * i + 0] = reduction.palette[i].red;
+	  palette[3 * i + 1] = reduction.palette[i].green;
+	  palette[3 * i + 2] = reduction.palette[i].blue;
+	}
+      if (write_png_chunk (file, "PLTE", palette, 3 * (size_t)(reduction.ncolours)) < 0)
+	goto fail;
+    }
+  if ((text != NULL) && (write_png_chunk (file, "tEXt", text, textlen) < 0))
+    goto fail;
+  if (write_png_image_chunk (file, "IDAT", NULL, 0, image, rowsize, height,
+			     rowsize, bpp, threads) < 0)
+    goto fail;
+  if (write_png_chunk (file, "IEND", NULL, 0) < 0)
+    goto fail;
+  
+  /* The end of the file is written when it is closed. */
+  rc = fclose (file) ? -1 : 0;
+  file = NULL;
+ fail:
+  saved_errno = errno;
+  if (file != NULL)
+    fclose (file);
+  free (reduced);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Create an PNG file, compressing horizontal
+ * strips of the image in parallel.
+ * 
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   threads  The number of threads to use.
+ * @param   buffer   Buffer to reuse between images, `NULL` if none.
+ * @return           Zero on success, -1 on error.
+ */
+int
+save_png_strips (int fbfd, long width, long height, int imgfd, void *restrict data,
+		 long threads, struct buffer *restrict buffer)
+{
+  struct buffer local = {NULL, 0};
+  png_byte *image;
+  int rc = -1, saved_errno;
+  
+  /* Read the entire framebuffer, we need all of it at the same time. */
+  image = reserve_buffer (buffer ? buffer : &local, (size_t)width * 3 * (size_t)height * sizeof (png_byte));
+  if ((image != NULL) && (snapshot_fb (fbfd, image, width, data) == 0))
+    rc = encode_png_strips (image, width, height, imgfd, threads, NULL, 0);
+  
+  saved_errno = errno;
+  free (local.buf);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Select whether the strips are compressed with the
+ * built-in encoder, which is several times faster,
+ * but makes the files a little larger, or with zlib.
+ * 
+ * @param  enable  Non-zero for the built-in encoder, zero for zlib.
+ */
+void
+use_fast_encoder (int enable)
+{
+  fast_encoder = enable;
+}
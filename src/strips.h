@@ -0,0 +1,88 @@
+/**
+ * scrotty — Screenshot program for Linux's TTY
+ * 
+ * Copyright © 2014, 2015  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * Defined in png.h.
+ */
+struct buffer;
+
+
+
+/**
+ * Write an image to a PNG file, as a single IDAT or fdAT chunk,
+ * compressing horizontal strips of the image in parallel.
+ * 
+ * @param   file       The output image file.
+ * @param   type       The chunk type, four characters.
+ * @param   prefix     Data to put at the beginning of the chunk, before the
+ *                     image, for example a sequence number, `NULL` for none.
+ * @param   prefixlen  The size of `prefix`.
+ * @param   image      The image.
+ * @param   rowsize    The number of bytes in each row, before filtering.
+ * @param   height     The height of the image.
+ * @param   stride     The number of bytes between the start of each row in `image`.
+ * @param   bpp        The number of bytes per pixel, rounded up, 0 to not
+ *                     filter the rows, as recommended for palettes and bit
+ *                     depths lower than 8.
+ * @param   threads    The number of threads to use.
+ * @return             Zero on success, -1 on error.
+ */
+int write_png_image_chunk (FILE *file, const char *type, const unsigned char *restrict prefix,
+			   size_t prefixlen, const png_byte *restrict image, size_t rowsize,
+			   long height, size_t stride, size_t bpp, long threads);
+
+/**
+ * Create an PNG file from an image in memory,
+ * compressing horizontal strips of the image in parallel.
+ * 
+ * @param   image    The image, `width * 3 * height` bytes.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   threads  The number of threads to use.
+ * @param   text     The data of a tEXt chunk to add, `NULL` for none.
+ * @param   textlen  The size of `text`.
+ * @return           Zero on success, -1 on error.
+ */
+int encode_png_strips (const png_byte *restrict image, long width, long height, int imgfd,
+		       long threads, const char *restrict text, size_t textlen);
+
+/**
+ * Create an PNG file, compressing horizontal
+ * strips of the image in parallel.
+ * 
+ * @param   fbfd     The file descriptor connected to framebuffer device.
+ * @param   width    The width of the image.
+ * @param   height   The height of the image.
+ * @param   imgfd    The file descriptor connected to conversion process's stdin.
+ * @param   data     Additional data for `convert_fb_to_png`.
+ * @param   threads  The number of threads to use.
+ * @param   buffer   Buffer to reuse between images, `NULL` if none.
+ * @return           Zero on success, -1 on error.
+ */
+int save_png_strips (int fbfd, long width, long height, int imgfd, void *restrict data,
+		     long threads, struct buffer *restrict buffer);
+
+/**
+ * Select whether the strips are compressed with the
+ * built-in encoder, which is several times faster,
+ * but makes the files a little larger, or with zlib.
+ * 
+ * @param  enable  Non-zero for the built-in encoder, zero for zlib.
+ */
+void use_fast_encoder (int enable);